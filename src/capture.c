@@ -11,6 +11,7 @@
 #include "common.h"
 
 #include <errno.h>
+#include <signal.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -55,7 +56,7 @@ capture_t *
 new_capture()
 {
     int bufsize = 4096;
-    capture_t *result = malloc(sizeof(capture_t));
+    capture_t *result = calloc(1, sizeof(capture_t));
     if (result == NULL)
         goto err;
     init_dynbuf(&result->childout, bufsize);
@@ -112,12 +113,41 @@ print_cmd(char *const argv[])
     debug("spawning child process: %s", cmd);
 }
 
-capture_t *
-capture_child(const char *file, char *const argv[])
+/* Pass each complete line in dbuf to callback, then keep only the
+ * unfinished last line in dbuf.  At EOF, the last line counts even
+ * without a newline.  Return nonzero if callback asked to stop.
+ */
+static int
+feed_lines(dynbuf *dbuf, line_callback_t callback, void *data)
+{
+    char *start = dbuf->buf;
+    char *end = dbuf->buf + dbuf->len;
+    char *newline;
+    int stop = 0;
+
+    while (!stop && (newline = memchr(start, '\n', end - start)) != NULL) {
+        *newline = '\0';
+        stop = callback(start, newline - start, data);
+        start = newline + 1;
+    }
+    if (!stop && dbuf->eof && start < end) {
+        /* read_dynbuf() has already terminated it */
+        stop = callback(start, end - start, data);
+        start = end;
+    }
+    dbuf->len = end - start;
+    memmove(dbuf->buf, start, dbuf->len);
+    return stop;
+}
+
+static capture_t *
+run_child(const char *file, char *const argv[],
+          line_callback_t callback, void *data)
 {
     int stdout_pipe[] = {-1, -1};
     int stderr_pipe[] = {-1, -1};
     capture_t *result = NULL;
+    pid_t pid = -1;
     if (pipe(stdout_pipe) < 0)
         goto err;
     if (pipe(stderr_pipe) < 0)
@@ -125,7 +155,7 @@ capture_child(const char *file, char *const argv[])
 
     if (debug_mode())
         print_cmd(argv);
-    pid_t pid = fork();
+    pid = fork();
     if (pid < 0) {
         goto err;
     }
@@ -175,6 +205,13 @@ capture_child(const char *file, char *const argv[])
         if (FD_ISSET(cstdout, &child_fds)) {
             if (read_dynbuf(cstdout, &result->childout) < 0)
                 goto err;
+            if (callback != NULL &&
+                feed_lines(&result->childout, callback, data)) {
+                debug("child process %s: rest of output not needed", file);
+                kill(pid, SIGTERM);
+                result->stopped = 1;
+                break;
+            }
         }
         if (FD_ISSET(cstderr, &child_fds)) {
             if (read_dynbuf(cstderr, &result->childerr) < 0)
@@ -183,6 +220,10 @@ capture_child(const char *file, char *const argv[])
         done = result->childout.eof && result->childerr.eof;
     }
 
+    /* closing our ends makes a stopped child fail on its next write */
+    close(cstdout);
+    close(cstderr);
+
     int status;
     waitpid(pid, &status, 0);
     result->status = result->signal = 0;
@@ -194,15 +235,21 @@ capture_child(const char *file, char *const argv[])
     if (result->status != 0)
         debug("child process %s exited with status %d",
               file, result->status);
-    if (result->signal != 0)
+    if (result->signal != 0 && !result->stopped)
         debug("child process %s killed by signal %d",
               file, result->signal);
-    if (result->childerr.len > 0)
+    if (result->childerr.len > 0) {
+        result->childerr.buf[result->childerr.len] = '\0';
         debug("child process %s wrote to stderr:\n%s",
               file, result->childerr.buf);
+    }
 
     return result;
  err:
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
     if (stdout_pipe[0] > -1)
         close(stdout_pipe[0]);
     if (stdout_pipe[1] > -1)
@@ -215,6 +262,19 @@ capture_child(const char *file, char *const argv[])
     return NULL;
 }
 
+capture_t *
+capture_child(const char *file, char *const argv[])
+{
+    return run_child(file, argv, NULL, NULL);
+}
+
+capture_t *
+capture_child_lines(const char *file, char *const argv[],
+                    line_callback_t callback, void *data)
+{
+    return run_child(file, argv, callback, data);
+}
+
 #if 0
 int
 capture_failed(capture_t *capture)
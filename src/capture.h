@@ -15,8 +15,16 @@ typedef struct {
     dynbuf childerr;
     int status;                 /* exit status that child passed (if any) */
     int signal;                 /* signal that killed the child (if any) */
+    int stopped;                /* true if a line callback stopped it */
 } capture_t;
 
+/* Called by capture_child_lines() for each line of the child's stdout,
+ * with the newline replaced by a NUL char.  data is whatever the
+ * caller passed to capture_child_lines().  Return nonzero if the rest
+ * of the output is not needed.
+ */
+typedef int (*line_callback_t)(char *line, size_t len, void *data);
+
 /* fork() and exec() a child process, capturing its entire stdout and
  * stderr to a capture object. Just like with execvp(), argv[0] should
  * be file (unless you are playing funny games) and the last element
@@ -32,6 +40,17 @@ typedef struct {
 capture_t *
 capture_child(const char *file, char *const argv[]);
 
+/* Like capture_child(), but pass the child's stdout to callback one
+ * line at a time as it arrives instead of collecting all of it.  If
+ * callback returns nonzero, the child is terminated (SIGTERM, so git
+ * can clean up its lock files) and reaped at once, and
+ * capture->stopped is set.  On return, capture->childout holds no
+ * useful data.
+ */
+capture_t *
+capture_child_lines(const char *file, char *const argv[],
+                    line_callback_t callback, void *data);
+
 /* free all resources in the object returned by capture_child() */
 void
 free_capture(capture_t *capture);
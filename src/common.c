@@ -11,10 +11,12 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include "common.h"
 
@@ -30,6 +32,7 @@ free_result(result_t *result)
     free(result->branch);
     free(result->revision);
     free(result->patch);
+    free(result->operation);
     free(result->full_revision);
     free(result);
 }
@@ -164,26 +167,39 @@ read_first_line(char *filename, char *buf, int size)
 int
 read_last_line(char *filename, char *buf, int size)
 {
-    FILE *file;
+    struct stat statbuf;
+    const char *data, *start, *end;
+    int fd, len;
 
-    file = fopen(filename, "r");
-    if (file == NULL) {
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
         debug("error opening '%s': %s", filename, strerror(errno));
         return 0;
     }
-
-    buf[0] = '\0';
-    while (fgets(buf, size, file));
-    fclose(file);
-
-    if (!buf[0]) {
+    if (fstat(fd, &statbuf) < 0 || statbuf.st_size == 0) {
         debug("empty line read from '%s'", filename);
+        close(fd);
+        return 0;
+    }
+    data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        debug("failed to mmap() '%s': %s", filename, strerror(errno));
         return 0;
     }
 
-    /* chop trailing newline */
-    chop_newline(buf);
-
+    /* scan back from the end: no need to read all the other lines */
+    end = data + statbuf.st_size;
+    if (end[-1] == '\n')
+        end--;
+    for (start = end; start > data && start[-1] != '\n'; start--)
+        ;
+    len = end - start;
+    if (len > size - 1)
+        len = size - 1;
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    munmap((void *) data, statbuf.st_size);
     return 1;
 }
 
@@ -206,6 +222,63 @@ read_file(const char *filename, char *buf, int size)
     return readsize;
 }
 
+/* Count the '\n' bytes in len bytes at p, a word at a time: the
+ * bytes of x that equal '\n' become zero, and for each zero byte the
+ * bit trick leaves exactly its top bit set.
+ */
+static size_t
+count_newlines(const unsigned char *p, size_t len)
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+    size_t count = 0;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t x;
+        memcpy(&x, p, 8);
+        x ^= ones * '\n';
+        x = ~(((x & low7) + low7) | x | low7);
+        count += ((x >> 7) * ones) >> 56;
+    }
+    for (; len > 0; p++, len--)
+        count += *p == '\n';
+    return count;
+}
+
+long
+count_lines(const char *filename)
+{
+    struct stat statbuf;
+    const unsigned char *data;
+    long count;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        debug("error opening '%s': %s", filename, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &statbuf) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (statbuf.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        debug("failed to mmap() '%s': %s", filename, strerror(errno));
+        return -1;
+    }
+    count = count_newlines(data, statbuf.st_size);
+    if (data[statbuf.st_size - 1] != '\n')
+        count++;                /* unterminated last line */
+    munmap((void *) data, statbuf.st_size);
+    return count;
+}
+
 void
 chop_newline(char *buf)
 {
@@ -238,3 +311,22 @@ get_till_eol(char *dest, const char *src, int nchars)
     strncpy(dest, src, nchars);
     dest[nchars] = '\0';
 }
+
+unsigned int
+get_be16(const unsigned char *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+uint32_t
+get_be32(const unsigned char *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+           ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+uint64_t
+get_be64(const unsigned char *p)
+{
+    return ((uint64_t) get_be32(p) << 32) | get_be32(p + 4);
+}
@@ -10,6 +10,17 @@
 #ifndef VCPROMPT_H
 #define VCPROMPT_H
 
+#include <stdint.h>
+
+/* nanosecond parts of struct stat timestamps */
+#if defined __APPLE__
+#define ST_MTIME_NSEC(st) ((st)->st_mtimespec.tv_nsec)
+#define ST_CTIME_NSEC(st) ((st)->st_ctimespec.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#define ST_CTIME_NSEC(st) ((st)->st_ctim.tv_nsec)
+#endif
+
 /* What the user asked for (environment + command-line).
  */
 typedef struct {
@@ -20,6 +31,14 @@ typedef struct {
     int show_patch;                     /* show patch name? */
     int show_unknown;                   /* show ? if unknown files? */
     int show_modified;                  /* show + if local changes? */
+    int show_staged;                    /* show + if staged changes? */
+    int show_unstaged;                  /* show * if unstaged changes? */
+    int show_ahead_behind;              /* show commits ahead/behind? */
+    int show_operation;                 /* show merge/rebase/...? */
+    int show_conflicts;                 /* show number of conflicts? */
+    int show_stashes;                   /* show number of stashes? */
+    int show_commit_age;                /* show age of last commit? */
+    int show_heads;                     /* show heads of the branch? */
     unsigned int timeout;               /* timeout in milliseconds */
     int show_features;                  /* list builtin features */
 } options_t;
@@ -34,6 +53,19 @@ typedef struct {
     char *patch;                        /* name of current patch */
     int unknown;                        /* any unknown files? */
     int modified;                       /* any local changes? */
+    int staged;                         /* any changes in the index? */
+    int unstaged;                       /* any changes to the index? */
+    int ahead, behind;                  /* commits not in upstream and
+                                           vice versa (-1: unknown) */
+    char *operation;                    /* merge/rebase/... in progress */
+    int conflicts;                      /* unmerged files (-1: unknown) */
+    int stashes;                        /* stashed changes */
+    long commit_time;                   /* when the current revision was
+                                           committed (0: no commits,
+                                           -1: unknown) */
+    int heads;                          /* open heads of the branch
+                                           (-1: unknown) */
+    int at_head;                        /* is the current revision one? */
 
     /* revision ID in VC-specific, not-necessarily-human-readable form */
     void *full_revision;
@@ -107,9 +139,10 @@ isfile(char *name);
 int
 read_first_line(char *filename, char *buf, int size);
 
-/* Open the specified file, reading and discarding every line except the
- * last.  The last line is written to buf (up to size-1 chars) without
- * the newline.  Caller must allocate at least size chars for buf.
+/* Open the specified file and find its last line by scanning back from
+ * the end, so a long file costs no more than a short one.  The last
+ * line is written to buf (up to size-1 chars) without the newline.
+ * Caller must allocate at least size chars for buf.
  * Return value and error handling: same as read_first_line().
  */
 int
@@ -123,6 +156,13 @@ read_last_line(char *filename, char *buf, int size);
 int
 read_file(const char *filename, char *buf, int size);
 
+/* mmap() the specified file and count its lines, without reading them
+ * one by one.  Return -1 (after a debug() message) if the file cannot
+ * be read.
+ */
+long
+count_lines(const char *filename);
+
 /* If the last char of buf is '\n', replace it with '\0', i.e. terminate
  * the string one char earlier.
  */
@@ -143,4 +183,16 @@ dump_hex(char *dest, const char *data, int datasize);
 void
 get_till_eol(char *dest, const char *src, int nchars);
 
+/* Decode a big-endian (network order) integer from p, which need not
+ * be aligned.
+ */
+unsigned int
+get_be16(const unsigned char *p);
+
+uint32_t
+get_be32(const unsigned char *p);
+
+uint64_t
+get_be64(const unsigned char *p);
+
 #endif
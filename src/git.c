@@ -7,31 +7,1183 @@
  * (at your option) any later version.
  */
 
+#include "../config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 #include "git.h"
+#include "gitconfig.h"
+#include "gitfsmonitor.h"
+#include "gitgraph.h"
+#include "githash.h"
+#include "gitindex.h"
+#include "gitobjects.h"
+#include "gitrefs.h"
+#include "gitsparse.h"
+#include "gitstaged.h"
+#include "gituntracked.h"
 #include "capture.h"
 #include "common.h"
 
+/* Where git keeps the files of the working dir in cwd.  .git is
+ * usually a directory, but in a linked worktree or a submodule it is a
+ * file with a "gitdir: <path>" line, and the gitdir of a linked
+ * worktree has a "commondir" file naming the .git it shares.
+ */
+typedef struct {
+    char gitdir[PATH_MAX];              /* HEAD, index, operation state */
+    char commondir[PATH_MAX];           /* config, refs, objects, info */
+    gitconfig_t config;                 /* all of it, includes and all */
+} gitdir_t;
+
+/* Copy the path of name in directory dir to buf and return buf. */
+static char *
+git_path(char *buf, size_t size, const char *dir, const char *name)
+{
+    if (snprintf(buf, size, "%s/%s", dir, name) >= (int) size)
+        debug("path too long: '%s/%s'", dir, name);
+    return buf;
+}
 
+/* Fill in the gitdir and commondir of repo from the .git of the
+ * working dir worktree ("" for cwd, else a path ending in "/", like
+ * "sub/").  Relative paths in a .git file are relative to worktree, and
+ * in a commondir file to the gitdir.  Return 0 if worktree has no .git.
+ */
+static int
+find_git_dirs(gitdir_t *repo, const char *worktree)
+{
+    char buf[PATH_MAX], path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s.git", worktree);
+    if (isdir(path))
+        snprintf(repo->gitdir, sizeof(repo->gitdir), "%s", path);
+    else if (read_first_line(path, buf, sizeof(buf)) &&
+             strncmp(buf, "gitdir: ", 8) == 0 && buf[8] != '\0')
+        snprintf(repo->gitdir, sizeof(repo->gitdir), "%.*s%.*s",
+                 PATH_MAX / 2 - 1, buf[8] == '/' ? "" : worktree,
+                 PATH_MAX / 2 - 1, buf + 8);
+    else
+        return 0;
+
+    git_path(path, sizeof(path), repo->gitdir, "commondir");
+    if (!read_first_line(path, buf, sizeof(buf)) || buf[0] == '\0')
+        strcpy(repo->commondir, repo->gitdir);
+    else if (buf[0] == '/')
+        snprintf(repo->commondir, sizeof(repo->commondir), "%s", buf);
+    else
+        snprintf(repo->commondir, sizeof(repo->commondir), "%.*s/%.*s",
+                 PATH_MAX / 2 - 1, repo->gitdir, PATH_MAX / 2 - 1, buf);
+    return 1;
+}
+
+/* Find the dirs of worktree, as find_git_dirs() does, and read the
+ * config of the repository.  Return 0 if worktree has no .git; else
+ * caller must free repo with free_git_dirs().
+ */
+static int
+open_git_dirs(gitdir_t *repo, const char *worktree)
+{
+    if (!find_git_dirs(repo, worktree))
+        return 0;
+    read_git_config(&repo->config, repo->gitdir, repo->commondir);
+    return 1;
+}
+
+static void
+free_git_dirs(gitdir_t *repo)
+{
+    free_git_config(&repo->config);
+}
+
+/* only git_get_info() needs the config */
 static int
 git_probe(vccontext_t *context)
 {
-    return isdir(".git");
+    gitdir_t repo;
+    return find_git_dirs(&repo, "");
+}
+
+/* Look up key in section of the repository's config (see
+ * read_git_config() for which files that is).  Copy the value to buf
+ * and return 1 if found.
+ */
+static int
+read_config_value(const gitdir_t *repo,
+                  const char *section, const char *key, char *buf, int size)
+{
+    const char *value = git_config_get(&repo->config, section, key);
+    if (value == NULL)
+        return 0;
+    snprintf(buf, size, "%s", value);
+    return 1;
+}
+
+static int
+read_config_bool(const gitdir_t *repo,
+                 const char *section, const char *key, int dflt)
+{
+    const char *value = git_config_get(&repo->config, section, key);
+    return value != NULL ? parse_config_bool(value) : dflt;
+}
+
+/* Size of object IDs in this repository: SHA-256 repositories say so
+ * in extensions.objectFormat.
+ */
+static int
+git_hash_size(const gitdir_t *repo)
+{
+    char buf[64];
+    if (read_config_value(repo, "extensions", "objectformat",
+                          buf, sizeof(buf)) &&
+        strncasecmp(buf, "sha256", 6) == 0)
+        return 32;
+    return 20;
+}
+
+/* Find core.excludesFile, or git's default $XDG_CONFIG_HOME/git/ignore.
+ * Copy its path to buf and return buf, or return NULL if there is none.
+ */
+static char *
+excludes_file(const gitdir_t *repo, char *buf, int size)
+{
+    char value[1024];
+    const char *home = getenv("HOME");
+    const char *xdg = getenv("XDG_CONFIG_HOME");
+
+    if (read_config_value(repo, "core", "excludesfile",
+                          value, sizeof(value))) {
+        if (strncmp(value, "~/", 2) == 0 && home != NULL)
+            snprintf(buf, size, "%s%s", home, value + 1);
+        else
+            snprintf(buf, size, "%s", value);
+    }
+    else if (xdg != NULL && *xdg)
+        snprintf(buf, size, "%s/git/ignore", xdg);
+    else if (home != NULL)
+        snprintf(buf, size, "%s/.config/git/ignore", home);
+    else
+        return NULL;
+    return buf;
+}
+
+/* Whether refs are stored in reftables (extensions.refStorage) rather
+ * than in loose files and packed-refs.
+ */
+static int
+uses_reftable(const gitdir_t *repo)
+{
+    char buf[64];
+    return (read_config_value(repo, "extensions", "refstorage",
+                              buf, sizeof(buf)) &&
+            strcasecmp(buf, "reftable") == 0);
+}
+
+/* Read HEAD: "ref: refs/heads/<branch>", or a commit ID if detached.
+ * Each worktree has its own HEAD; with reftable, it is in the
+ * worktree's own stack, and the HEAD file only holds a placeholder for
+ * old gits.
+ */
+static int
+read_head(const gitdir_t *repo, char *buf, int size)
+{
+    char path[PATH_MAX];
+
+    if (uses_reftable(repo))
+        return read_reftable_ref(git_path(path, sizeof(path), repo->gitdir,
+                                          "reftable"),
+                                 "HEAD", buf, size);
+    return read_first_line(git_path(path, sizeof(path), repo->gitdir, "HEAD"),
+                           buf, size);
+}
+
+/* Read the object ID that refname (e.g. "refs/heads/master") points
+ * to, from its own file or else from packed-refs -- or from the
+ * reftables, following symbolic refs.  Branches are shared by all
+ * worktrees: they are in the common dir.
+ */
+static int
+read_ref(const gitdir_t *repo, const char *refname, char *buf, int size)
+{
+    char filename[PATH_MAX];
+
+    if (uses_reftable(repo)) {
+        char target[1024];
+        git_path(filename, sizeof(filename), repo->commondir, "reftable");
+        snprintf(target, sizeof(target), "%s", refname);
+        for (int depth = 0; depth < 5; depth++) {
+            if (!read_reftable_ref(filename, target, buf, size))
+                return 0;
+            if (strncmp(buf, "ref: ", 5) != 0)
+                return 1;
+            snprintf(target, sizeof(target), "%s", buf + 5);
+        }
+        return 0;
+    }
+    if (read_first_line(git_path(filename, sizeof(filename), repo->commondir,
+                                 refname),
+                        buf, size))
+        return 1;
+    return read_packed_ref(git_path(filename, sizeof(filename),
+                                    repo->commondir, "packed-refs"),
+                           refname, buf, size);
+}
+
+/* Convert the hex object ID hex to hashsize bytes at oid. */
+static int
+parse_oid(const char *hex, unsigned char *oid, int hashsize)
+{
+    for (int i = 0; i < hashsize; i++) {
+        unsigned int byte;
+        if (!isxdigit((unsigned char) hex[2 * i]) ||
+            !isxdigit((unsigned char) hex[2 * i + 1]) ||
+            sscanf(hex + 2 * i, "%2x", &byte) != 1)
+            return 0;
+        oid[i] = byte;
+    }
+    return 1;
+}
+
+/* Find the upstream of branch (from branch.<name>.remote and
+ * branch.<name>.merge, assuming the default fetch refspec) and count
+ * how far the branch is ahead of and behind it, using the commit-graph.
+ * Leave result->ahead and result->behind 0 if there is no upstream;
+ * set them to -1 if the graph cannot tell (e.g. commits made since it
+ * was written).
+ */
+static void
+git_ahead_behind(const gitdir_t *repo, result_t *result, const char *branch)
+{
+    char section[1024], remote[256], merge[1024], upstream[1024];
+    char hex[128], objdir[PATH_MAX];
+    unsigned char head_oid[32], upstream_oid[32];
+    int hashsize = git_hash_size(repo);
+    uint32_t head_pos, upstream_pos;
+    unsigned int ahead, behind;
+
+    snprintf(section, sizeof(section), "branch.%s", branch);
+    if (!read_config_value(repo, section, "remote", remote, sizeof(remote)) ||
+        !read_config_value(repo, section, "merge", merge, sizeof(merge))) {
+        debug("branch '%s' has no upstream", branch);
+        return;
+    }
+    if (strcmp(remote, ".") == 0)
+        snprintf(upstream, sizeof(upstream), "%s", merge);
+    else if (strncmp(merge, "refs/heads/", 11) != 0)
+        goto unknown;
+    else if (snprintf(upstream, sizeof(upstream), "refs/remotes/%s/%s",
+                      remote, merge + 11) >= (int) sizeof(upstream)) {
+        /* cut short, it could name some other ref */
+        debug("upstream of '%s' is too long", branch);
+        goto unknown;
+    }
+
+    snprintf(section, sizeof(section), "refs/heads/%s", branch);
+    if (!read_ref(repo, section, hex, sizeof(hex)) ||
+        !parse_oid(hex, head_oid, hashsize))
+        goto unknown;
+    if (!read_ref(repo, upstream, hex, sizeof(hex))) {
+        debug("upstream '%s' is gone", upstream);
+        return;
+    }
+    if (!parse_oid(hex, upstream_oid, hashsize))
+        goto unknown;
+
+    git_path(objdir, sizeof(objdir), repo->commondir, "objects");
+    commitgraph_t *graph = open_commit_graph(objdir, hashsize);
+    if (graph == NULL)
+        goto unknown;
+    int ok = (find_graph_commit(graph, head_oid, &head_pos) &&
+              find_graph_commit(graph, upstream_oid, &upstream_pos) &&
+              graph_ahead_behind(graph, head_pos, upstream_pos,
+                                 &ahead, &behind));
+    free_commit_graph(graph);
+    if (!ok) {
+        debug("'%s' or '%s' is not in the commit-graph", branch, upstream);
+        goto unknown;
+    }
+    debug("'%s' is %u ahead of, %u behind '%s'",
+          branch, ahead, behind, upstream);
+    result->ahead = ahead;
+    result->behind = behind;
+    return;
+
+ unknown:
+    result->ahead = result->behind = -1;
+}
+
+/* Find the binary ID of the commit that HEAD (as read_head() read it)
+ * points to.  Return 1 on success, 0 if HEAD has no commits yet, -1 on
+ * error.
+ */
+static int
+head_commit(const gitdir_t *repo, const char *head,
+            unsigned char *oid, int hashsize)
+{
+    char hex[128];
+
+    if (strncmp(head, "ref: ", 5) != 0)
+        snprintf(hex, sizeof(hex), "%.100s", head);
+    else if (!read_ref(repo, head + 5, hex, sizeof(hex))) {
+        debug("'%s' has no commits yet", head + 5);
+        return 0;
+    }
+    return parse_oid(hex, oid, hashsize) ? 1 : -1;
+}
+
+/* Find the root tree of commit oid, from the commit-graph or else the
+ * commit object: "tree <hex>" is always its first line.
+ */
+static int
+commit_tree(const char *objdir, const unsigned char *oid,
+            unsigned char *tree, int hashsize)
+{
+    commitgraph_t *graph = open_commit_graph(objdir, hashsize);
+    uint32_t pos;
+    if (graph != NULL) {
+        int found = find_graph_commit(graph, oid, &pos);
+        if (found)
+            memcpy(tree, graph_commit_tree(graph, pos), hashsize);
+        free_commit_graph(graph);
+        if (found)
+            return 1;
+    }
+
+    gitobjects_t *objects = open_git_objects(objdir, hashsize);
+    char type[16], *buf = NULL;
+    int ok = (objects != NULL &&
+              read_git_object(objects, oid, type, sizeof(type),
+                              &buf, 5 + 2 * hashsize) >= 0 &&
+              strcmp(type, "commit") == 0 &&
+              strncmp(buf, "tree ", 5) == 0 &&
+              parse_oid(buf + 5, tree, hashsize));
+    free(buf);
+    free_git_objects(objects);
+    return ok;
+}
+
+/* Decide whether the index has staged changes natively, by comparing
+ * it with HEAD's tree.  Return 1, 0, or -1 to ask git.
+ */
+static int
+git_staged(const gitdir_t *repo, const gitindex_t *index, const char *head)
+{
+    char objdir[PATH_MAX];
+    unsigned char oid[32], tree[32];
+    int found = head_commit(repo, head, oid, index->hashsize);
+
+    git_path(objdir, sizeof(objdir), repo->commondir, "objects");
+    if (found < 0)
+        return -1;
+    if (found == 0)
+        return staged_changes(index, NULL, objdir);
+    if (!commit_tree(objdir, oid, tree, index->hashsize)) {
+        debug("cannot find the tree of HEAD");
+        return -1;
+    }
+    return staged_changes(index, tree, objdir);
+}
+
+/* Find when the commit that HEAD points to was made.  The last line of
+ * HEAD's reflog,
+ *   <old> <new> <name> <<email>> <time> <zone>\t<message>
+ * has it if it records that very commit being made ("commit: ...",
+ * "commit (amend): ..."), since checkouts and resets are logged with
+ * their own time.  Otherwise look the commit up in the commit-graph, or
+ * inflate the start of the commit object.  Return 0 if HEAD has no
+ * commits yet, -1 if we cannot tell.
+ */
+static long
+git_commit_time(const gitdir_t *repo, const char *head)
+{
+    char hex[2 * 32 + 1], line[2048], path[PATH_MAX];
+    unsigned char oid[32];
+    int hashsize = git_hash_size(repo);
+    long when;
+    int found = head_commit(repo, head, oid, hashsize);
+
+    if (found <= 0)
+        return found;
+    dump_hex(hex, (const char *) oid, hashsize);
+
+    if (read_last_line(git_path(path, sizeof(path), repo->gitdir,
+                                "logs/HEAD"),
+                       line, sizeof(line)) &&
+        strlen(line) > (size_t) (4 * hashsize + 2) &&
+        strncmp(line + 2 * hashsize + 1, hex, 2 * hashsize) == 0) {
+        char *tab = strchr(line, '\t'), *gt = NULL;
+        for (char *p = line; p < tab; p++) {
+            if (*p == '>')
+                gt = p;
+        }
+        if (gt != NULL && strncmp(tab + 1, "commit", 6) == 0) {
+            when = strtol(gt + 1, NULL, 10);
+            debug("reflog: HEAD committed at %ld", when);
+            return when;
+        }
+    }
+
+    git_path(path, sizeof(path), repo->commondir, "objects");
+    commitgraph_t *graph = open_commit_graph(path, hashsize);
+    if (graph != NULL) {
+        uint32_t pos;
+        int found = find_graph_commit(graph, oid, &pos);
+        if (found)
+            when = graph_commit_time(graph, pos);
+        free_commit_graph(graph);
+        if (found) {
+            debug("commit-graph: HEAD committed at %ld", when);
+            return when;
+        }
+    }
+
+    gitobjects_t *objects = open_git_objects(path, hashsize);
+    if (objects == NULL)
+        return -1;
+    char type[16], *buf = NULL;
+    long len;
+    /* the committer line comes after tree, parents and author: 4 KiB
+     * is plenty unless it is a huge octopus merge */
+    when = -1;
+    len = read_git_object(objects, oid, type, sizeof(type), &buf, 4096);
+    if (len >= 0 && strcmp(type, "commit") == 0 &&
+        !parse_commit_time(buf, &when) && len == 4096) {
+        free(buf);
+        buf = NULL;
+        len = read_git_object(objects, oid, type, sizeof(type), &buf, 0);
+        if (len < 0 || !parse_commit_time(buf, &when))
+            when = -1;
+    }
+    free(buf);
+    free_git_objects(objects);
+    debug("objects: HEAD committed at %ld", when);
+    return when;
+}
+
+/* Read a step counter such as rebase-merge/msgnum in gitdir. */
+static int
+read_step(const char *gitdir, const char *name)
+{
+    char buf[64], path[PATH_MAX];
+    if (!read_first_line(git_path(path, sizeof(path), gitdir, name),
+                         buf, sizeof(buf)))
+        return 0;
+    return atoi(buf);
+}
+
+/* Return true if name exists in gitdir, as a file (dir is 0) or a
+ * directory (dir is 1). */
+static int
+git_exists(const char *gitdir, const char *name, int dir)
+{
+    char path[PATH_MAX];
+    git_path(path, sizeof(path), gitdir, name);
+    return dir ? isdir(path) : isfile(path);
+}
+
+/* Work out what git operation is in progress, the way git's own
+ * git-prompt.sh does, and store it in result->operation: "MERGING",
+ * "REBASE 2/5", etc.
+ */
+static void
+git_operation(const gitdir_t *repo, result_t *result)
+{
+    const char *gitdir = repo->gitdir;
+    char buf[64];
+    const char *op = NULL;
+    int step = 0, total = 0;
+
+    if (git_exists(gitdir, "rebase-merge", 1)) {
+        op = "REBASE";
+        step = read_step(gitdir, "rebase-merge/msgnum");
+        total = read_step(gitdir, "rebase-merge/end");
+    }
+    else if (git_exists(gitdir, "rebase-apply", 1)) {
+        if (git_exists(gitdir, "rebase-apply/rebasing", 0))
+            op = "REBASE";
+        else if (git_exists(gitdir, "rebase-apply/applying", 0))
+            op = "AM";
+        else
+            op = "AM/REBASE";
+        step = read_step(gitdir, "rebase-apply/next");
+        total = read_step(gitdir, "rebase-apply/last");
+    }
+    else if (git_exists(gitdir, "MERGE_HEAD", 0))
+        op = "MERGING";
+    else if (git_exists(gitdir, "CHERRY_PICK_HEAD", 0))
+        op = "CHERRY-PICKING";
+    else if (git_exists(gitdir, "REVERT_HEAD", 0))
+        op = "REVERTING";
+    else if (git_exists(gitdir, "BISECT_LOG", 0))
+        op = "BISECTING";
+    if (op == NULL)
+        return;
+
+    if (step > 0 && total > 0)
+        snprintf(buf, sizeof(buf), "%s %d/%d", op, step, total);
+    else
+        snprintf(buf, sizeof(buf), "%s", op);
+    debug("operation in progress: %s", buf);
+    result->operation = strdup(buf);
+}
+
+/* Count the paths with unmerged (stage > 0) entries in index, as
+ * "git status" would list them.  Return -1 if the index is corrupt.
+ */
+static int
+count_conflicts(const gitindex_t *index)
+{
+    gitindex_cursor_t cursor;
+    char *last = NULL;
+    int status, count = 0;
+
+    init_index_cursor(&cursor, index);
+    while ((status = next_index_entry(&cursor)) > 0) {
+        gitindex_entry_t *entry = &cursor.entry;
+        if (CE_STAGE(entry->flags) == 0)
+            continue;
+        /* the stages of a path are next to each other */
+        if (last != NULL && strcmp(last, entry->path) == 0)
+            continue;
+        free(last);
+        last = strdup(entry->path);
+        count++;
+    }
+    free(last);
+    free_index_cursor(&cursor);
+    if (status < 0)
+        return -1;
+    debug("index: %d unmerged paths", count);
+    return count;
+}
+
+/* Number of threads to scan the index with, per index.threads: true
+ * or 0 means one per CPU, false or 1 means just this one.
+ */
+static int
+index_threads(const gitdir_t *repo)
+{
+    char buf[64];
+    int nthreads = 0;
+
+    if (read_config_value(repo, "index", "threads", buf, sizeof(buf))) {
+        if (!read_config_bool(repo, "index", "threads", 1))
+            return 1;
+        nthreads = atoi(buf);
+    }
+    if (nthreads <= 0) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpus > 0 ? ncpus : 1;
+    }
+    return nthreads;
+}
+
+/* Number of threads to walk the working dir for untracked files with:
+ * just this one, which keeps memory bounded by the depth of the tree,
+ * unless index.threads asks for more by number.
+ */
+static int
+walk_threads(const gitdir_t *repo)
+{
+    char buf[64];
+
+    if (read_config_value(repo, "index", "threads", buf, sizeof(buf)) &&
+        atoi(buf) > 1)
+        return atoi(buf);
+    return 1;
+}
+
+/* The submodules of the index (its gitlink entries), which are
+ * checked by up to index.threads threads at once once the files of the
+ * superproject turn out clean.  The first dirty one stops them all.
+ */
+typedef struct {
+    char *path;                         /* "sub", relative to cwd */
+    unsigned char oid[32];              /* commit recorded in the index */
+    int ignore_dirty;                   /* only compare HEAD */
+} submodule_t;
+
+typedef struct {
+    submodule_t *items;
+    size_t count, size;
+    size_t next;                        /* next one to check */
+    int hashsize;
+    int result;                         /* 1 found, -1 gave up */
+#if HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+} submodule_scan_t;
+
+typedef struct {
+    const gitindex_t *index;
+    const fsmonitor_t *fsmonitor;       /* NULL if none */
+    int trust_exec_bit;
+    int trust_ctime;
+    int check_stat;
+    int may_convert;                    /* the files might be filtered
+                                           on the way to the index */
+    const char *prefix;                 /* "" or "sub/": where the
+                                           working dir of index is */
+    submodule_scan_t *submodules;       /* to collect gitlinks into, or
+                                           NULL (in a submodule) */
+    submodule_scan_t *outer;            /* the scan of the submodules
+                                           this one is part of */
+    unsigned int nchecked;
+} modified_scan_t;
+
+/* Which stat data of the index entries to compare, as git does:
+ * core.fileMode for the exec bit, core.trustCtime for the ctime, and
+ * core.checkStat=minimal for just the mtime seconds and the size.
+ */
+static void
+read_stat_config(const gitdir_t *repo, modified_scan_t *scan)
+{
+    char buf[64];
+
+    scan->trust_exec_bit = read_config_bool(repo, "core", "filemode", 1);
+    scan->trust_ctime = read_config_bool(repo, "core", "trustctime", 1);
+    scan->check_stat = !(read_config_value(repo, "core", "checkstat",
+                                           buf, sizeof(buf)) &&
+                         strcmp(buf, "minimal") == 0);
+}
+
+/* Whether git might convert files on their way into the index, so
+ * that a file whose raw content does not hash to its entry's object
+ * ID may still be clean: core.autocrlf, or attributes files outside
+ * the working dir, which could set "text", "eol", "ident" or a filter.
+ */
+static int
+may_convert(const gitdir_t *repo)
+{
+    char value[1024], path[PATH_MAX];
+    const char *home = getenv("HOME");
+    const char *xdg = getenv("XDG_CONFIG_HOME");
+    struct stat statbuf;
+
+    if (read_config_value(repo, "core", "autocrlf", value, sizeof(value)) &&
+        (strcasecmp(value, "input") == 0 || parse_config_bool(value)))
+        return 1;
+    if (stat(git_path(path, sizeof(path), repo->commondir, "info/attributes"),
+             &statbuf) == 0)
+        return 1;
+    if (read_config_value(repo, "core", "attributesfile",
+                          value, sizeof(value))) {
+        if (strncmp(value, "~/", 2) == 0 && home != NULL)
+            snprintf(path, sizeof(path), "%s%s", home, value + 1);
+        else
+            snprintf(path, sizeof(path), "%s", value);
+    }
+    else if (xdg != NULL && *xdg)
+        snprintf(path, sizeof(path), "%s/git/attributes", xdg);
+    else if (home != NULL)
+        snprintf(path, sizeof(path), "%s/.config/git/attributes", home);
+    else
+        return 0;
+    return stat(path, &statbuf) == 0;
+}
+
+/* Whether there is a .gitattributes in the working dir that applies
+ * to the entry at path (relative to the top of the superproject; the
+ * entry's own path starts at offset start).
+ */
+static int
+has_attributes(const char *path, size_t start)
+{
+    char buf[PATH_MAX];
+    struct stat statbuf;
+
+    for (size_t len = start; ; len++) {
+        if (len == start || path[len - 1] == '/') {
+            if (snprintf(buf, sizeof(buf), "%.*s.gitattributes",
+                         (int) len, path) >= (int) sizeof(buf) ||
+                lstat(buf, &statbuf) == 0)
+                return 1;
+        }
+        if (path[len] == '\0')
+            return 0;
+    }
+}
+
+/* Settle a racy entry the way git does: hash the file as a blob and
+ * compare it with the entry's object ID.  Only the handful of files
+ * touched just before the index was written are ever read.
+ */
+static int
+content_changed(const modified_scan_t *scan, const gitindex_entry_t *entry,
+                const char *path, const struct stat *statbuf)
+{
+    unsigned char oid[32];
+
+    if (!hash_blob_file(path, statbuf, scan->index->hashsize, oid))
+        return -1;
+    if (memcmp(oid, entry->oid, scan->index->hashsize) == 0)
+        return 0;
+    if (S_ISREG(statbuf->st_mode) &&
+        (scan->may_convert || has_attributes(path, strlen(scan->prefix)))) {
+        debug("index: '%s' might be converted: cannot tell", path);
+        return -1;
+    }
+    return 1;
+}
+
+static void
+submodule_lock(submodule_scan_t *subs)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_lock(&subs->lock);
+#endif
+}
+
+static void
+submodule_unlock(submodule_scan_t *subs)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_unlock(&subs->lock);
+#endif
+}
+
+static int
+add_submodule(submodule_scan_t *subs, const gitindex_entry_t *entry)
+{
+    int ok = 0;
+
+    submodule_lock(subs);
+    if (subs->count == subs->size) {
+        size_t size = subs->size ? subs->size * 2 : 16;
+        submodule_t *items = realloc(subs->items, size * sizeof(submodule_t));
+        if (items == NULL)
+            goto done;
+        subs->items = items;
+        subs->size = size;
+    }
+    submodule_t *sub = &subs->items[subs->count];
+    if ((sub->path = strdup(entry->path)) == NULL)
+        goto done;
+    memcpy(sub->oid, entry->oid, subs->hashsize);
+    sub->ignore_dirty = 0;
+    subs->count++;
+    ok = 1;
+ done:
+    submodule_unlock(subs);
+    return ok;
+}
+
+/* index_visitor_t for index_modified(); may run in several threads */
+static int
+check_entry(const gitindex_entry_t *entry, unsigned int pos, void *data)
+{
+    modified_scan_t *scan = data;
+    struct stat statbuf;
+    char buf[PATH_MAX];
+    const char *path = entry->path;
+
+    if (CE_STAGE(entry->flags) != 0 ||
+        (entry->flags & CE_INTENT_TO_ADD)) {
+        debug("index: '%s' is unmerged or intent-to-add", entry->path);
+        return 1;
+    }
+    if ((entry->flags & CE_VALID) ||
+        (entry->flags & CE_SKIP_WORKTREE))
+        return 0;               /* assume-unchanged, or outside the
+                                   sparse checkout (even a whole sparse
+                                   directory) */
+    if ((entry->mode & GIT_MODE_TYPE) == GIT_MODE_GITLINK) {
+        /* a submodule: checked later (nested ones are not) */
+        if (scan->submodules != NULL && !add_submodule(scan->submodules, entry))
+            return -1;
+        return 0;
+    }
+    if (scan->fsmonitor != NULL &&
+        !fsmonitor_needs_check(scan->fsmonitor, pos, entry->path))
+        return 0;
+
+    if (scan->outer != NULL && ++scan->nchecked % 256 == 0) {
+        /* another submodule is dirty already? */
+        submodule_lock(scan->outer);
+        int over = scan->outer->result > 0;
+        submodule_unlock(scan->outer);
+        if (over)
+            return 1;
+    }
+    if (*scan->prefix != '\0') {
+        if (snprintf(buf, sizeof(buf), "%s%s", scan->prefix, entry->path) >=
+            (int) sizeof(buf))
+            return -1;
+        path = buf;
+    }
+    if (lstat(path, &statbuf) < 0) {
+        debug("index: failed to stat '%s'", path);
+        return 1;
+    }
+    int changed = index_entry_changed(scan->index, entry, &statbuf,
+                                      scan->trust_exec_bit, scan->trust_ctime,
+                                      scan->check_stat);
+    if (changed < 0) {
+        debug("index: '%s' is racy: hashing it", path);
+        changed = content_changed(scan, entry, path, &statbuf);
+    }
+    if (changed > 0)
+        debug("index: '%s' has changed", path);
+    return changed;
+}
+
+/* Check one submodule, as "git status" does: is its HEAD still the
+ * commit recorded in the superproject's index, and do its files still
+ * match its own index?  Untracked files in it are not looked for.
+ * Return 1 if dirty, 0 if clean (or not checked out), -1 if we cannot
+ * tell.
+ */
+static int
+submodule_modified(submodule_scan_t *subs, const submodule_t *sub)
+{
+    char prefix[PATH_MAX], head[1024], path[PATH_MAX];
+    unsigned char oid[32];
+    gitdir_t repo;
+    modified_scan_t scan;
+    int result = -1;
+
+    snprintf(prefix, sizeof(prefix), "%s/", sub->path);
+    if (!open_git_dirs(&repo, prefix)) {
+        /* not checked out (an empty directory), or removed */
+        struct stat statbuf;
+        return lstat(sub->path, &statbuf) < 0 ? 1 : 0;
+    }
+    if (!read_head(&repo, head, sizeof(head)) ||
+        head_commit(&repo, head, oid, subs->hashsize) <= 0)
+        goto done;
+    if (memcmp(oid, sub->oid, subs->hashsize) != 0) {
+        debug("submodule '%s': HEAD is not the recorded commit", sub->path);
+        result = 1;
+        goto done;
+    }
+    if (sub->ignore_dirty) {
+        result = 0;
+        goto done;
+    }
+
+    gitindex_t *index = open_git_index(
+        git_path(path, sizeof(path), repo.gitdir, "index"), subs->hashsize);
+    if (index == NULL)
+        goto done;
+    memset(&scan, 0, sizeof(scan));
+    scan.index = index;
+    read_stat_config(&repo, &scan);
+    scan.may_convert = may_convert(&repo);
+    scan.prefix = prefix;
+    scan.outer = subs;
+    result = scan_index(index, 1, check_entry, &scan);
+    free_git_index(index);
+    if (result > 0)
+        debug("submodule '%s' is dirty", sub->path);
+
+ done:
+    free_git_dirs(&repo);
+    return result;
+}
+
+static void *
+submodule_worker(void *arg)
+{
+    submodule_scan_t *subs = arg;
+
+    while (1) {
+        submodule_lock(subs);
+        if (subs->result > 0 || subs->next == subs->count) {
+            submodule_unlock(subs);
+            break;
+        }
+        const submodule_t *sub = &subs->items[subs->next++];
+        submodule_unlock(subs);
+
+        int result = submodule_modified(subs, sub);
+        submodule_lock(subs);
+        if (result > 0)
+            subs->result = 1;
+        else if (result < 0 && subs->result == 0)
+            subs->result = -1;
+        submodule_unlock(subs);
+    }
+    return NULL;
+}
+
+/* Read how much of submodule path "git status" must look at: from
+ * diff.ignoreSubmodules, which overrides submodule.<name>.ignore in the
+ * config or else .gitmodules (taking the name to be the path, as "git
+ * submodule add" makes it).  Return "none", "untracked", "dirty" or
+ * "all" in buf.
+ */
+static void
+submodule_ignore(const gitdir_t *repo, const char *path, char *buf, int size)
+{
+    char section[PATH_MAX];
+    gitconfig_t modules;
+    const char *value;
+
+    snprintf(section, sizeof(section), "submodule.%s", path);
+    if (read_config_value(repo, "diff", "ignoresubmodules", buf, size) ||
+        read_config_value(repo, section, "ignore", buf, size))
+        return;
+    /* .gitmodules has no includes */
+    memset(&modules, 0, sizeof(modules));
+    read_config_file(&modules, ".gitmodules", 0);
+    value = git_config_get(&modules, section, "ignore");
+    snprintf(buf, size, "%s", value != NULL ? value : "none");
+    free_git_config(&modules);
+}
+
+/* Check the submodules in subs with up to nthreads threads.  Return 1
+ * at the first dirty one, 0 if all are clean, -1 if we cannot tell.
+ */
+static int
+submodules_modified(const gitdir_t *repo, submodule_scan_t *subs,
+                    int nthreads)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < subs->count; i++) {
+        char ignore[64];
+        submodule_t *sub = &subs->items[i];
+        submodule_ignore(repo, sub->path, ignore, sizeof(ignore));
+        if (strcasecmp(ignore, "all") == 0) {
+            free(sub->path);
+            continue;
+        }
+        sub->ignore_dirty = (strcasecmp(ignore, "dirty") == 0);
+        subs->items[n++] = *sub;
+    }
+    subs->count = n;
+    if (nthreads > (int) subs->count)
+        nthreads = subs->count;
+    if (nthreads > MAX_INDEX_THREADS)
+        nthreads = MAX_INDEX_THREADS;
+    debug("checking %zu submodules with %d threads", subs->count, nthreads);
+
+#if HAVE_PTHREAD
+    pthread_t tids[MAX_INDEX_THREADS];
+    int nstarted = 0;
+
+    for (int i = 1; i < nthreads; i++) {
+        if (pthread_create(&tids[i], NULL, submodule_worker, subs) != 0)
+            break;
+        nstarted++;
+    }
+    submodule_worker(subs);
+    for (int i = 1; i <= nstarted; i++)
+        pthread_join(tids[i], NULL);
+#else
+    submodule_worker(subs);
+#endif
+    return subs->result;
+}
+
+/* Return 1 if dir belongs to the current user: or, under sudo, to the
+ * user who ran it, as git allows.
+ */
+static int
+owned_by_user(const char *dir)
+{
+    struct stat statbuf;
+    const char *sudo_uid = getenv("SUDO_UID");
+
+    if (lstat(dir, &statbuf) < 0)
+        return 0;
+    if (statbuf.st_uid == geteuid())
+        return 1;
+    return (geteuid() == 0 && sudo_uid != NULL && *sudo_uid &&
+            statbuf.st_uid == (uid_t) strtoul(sudo_uid, NULL, 10));
+}
+
+/* Whether to run a program that the repository's config names, like a
+ * core.fsmonitor hook: whoever can write that config could otherwise
+ * run anything in every prompt shown in the working dir.  Like git,
+ * only trust a repository whose working dir and git dirs the user
+ * owns, or that safe.directory in the system or global config lists:
+ * as "*", as the working dir, or as a dir above it followed by a "*"
+ * component.
+ */
+static int
+repo_is_trusted(const gitdir_t *repo)
+{
+    gitconfig_t config;
+    char cwd[PATH_MAX], path[PATH_MAX];
+    const char *home = getenv("HOME");
+    int trusted = 0;
+
+    if (owned_by_user(".") && owned_by_user(repo->gitdir) &&
+        owned_by_user(repo->commondir))
+        return 1;
+    if (realpath(".", cwd) == NULL)
+        return 0;
+
+    read_protected_git_config(&config);
+    for (size_t i = 0; i < config.count; i++) {
+        const config_entry_t *entry = config.entries[i];
+        const char *value = entry->value;
+        size_t len;
+
+        if (strcmp(entry->section, "safe") != 0 ||
+            entry->subsection != NULL ||
+            strcmp(entry->name, "directory") != 0 || value == NULL)
+            continue;
+        if (value[0] == '\0') {        /* resets the list */
+            trusted = 0;
+            continue;
+        }
+        if (strcmp(value, "*") == 0) {
+            trusted = 1;
+            continue;
+        }
+        if (strncmp(value, "~/", 2) == 0 && home != NULL)
+            snprintf(path, sizeof(path), "%s%s", home, value + 1);
+        else
+            snprintf(path, sizeof(path), "%s", value);
+        len = strlen(path);
+        if (len >= 2 && strcmp(path + len - 2, "/*") == 0) {
+            if (strncmp(cwd, path, len - 1) == 0)
+                trusted = 1;
+        }
+        else {
+            while (len > 1 && path[len - 1] == '/')
+                path[--len] = '\0';
+            if (strcmp(cwd, path) == 0)
+                trusted = 1;
+        }
+    }
+    free_git_config(&config);
+    if (!trusted)
+        debug("'%s' is owned by someone else, and not in safe.directory",
+              cwd);
+    return trusted;
+}
+
+/* Decide whether the working tree differs from the index by comparing
+ * each entry's cached stat data with lstat(), stopping at the first
+ * mismatch -- like "git diff --quiet", but without the fork.  Then, if
+ * the files are clean, check the submodules.  Racy entries are
+ * settled by hashing their content.  Return 1 if modified, 0 if clean,
+ * or -1 if the index has something we cannot judge, in which case
+ * caller should ask git.
+ */
+static int
+index_modified(const gitdir_t *repo, gitindex_t *index)
+{
+    modified_scan_t scan;
+    submodule_scan_t subs;
+    fsmonitor_t fsm;
+    char fsmonitor[1024];
+    int result;
+
+    memset(&scan, 0, sizeof(scan));
+    memset(&subs, 0, sizeof(subs));
+    subs.hashsize = index->hashsize;
+#if HAVE_PTHREAD
+    pthread_mutex_init(&subs.lock, NULL);
+#endif
+    scan.index = index;
+    scan.fsmonitor = NULL;
+    read_stat_config(repo, &scan);
+    scan.may_convert = may_convert(repo);
+    scan.prefix = "";
+    scan.submodules = &subs;
+
+    /* with a file system monitor, only stat what it says has changed:
+     * core.fsmonitor is either a boolean (git's builtin daemon) or the
+     * path of a hook, which is only run in a trusted repository */
+    if (read_config_value(repo, "core", "fsmonitor",
+                          fsmonitor, sizeof(fsmonitor)) &&
+        read_config_bool(repo, "core", "fsmonitor", 1)) {
+        if (strcasecmp(fsmonitor, "true") == 0 ||
+            strcasecmp(fsmonitor, "yes") == 0 ||
+            strcasecmp(fsmonitor, "on") == 0 ||
+            strcmp(fsmonitor, "1") == 0)
+            strcpy(fsmonitor, "true");
+        if ((strcmp(fsmonitor, "true") == 0 || repo_is_trusted(repo)) &&
+            query_fsmonitor(index, repo->gitdir, fsmonitor, &fsm))
+            scan.fsmonitor = &fsm;
+    }
+
+    /* an entry we cannot judge does not stop the scan: another file
+     * might be clearly modified */
+    result = scan_index(index, index_threads(repo), check_entry, &scan);
+    if (scan.fsmonitor != NULL)
+        free_fsmonitor(&fsm);
+
+    if (result <= 0 && subs.count > 0) {
+        int dirty = submodules_modified(repo, &subs, index_threads(repo));
+        if (dirty > 0 || result == 0)
+            result = dirty;
+    }
+    for (size_t i = 0; i < subs.count; i++)
+        free(subs.items[i].path);
+    free(subs.items);
+#if HAVE_PTHREAD
+    pthread_mutex_destroy(&subs.lock);
+#endif
+    return result;
+}
+
+typedef struct {
+    result_t *result;
+    int need_modified;
+    int need_unknown;
+    int need_staged;
+    int need_unstaged;
+} status_lines_t;
+
+/* line callback for "git status --porcelain": stop reading as soon as
+ * everything we need to know is known */
+static int
+read_status_line(char *line, size_t len, void *data)
+{
+    status_lines_t *lines = data;
+
+    if (len < 2)
+        return 0;
+    if (line[0] == '?') {
+        if (lines->need_unknown)
+            lines->result->unknown = 1;
+    }
+    else {
+        /* "XY path": X is the index, Y the work tree */
+        if (lines->need_modified && line[1] != ' ')
+            lines->result->modified = 1;
+        if (lines->need_staged && line[0] != ' ')
+            lines->result->staged = 1;
+        if (lines->need_unstaged && line[1] != ' ')
+            lines->result->unstaged = 1;
+    }
+    return ((!lines->need_modified || lines->result->modified) &&
+            (!lines->need_unknown || lines->result->unknown) &&
+            (!lines->need_staged || lines->result->staged) &&
+            (!lines->need_unstaged || lines->result->unstaged));
 }
 
 static result_t*
 git_get_info(vccontext_t *context)
 {
     result_t *result = init_result();
-    char buf[1024];
+    char buf[1024], path[PATH_MAX];
+    gitdir_t repo;
 
-    if (!read_first_line(".git/HEAD", buf, 1024)) {
-        debug("unable to read .git/HEAD: assuming not a git repo");
+    memset(&repo, 0, sizeof(repo));
+    if (!open_git_dirs(&repo, "") || !read_head(&repo, buf, 1024)) {
+        debug("unable to read HEAD: assuming not a git repo");
         goto err;
     }
+    if (strcmp(repo.gitdir, ".git") != 0)
+        debug("git dir: '%s', common dir: '%s'", repo.gitdir, repo.commondir);
 
     char *prefix = "ref: refs/heads/";
     int prefixlen = strlen(prefix);
@@ -40,61 +1192,138 @@ git_get_info(vccontext_t *context)
         int found_branch = 0;
         if (strncmp(prefix, buf, prefixlen) == 0) {
             /* yep, we're on a known branch */
-            debug("read a head ref from .git/HEAD: '%s'", buf);
+            debug("read a head ref from HEAD: '%s'", buf);
             if (result_set_branch(result, buf + prefixlen))
                 found_branch = 1;
         }
         else {
             /* if it's not a branch name, assume it is a commit ID */
-            debug(".git/HEAD doesn't look like a head ref: unknown branch");
+            debug("HEAD doesn't look like a head ref: unknown branch");
             result_set_branch(result, "(unknown)");
             result_set_revision(result, buf, 12);
         }
         if (context->options->show_revision && found_branch) {
+            char oid[128];
+            if (read_ref(&repo, buf + 5, oid, sizeof(oid)))
+                result_set_revision(result, oid, 12);
+        }
+    }
+    if (context->options->show_ahead_behind &&
+        strncmp(prefix, buf, prefixlen) == 0)
+        git_ahead_behind(&repo, result, buf + prefixlen);
+
+    if (context->options->show_operation)
+        git_operation(&repo, result);
+    if (context->options->show_stashes) {
+        /* one reflog line per stash entry */
+        char oid[128];
+        long count = count_lines(git_path(path, sizeof(path), repo.commondir,
+                                          "logs/refs/stash"));
+        if (count < 0)
+            count = read_ref(&repo, "refs/stash", oid, sizeof(oid)) ? 1 : 0;
+        result->stashes = count;
+    }
+    if (context->options->show_commit_age)
+        result->commit_time = git_commit_time(&repo, buf);
+    if (!context->options->show_modified && !context->options->show_unknown &&
+        !context->options->show_conflicts && !context->options->show_staged &&
+        !context->options->show_unstaged)
+        goto done;
+
+    int need_modified = context->options->show_modified;
+    int need_unknown = context->options->show_unknown;
+    const char *value = git_config_get(&repo.config, "status",
+                                       "showuntrackedfiles");
+    if (need_unknown && value != NULL && !parse_config_bool(value)) {
+        /* "no": git status does not look for them, so neither do we */
+        result->unknown = 0;
+        need_unknown = 0;
+    }
+    int need_staged = context->options->show_staged;
+    int need_unstaged = context->options->show_unstaged;
+    gitindex_t *index = open_git_index(
+        git_path(path, sizeof(path), repo.gitdir, "index"),
+        git_hash_size(&repo));
+    if (context->options->show_conflicts)
+        result->conflicts = index != NULL ? count_conflicts(index) : -1;
+    if (index != NULL) {
+        /* git's %m is the same check as %w: the work tree against
+         * the index */
+        if (need_modified || need_unstaged) {
+            int modified = index_modified(&repo, index);
+            if (modified >= 0) {
+                if (need_modified)
+                    result->modified = modified;
+                if (need_unstaged)
+                    result->unstaged = modified;
+                need_modified = need_unstaged = 0;
+            }
+        }
+        if (need_staged) {
+            int staged = git_staged(&repo, index, buf);
+            if (staged >= 0) {
+                result->staged = staged;
+                need_staged = 0;
+            }
+        }
+        if (need_unknown) {
             char buf[1024];
-            char filename[1024] = ".git/refs/heads/";
-            int nchars = sizeof(filename) - strlen(filename) - 1;
-            strncat(filename, result->branch, nchars);
-            if (read_first_line(filename, buf, 1024)) {
-                result_set_revision(result, buf, 12);
+            const char *excludes = excludes_file(&repo, buf, sizeof(buf));
+            git_path(path, sizeof(path), repo.commondir, "info/exclude");
+            int unknown = -1;
+            /* core.untrackedCache=false: git would drop the cache */
+            if (read_config_bool(&repo, "core", "untrackedcache", 1))
+                unknown = untracked_cache_check(index, path, excludes);
+            /* git folds case on such file systems: leave it to git */
+            if (unknown < 0 &&
+                !read_config_bool(&repo, "core", "ignorecase", 0)) {
+                char conefile[PATH_MAX];
+                sparse_cone_t cone;
+                int sparse = (read_config_bool(&repo, "core", "sparsecheckout",
+                                               0) &&
+                              read_sparse_cone(
+                                  git_path(conefile, sizeof(conefile),
+                                           repo.gitdir, "info/sparse-checkout"),
+                                  &cone));
+                unknown = untracked_walk(index, path, excludes,
+                                         sparse ? &cone : NULL,
+                                         walk_threads(&repo));
+                if (sparse)
+                    free_sparse_cone(&cone);
+            }
+            if (unknown >= 0) {
+                result->unknown = unknown;
+                need_unknown = 0;
             }
         }
+        free_git_index(index);
     }
-
-    if (!context->options->show_modified && !context->options->show_unknown)
-        return result;
+    if (!need_modified && !need_unknown && !need_staged && !need_unstaged)
+        goto done;
 
     char *argv[] = {
         "git", "status", "--porcelain", "--untracked-files=normal", NULL};
-    if (!context->options->show_unknown) {
+    if (!need_unknown) {
         // asking git to search for unknown files can be expensive, so
         // skip it unless the user wants it
         argv[3] = "--untracked-files=no";
     }
-    capture_t *capture = capture_child("git", argv);
+    status_lines_t lines = {result, need_modified, need_unknown, need_staged,
+                            need_unstaged};
+    capture_t *capture = capture_child_lines("git", argv,
+                                             read_status_line, &lines);
     if (capture == NULL) {
         debug("unable to execute 'git status'");
         goto err;
     }
-    char *cstdout = capture->childout.buf;
-    for (char *ch = cstdout; *ch != 0; ch++) {
-        if (ch == cstdout || *(ch-1) == '\n') {
-            // at start of output or start of line: look for ?, M, etc.
-            if (context->options->show_unknown && *ch == '?') {
-                result->unknown = 1;
-            }
-            else if (context->options->show_modified && *(ch+1) != ' ') {
-                result->modified = 1;
-            }
-        }
-    }
-
-    cstdout = NULL;
     free_capture(capture);
 
+ done:
+    free_git_dirs(&repo);
     return result;
 
  err:
+    free_git_dirs(&repo);
     free_result(result);
     return NULL;
 }
@@ -0,0 +1,548 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "../config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "gitconfig.h"
+#include "gitignore.h"
+
+/* git gives up on deeper includes, which are probably a loop */
+#define MAX_INCLUDE_DEPTH 10
+
+/* A parsed config file, known by the stat data it had when read. */
+typedef struct cached_file {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime_sec;
+    long mtime_nsec;
+    config_entry_t *entries;
+    size_t count;
+    struct cached_file *next;
+} cached_file_t;
+
+/* Files are never freed: an entry of one might be in any gitconfig_t.
+ * A file that changes while vcprompt runs is simply read again. */
+static cached_file_t *cache = NULL;
+#if HAVE_PTHREAD
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+int
+parse_config_bool(const char *value)
+{
+    if (strcasecmp(value, "true") == 0 || strcasecmp(value, "yes") == 0 ||
+        strcasecmp(value, "on") == 0)
+        return 1;
+    if (strcasecmp(value, "false") == 0 || strcasecmp(value, "no") == 0 ||
+        strcasecmp(value, "off") == 0 || value[0] == '\0')
+        return 0;
+    if (isdigit((unsigned char) value[0]) || value[0] == '-')
+        return atoi(value) != 0;
+    return 1;
+}
+
+static void
+free_entry(config_entry_t *entry)
+{
+    free(entry->section);
+    free(entry->subsection);
+    free(entry->name);
+    free(entry->value);
+}
+
+static char *
+skip_line(char *p)
+{
+    while (*p != '\0' && *p != '\n')
+        p++;
+    return p;
+}
+
+/* Parse a section header: p is just after the "[".  Store the section
+ * and subsection (NULL if none) and return the end of the header, or
+ * NULL if it is malformed.
+ */
+static char *
+parse_section(char *p, char **section, char **subsection)
+{
+    char *start = p, *sub, *q;
+
+    *section = *subsection = NULL;
+    while (isalnum((unsigned char) *p) || *p == '-' || *p == '.') {
+        *p = tolower((unsigned char) *p);
+        p++;
+    }
+    if (p == start)
+        return NULL;
+
+    if (*p == ']') {
+        /* old style [section.subsection]: all lowercase */
+        char *dot = memchr(start, '.', p - start);
+        *section = strndup(start, (dot != NULL ? dot : p) - start);
+        if (dot != NULL)
+            *subsection = strndup(dot + 1, p - dot - 1);
+        return p + 1;
+    }
+    if (*p != ' ' && *p != '\t')
+        return NULL;
+    *section = strndup(start, p - start);
+    while (*p == ' ' || *p == '\t')
+        p++;
+    if (*p++ != '"')
+        return NULL;
+    sub = q = p;
+    for (; *p != '"'; p++) {
+        if (*p == '\\')
+            p++;
+        if (*p == '\0' || *p == '\n')
+            return NULL;
+        *q++ = *p;
+    }
+    if (p[1] != ']')
+        return NULL;
+    *subsection = strndup(sub, q - sub);
+    return p + 2;
+}
+
+/* Parse the value at p (just after the "="), up to the end of the line
+ * or of the last continued line, and store it, unquoted and unescaped,
+ * in *value.  Return the end of the value, or NULL if it is malformed.
+ */
+static char *
+parse_value(char *p, char **value)
+{
+    char *q;
+    int quoted = 0, nspaces = 0;
+
+    *value = q = malloc(strlen(p) + 1);
+    if (q == NULL)
+        return NULL;
+    while (*p == ' ' || *p == '\t')
+        p++;
+    for (; *p != '\0'; p++) {
+        if (*p == '\n') {
+            if (quoted)
+                return NULL;
+            break;
+        }
+        if (!quoted && (*p == '#' || *p == ';')) {
+            p = skip_line(p);
+            break;
+        }
+        if (!quoted && isspace((unsigned char) *p)) {
+            /* inner whitespace is kept, trailing whitespace is not */
+            if (q > *value)
+                nspaces++;
+            continue;
+        }
+        for (; nspaces > 0; nspaces--)
+            *q++ = ' ';
+        if (*p == '"') {
+            quoted = !quoted;
+            continue;
+        }
+        if (*p == '\\') {
+            switch (*++p) {
+            case '\n':                  /* continued on the next line */
+                continue;
+            case 'n':
+                *q++ = '\n';
+                break;
+            case 't':
+                *q++ = '\t';
+                break;
+            case 'b':
+                *q++ = '\b';
+                break;
+            case '\\':
+            case '"':
+                *q++ = *p;
+                break;
+            default:
+                return NULL;
+            }
+            continue;
+        }
+        *q++ = *p;
+    }
+    *q = '\0';
+    return p;
+}
+
+static int
+add_entry(cached_file_t *file, size_t *size, config_entry_t *entry)
+{
+    if (file->count == *size) {
+        size_t newsize = *size ? *size * 2 : 32;
+        config_entry_t *entries = realloc(file->entries,
+                                          newsize * sizeof(config_entry_t));
+        if (entries == NULL)
+            return 0;
+        file->entries = entries;
+        *size = newsize;
+    }
+    file->entries[file->count++] = *entry;
+    return 1;
+}
+
+/* Parse the text of a config file into file's entries.  Like git, give
+ * up on a file with a syntax error, but keep what came before it.
+ */
+static void
+parse_config(char *p, cached_file_t *file, const char *filename)
+{
+    char *section = NULL, *subsection = NULL;
+    size_t size = 0;
+
+    while (*p != '\0') {
+        config_entry_t entry;
+        char *start;
+
+        if (isspace((unsigned char) *p)) {
+            p++;
+            continue;
+        }
+        if (*p == '#' || *p == ';') {
+            p = skip_line(p);
+            continue;
+        }
+        if (*p == '[') {
+            free(section);
+            free(subsection);
+            p = parse_section(p + 1, &section, &subsection);
+            if (p == NULL)
+                goto err;
+            continue;
+        }
+        if (!isalpha((unsigned char) *p) || section == NULL)
+            goto err;
+
+        memset(&entry, 0, sizeof(entry));
+        for (start = p; isalnum((unsigned char) *p) || *p == '-'; p++)
+            *p = tolower((unsigned char) *p);
+        entry.name = strndup(start, p - start);
+        while (*p == ' ' || *p == '\t' || *p == '\r')
+            p++;
+        if (*p == '=')
+            p = parse_value(p + 1, &entry.value);
+        else if (*p == '#' || *p == ';')
+            p = skip_line(p);
+        else if (*p != '\n' && *p != '\0')
+            p = NULL;
+        entry.section = strdup(section);
+        entry.subsection = subsection != NULL ? strdup(subsection) : NULL;
+        if (p == NULL || entry.name == NULL || entry.section == NULL ||
+            (subsection != NULL && entry.subsection == NULL) ||
+            !add_entry(file, &size, &entry)) {
+            free_entry(&entry);
+            goto err;
+        }
+    }
+    free(section);
+    free(subsection);
+    return;
+
+ err:
+    debug("config: bad syntax in '%s': ignoring the rest of it", filename);
+    free(section);
+    free(subsection);
+}
+
+/* Return the parsed entries of filename, reading it only if its stat
+ * data is not in the cache yet.  Return NULL if it cannot be read.
+ */
+static const cached_file_t *
+load_config_file(const char *filename)
+{
+    struct stat statbuf;
+    cached_file_t *file = NULL;
+    FILE *stream = NULL;
+    char *buf = NULL;
+
+    if (stat(filename, &statbuf) < 0 || !S_ISREG(statbuf.st_mode))
+        return NULL;
+
+#if HAVE_PTHREAD
+    pthread_mutex_lock(&cache_lock);
+#endif
+    for (file = cache; file != NULL; file = file->next) {
+        if (file->dev == statbuf.st_dev && file->ino == statbuf.st_ino &&
+            file->size == statbuf.st_size &&
+            file->mtime_sec == statbuf.st_mtime &&
+            file->mtime_nsec == ST_MTIME_NSEC(&statbuf))
+            goto done;
+    }
+
+    stream = fopen(filename, "r");
+    if (stream == NULL ||
+        (buf = malloc(statbuf.st_size + 1)) == NULL ||
+        (file = calloc(1, sizeof(cached_file_t))) == NULL) {
+        debug("error reading '%s': %s", filename, strerror(errno));
+        goto done;
+    }
+    size_t len = fread(buf, 1, statbuf.st_size, stream);
+    buf[len] = '\0';
+    file->dev = statbuf.st_dev;
+    file->ino = statbuf.st_ino;
+    file->size = statbuf.st_size;
+    file->mtime_sec = statbuf.st_mtime;
+    file->mtime_nsec = ST_MTIME_NSEC(&statbuf);
+    parse_config(buf, file, filename);
+    file->next = cache;
+    cache = file;
+    debug("config: read %zu variables from '%s'", file->count, filename);
+
+ done:
+#if HAVE_PTHREAD
+    pthread_mutex_unlock(&cache_lock);
+#endif
+    if (stream != NULL)
+        fclose(stream);
+    free(buf);
+    return file;
+}
+
+/* Expand path, a value of include.path or of an includeIf pattern,
+ * into buf: "~/" is the home directory, and a relative path is
+ * relative to the directory of the including file.
+ */
+static char *
+expand_path(char *buf, size_t size, const char *path, const char *including)
+{
+    const char *home = getenv("HOME");
+    const char *slash = strrchr(including, '/');
+
+    if (strncmp(path, "~/", 2) == 0 && home != NULL)
+        snprintf(buf, size, "%s%s", home, path + 1);
+    else if (path[0] == '/' || path[0] == '~' || slash == NULL)
+        snprintf(buf, size, "%s", path);
+    else
+        snprintf(buf, size, "%.*s/%s", (int) (slash - including), including,
+                 path);
+    return buf;
+}
+
+static void
+lowercase(char *s)
+{
+    for (; *s != '\0'; s++)
+        *s = tolower((unsigned char) *s);
+}
+
+/* Does the includeIf condition cond hold?  "gitdir:" (or "gitdir/i:",
+ * ignoring case) globs the real path of the git dir, "onbranch:" the
+ * current branch; "hasconfig:" is not supported, so never holds.
+ */
+static int
+include_applies(const gitconfig_t *config, const char *cond,
+                const char *including)
+{
+    char pattern[PATH_MAX], text[PATH_MAX], path[PATH_MAX];
+    int icase = 0;
+
+    if (strncmp(cond, "onbranch:", 9) == 0) {
+        cond += 9;
+        if (config->branch[0] == '\0' ||
+            snprintf(pattern, sizeof(pattern), "%s%s", cond,
+                     cond[0] != '\0' && cond[strlen(cond) - 1] == '/'
+                     ? "**" : "") >= (int) sizeof(pattern))
+            return 0;
+        return glob_match(pattern, config->branch);
+    }
+
+    if (strncmp(cond, "gitdir:", 7) == 0)
+        cond += 7;
+    else if (strncmp(cond, "gitdir/i:", 9) == 0) {
+        cond += 9;
+        icase = 1;
+    }
+    else
+        return 0;
+    if (config->gitdir == NULL || realpath(config->gitdir, text) == NULL)
+        return 0;
+    if (strncmp(cond, "./", 2) == 0)
+        expand_path(path, sizeof(path), cond + 2, including);
+    else
+        expand_path(path, sizeof(path), cond, "");
+    if (snprintf(pattern, sizeof(pattern), "%s%s%s",
+                 path[0] == '/' ? "" : "**/", path,
+                 path[0] != '\0' && path[strlen(path) - 1] == '/'
+                 ? "**" : "") >= (int) sizeof(pattern))
+        return 0;
+    if (icase) {
+        lowercase(pattern);
+        lowercase(text);
+    }
+    return glob_match(pattern, text);
+}
+
+static int
+add_config_file(gitconfig_t *config, const char *filename,
+                int follow_includes, int depth)
+{
+    const cached_file_t *file = load_config_file(filename);
+
+    if (file == NULL)
+        return 0;
+    for (size_t i = 0; i < file->count; i++) {
+        const config_entry_t *entry = &file->entries[i];
+        if (config->count == config->size) {
+            size_t newsize = config->size ? config->size * 2 : 64;
+            const config_entry_t **entries = realloc(
+                config->entries, newsize * sizeof(config_entry_t *));
+            if (entries == NULL)
+                return 0;
+            config->entries = entries;
+            config->size = newsize;
+        }
+        config->entries[config->count++] = entry;
+
+        if (!follow_includes || entry->value == NULL ||
+            strcmp(entry->name, "path") != 0)
+            continue;
+        if (strcmp(entry->section, "include") == 0 &&
+            entry->subsection == NULL)
+            ;
+        else if (strcmp(entry->section, "includeif") == 0 &&
+                 entry->subsection != NULL &&
+                 include_applies(config, entry->subsection, filename))
+            ;
+        else
+            continue;
+        if (depth >= MAX_INCLUDE_DEPTH) {
+            debug("config: includes nested too deeply in '%s'", filename);
+            continue;
+        }
+        char path[PATH_MAX];
+        expand_path(path, sizeof(path), entry->value, filename);
+        add_config_file(config, path, 1, depth + 1);
+    }
+    return 1;
+}
+
+int
+read_config_file(gitconfig_t *config, const char *filename,
+                 int follow_includes)
+{
+    return add_config_file(config, filename, follow_includes, 0);
+}
+
+/* The system and global config files. */
+static void
+add_protected_files(gitconfig_t *config)
+{
+    const char *home = getenv("HOME");
+    const char *xdg = getenv("XDG_CONFIG_HOME");
+    const char *env;
+    char path[PATH_MAX];
+
+    env = getenv("GIT_CONFIG_NOSYSTEM");
+    if (env == NULL || !parse_config_bool(env)) {
+        env = getenv("GIT_CONFIG_SYSTEM");
+        read_config_file(config, env != NULL ? env : "/etc/gitconfig", 1);
+    }
+    env = getenv("GIT_CONFIG_GLOBAL");
+    if (env != NULL)
+        read_config_file(config, env, 1);
+    else {
+        if (xdg != NULL && *xdg) {
+            snprintf(path, sizeof(path), "%s/git/config", xdg);
+            read_config_file(config, path, 1);
+        }
+        else if (home != NULL) {
+            snprintf(path, sizeof(path), "%s/.config/git/config", home);
+            read_config_file(config, path, 1);
+        }
+        if (home != NULL) {
+            snprintf(path, sizeof(path), "%s/.gitconfig", home);
+            read_config_file(config, path, 1);
+        }
+    }
+}
+
+void
+read_protected_git_config(gitconfig_t *config)
+{
+    memset(config, 0, sizeof(gitconfig_t));
+    add_protected_files(config);
+}
+
+void
+read_git_config(gitconfig_t *config, const char *gitdir,
+                const char *commondir)
+{
+    const char *value;
+    char path[PATH_MAX], head[1024];
+
+    memset(config, 0, sizeof(gitconfig_t));
+    config->gitdir = gitdir;
+    snprintf(path, sizeof(path), "%s/HEAD", gitdir);
+    if (read_first_line(path, head, sizeof(head)) &&
+        strncmp(head, "ref: refs/heads/", 16) == 0 &&
+        snprintf(config->branch, sizeof(config->branch), "%s",
+                 head + 16) >= (int) sizeof(config->branch))
+        config->branch[0] = '\0';
+
+    add_protected_files(config);
+    snprintf(path, sizeof(path), "%s/config", commondir);
+    read_config_file(config, path, 1);
+    /* "git sparse-checkout" turns this on, and writes its settings to
+     * the worktree's own file */
+    value = git_config_get(config, "extensions", "worktreeconfig");
+    if (value != NULL && parse_config_bool(value)) {
+        snprintf(path, sizeof(path), "%s/config.worktree", gitdir);
+        read_config_file(config, path, 1);
+    }
+}
+
+void
+free_git_config(gitconfig_t *config)
+{
+    free(config->entries);
+    config->entries = NULL;
+    config->count = config->size = 0;
+}
+
+const char *
+git_config_get(const gitconfig_t *config,
+               const char *section, const char *name)
+{
+    const char *dot = strchr(section, '.');
+    size_t seclen = dot != NULL ? (size_t) (dot - section) : strlen(section);
+
+    /* the last one wins */
+    for (size_t i = config->count; i-- > 0; ) {
+        const config_entry_t *entry = config->entries[i];
+        if (strcasecmp(entry->name, name) != 0 ||
+            strncasecmp(entry->section, section, seclen) != 0 ||
+            entry->section[seclen] != '\0')
+            continue;
+        if (dot == NULL
+            ? entry->subsection != NULL
+            : (entry->subsection == NULL ||
+               strcmp(entry->subsection, dot + 1) != 0))
+            continue;
+        return entry->value != NULL ? entry->value : "true";
+    }
+    return NULL;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITCONFIG_H
+#define GITCONFIG_H
+
+#include <stddef.h>
+
+/* One "name = value" line of a config file, in [section "subsection"]
+ * (or the old-style [section.subsection]).
+ */
+typedef struct {
+    char *section;                      /* lowercased */
+    char *subsection;                   /* NULL if none */
+    char *name;                         /* lowercased */
+    char *value;                        /* unquoted; NULL for a bare
+                                           "name", which means true */
+} config_entry_t;
+
+/* The variables of one or more config files, in the order git reads
+ * them, with the files they include spliced in where the include is:
+ * the last entry for a variable wins.  The entries themselves belong
+ * to a cache of parsed files, shared by all threads, which is only
+ * refreshed when a file's stat data changes.
+ */
+typedef struct {
+    const config_entry_t **entries;
+    size_t count, size;
+    const char *gitdir;                 /* for includeIf "gitdir:" */
+    char branch[256];                   /* for includeIf "onbranch:" */
+} gitconfig_t;
+
+/* Read the config of the repository whose per-worktree and common git
+ * dirs are gitdir and commondir: the system config, the global ones,
+ * commondir/config and, with extensions.worktreeConfig, the
+ * worktree's config.worktree, honoring GIT_CONFIG_NOSYSTEM,
+ * GIT_CONFIG_SYSTEM and GIT_CONFIG_GLOBAL.  Files that do not exist
+ * are skipped.  Caller must free config with free_git_config().
+ */
+void
+read_git_config(gitconfig_t *config, const char *gitdir,
+                const char *commondir);
+
+/* Read only the system and global config files, as for
+ * read_git_config(): the ones that whoever owns a repository cannot
+ * write, which is where git looks for safe.directory.
+ */
+void
+read_protected_git_config(gitconfig_t *config);
+
+/* Append the entries of the config file filename to config, which
+ * must be zeroed before the first call, following its include.path
+ * and includeIf.<condition>.path variables if follow_includes is set.
+ * Return 1 if the file could be read.
+ */
+int
+read_config_file(gitconfig_t *config, const char *filename,
+                 int follow_includes);
+
+void
+free_git_config(gitconfig_t *config);
+
+/* Return the value of name in section, which may have a subsection:
+ * "branch.master" stands for [branch "master"].  A bare "name" reads
+ * as "true".  Return NULL if it is not set.
+ */
+const char *
+git_config_get(const gitconfig_t *config,
+               const char *section, const char *name);
+
+/* Parse a boolean value the way git does: "false", "no", "off", "0"
+ * and "" are false, anything else true.
+ */
+int
+parse_config_bool(const char *value);
+
+#endif
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "common.h"
+#include "gitfsmonitor.h"
+
+#define DAEMON_SOCKET "fsmonitor--daemon.ipc"
+#define PKT_MAX 65520
+
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int
+read_all(int fd, char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/* Send token to git's builtin fsmonitor daemon and return its reply
+ * (caller frees), storing the length in *len.  git's "simple IPC"
+ * frames both request and reply as pkt-lines ending with a flush
+ * packet.
+ */
+static char *
+ask_daemon(const char *gitdir, const char *token, size_t *len)
+{
+    struct sockaddr_un addr;
+    char hdr[5];
+    char *reply = NULL;
+    size_t size = 0;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s",
+             gitdir, DAEMON_SOCKET);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return NULL;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        debug("fsmonitor: cannot connect to %s: %s",
+              addr.sun_path, strerror(errno));
+        goto err;
+    }
+
+    size_t tokenlen = strlen(token);
+    if (tokenlen + 4 > PKT_MAX)
+        goto err;
+    snprintf(hdr, sizeof(hdr), "%04zx", tokenlen + 4);
+    if (!write_all(fd, hdr, 4) || !write_all(fd, token, tokenlen) ||
+        !write_all(fd, "0000", 4))
+        goto err;
+
+    *len = 0;
+    while (1) {
+        unsigned int pktlen;
+        if (!read_all(fd, hdr, 4))
+            goto err;
+        hdr[4] = '\0';
+        if (sscanf(hdr, "%4x", &pktlen) != 1 || (pktlen > 0 && pktlen < 4))
+            goto err;
+        if (pktlen == 0)        /* flush: end of reply */
+            break;
+        pktlen -= 4;
+        if (*len + pktlen + 1 > size) {
+            size = (*len + pktlen + 1) * 2;
+            char *buf = realloc(reply, size);
+            if (buf == NULL)
+                goto err;
+            reply = buf;
+        }
+        if (!read_all(fd, reply + *len, pktlen))
+            goto err;
+        *len += pktlen;
+    }
+    close(fd);
+    return reply;
+
+ err:
+    close(fd);
+    free(reply);
+    return NULL;
+}
+
+/* Run a version 2 fsmonitor hook, as git does: "hook 2 <token>". */
+static char *
+ask_hook(const char *hook, const char *token, size_t *len)
+{
+    char *argv[] = {(char *) hook, "2", (char *) token, NULL};
+    char *reply = NULL;
+
+    capture_t *capture = capture_child(hook, argv);
+    if (capture == NULL)
+        return NULL;
+    if (capture->status == 0 && capture->signal == 0) {
+        reply = malloc(capture->childout.len + 1);
+        if (reply != NULL) {
+            memcpy(reply, capture->childout.buf, capture->childout.len);
+            *len = capture->childout.len;
+        }
+    }
+    free_capture(capture);
+    return reply;
+}
+
+static int
+compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(const char **) a, *(const char **) b);
+}
+
+int
+query_fsmonitor(const gitindex_t *index, const char *gitdir,
+                const char *fsmonitor, fsmonitor_t *fsm)
+{
+    const unsigned char *ext, *end;
+    size_t size, len, n;
+    const char *token;
+
+    memset(fsm, 0, sizeof(fsmonitor_t));
+    ext = find_index_extension(index, "FSMN", &size);
+    if (ext == NULL) {
+        debug("fsmonitor: index has no FSMN extension");
+        return 0;
+    }
+    end = ext + size;
+
+    /* version 2: NUL-terminated token (version 1 had a timestamp,
+     * which only the long-gone version 1 hooks understand) */
+    if (size < 4 || get_be32(ext) != 2) {
+        debug("fsmonitor: unsupported FSMN version");
+        return 0;
+    }
+    token = (const char *) ext + 4;
+    const unsigned char *nul = memchr(token, '\0', end - ext - 4);
+    if (nul == NULL || end - nul < 5)
+        return 0;
+    size_t bitmapsize = get_be32(nul + 1);
+    if (bitmapsize > (size_t) (end - nul - 5) ||
+        read_ewah(nul + 5, nul + 5 + bitmapsize,
+                  &fsm->dirty, &fsm->ndirty) == 0)
+        return 0;
+
+    if (strcmp(fsmonitor, "true") == 0)
+        fsm->reply = ask_daemon(gitdir, token, &len);
+    else
+        fsm->reply = ask_hook(fsmonitor, token, &len);
+    if (fsm->reply == NULL) {
+        debug("fsmonitor: no reply from '%s'", fsmonitor);
+        goto err;
+    }
+    fsm->reply[len] = '\0';
+
+    /* reply: new token, then NUL-terminated paths */
+    char *p = memchr(fsm->reply, '\0', len + 1);
+    char *replyend = fsm->reply + len;
+    for (n = 0, p++; p < replyend; p += strlen(p) + 1)
+        n++;
+    fsm->paths = malloc((n + 1) * sizeof(char *));
+    if (fsm->paths == NULL)
+        goto err;
+    p = memchr(fsm->reply, '\0', len + 1);
+    for (p++; p < replyend; p += strlen(p) + 1) {
+        if (strcmp(p, "/") == 0) {
+            /* the monitor lost track: everything may have changed */
+            debug("fsmonitor: trivial reply");
+            goto err;
+        }
+        if (*p)
+            fsm->paths[fsm->npaths++] = p;
+    }
+    qsort(fsm->paths, fsm->npaths, sizeof(char *), compare_paths);
+    debug("fsmonitor: %zu paths changed since token '%s'",
+          fsm->npaths, token);
+    return 1;
+
+ err:
+    free_fsmonitor(fsm);
+    return 0;
+}
+
+void
+free_fsmonitor(fsmonitor_t *fsm)
+{
+    free(fsm->dirty);
+    free(fsm->reply);
+    free(fsm->paths);
+    memset(fsm, 0, sizeof(fsmonitor_t));
+}
+
+/* Binary search for the first len chars of path. */
+static int
+has_path(const fsmonitor_t *fsm, const char *path, size_t len)
+{
+    size_t lo = 0, hi = fsm->npaths;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strncmp(fsm->paths[mid], path, len);
+        if (cmp == 0 && fsm->paths[mid][len] != '\0')
+            cmp = 1;
+        if (cmp == 0)
+            return 1;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return 0;
+}
+
+int
+fsmonitor_needs_check(const fsmonitor_t *fsm, size_t pos, const char *path)
+{
+    if (pos < fsm->ndirty && BITMAP_TEST(fsm->dirty, pos))
+        return 1;
+    if (has_path(fsm, path, strlen(path)))
+        return 1;
+
+    /* a changed directory (with or without trailing slash) covers
+     * everything below it */
+    for (const char *slash = strchr(path, '/'); slash != NULL;
+         slash = strchr(slash + 1, '/')) {
+        if (has_path(fsm, path, slash - path) ||
+            has_path(fsm, path, slash - path + 1))
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITFSMONITOR_H
+#define GITFSMONITOR_H
+
+#include <stddef.h>
+
+#include "gitindex.h"
+
+/* What a file system monitor (core.fsmonitor) told us: the index
+ * entries git already knew to be dirty when it wrote the FSMN
+ * extension, plus the paths changed since then.  Every other entry is
+ * known to be unchanged and need not be stat()ed.
+ */
+typedef struct {
+    unsigned char *dirty;               /* bitmap: entry n needs a check */
+    size_t ndirty;                      /* number of bits in dirty */
+    char *reply;                        /* raw reply from the monitor */
+    const char **paths;                 /* sorted changed paths */
+    size_t npaths;
+} fsmonitor_t;
+
+/* Read the FSMN extension of index and ask the monitor configured in
+ * core.fsmonitor (value fsmonitor: "true" for git's builtin daemon,
+ * listening on fsmonitor--daemon.ipc in gitdir, or else the path of a
+ * hook such as the one for watchman) what changed since the token in
+ * it.
+ * Return 1 and fill fsm on success; return 0 if there is no usable
+ * answer (no extension, no daemon, or a reply that says "assume
+ * everything changed").  Caller frees fsm with free_fsmonitor().
+ */
+int
+query_fsmonitor(const gitindex_t *index, const char *gitdir,
+                const char *fsmonitor, fsmonitor_t *fsm);
+
+void
+free_fsmonitor(fsmonitor_t *fsm);
+
+/* Return true if the entry at position pos in the index, with path
+ * path, may have changed and must be checked.
+ */
+int
+fsmonitor_needs_check(const fsmonitor_t *fsm, size_t pos, const char *path);
+
+#endif
@@ -0,0 +1,444 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "gitgraph.h"
+
+#define GRAPH_PARENT_NONE  0x70000000
+#define GRAPH_EXTRA_EDGES  0x80000000
+#define GRAPH_EDGE_LAST    0x80000000
+#define GRAPH_MAX_LAYERS   64
+
+/* flags of commits during graph_ahead_behind() */
+#define FROM_A   1
+#define FROM_B   2
+#define STALE    (FROM_A | FROM_B)
+#define SEEN     4
+
+static const unsigned char *
+find_chunk(const unsigned char *data, size_t size, unsigned int nchunks,
+           const char *id, size_t *chunksize)
+{
+    const unsigned char *lookup = data + 8;
+
+    for (unsigned int i = 0; i < nchunks; i++, lookup += 12) {
+        if (memcmp(lookup, id, 4) != 0)
+            continue;
+        uint64_t start = get_be64(lookup + 4);
+        uint64_t end = get_be64(lookup + 16);
+        if (start > end || end > size)
+            return NULL;
+        *chunksize = end - start;
+        return data + start;
+    }
+    return NULL;
+}
+
+/* mmap() and check one commit-graph file; nbase is the number of base
+ * layers git must have recorded in it.
+ */
+static int
+open_layer(const char *filename, int hashsize, int nbase,
+           graph_layer_t *layer)
+{
+    struct stat statbuf;
+    void *data;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        debug("error opening '%s': %s", filename, strerror(errno));
+        return 0;
+    }
+    if (fstat(fd, &statbuf) < 0 || statbuf.st_size < 8 + 12) {
+        close(fd);
+        return 0;
+    }
+    data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        debug("failed to mmap() '%s': %s", filename, strerror(errno));
+        return 0;
+    }
+    memset(layer, 0, sizeof(graph_layer_t));
+    layer->data = data;
+    layer->size = statbuf.st_size;
+
+    /* header: "CGPH", version 1, hash version, chunks, base layers */
+    const unsigned char *p = layer->data;
+    unsigned int nchunks = p[6];
+    if (memcmp(p, "CGPH", 4) != 0 || p[4] != 1 ||
+        p[5] != (hashsize == 32 ? 2 : 1) || p[7] != nbase ||
+        8 + (nchunks + 1) * 12 > layer->size) {
+        debug("'%s': not a commit-graph we understand", filename);
+        goto err;
+    }
+
+    size_t fanoutsize, oidsize, cdatsize, edgesize;
+    layer->fanout = find_chunk(p, layer->size, nchunks, "OIDF", &fanoutsize);
+    layer->oids = find_chunk(p, layer->size, nchunks, "OIDL", &oidsize);
+    layer->cdat = find_chunk(p, layer->size, nchunks, "CDAT", &cdatsize);
+    layer->edges = find_chunk(p, layer->size, nchunks, "EDGE", &edgesize);
+    if (layer->fanout == NULL || layer->oids == NULL ||
+        layer->cdat == NULL || fanoutsize != 256 * 4)
+        goto corrupt;
+    layer->ncommits = get_be32(layer->fanout + 255 * 4);
+    if (oidsize != (size_t) layer->ncommits * hashsize ||
+        cdatsize != (size_t) layer->ncommits * (hashsize + 16))
+        goto corrupt;
+    layer->nedges = layer->edges != NULL ? edgesize / 4 : 0;
+    return 1;
+
+ corrupt:
+    debug("'%s': corrupt commit-graph", filename);
+ err:
+    munmap(data, layer->size);
+    return 0;
+}
+
+static commitgraph_t *
+new_graph(int hashsize, int nlayers)
+{
+    commitgraph_t *graph = calloc(1, sizeof(commitgraph_t));
+    if (graph == NULL)
+        return NULL;
+    graph->hashsize = hashsize;
+    graph->layers = calloc(nlayers, sizeof(graph_layer_t));
+    if (graph->layers == NULL) {
+        free(graph);
+        return NULL;
+    }
+    return graph;
+}
+
+/* Add layer to graph, on top of those already there. */
+static int
+add_layer(commitgraph_t *graph, const char *filename)
+{
+    graph_layer_t *layer = &graph->layers[graph->nlayers];
+    if (!open_layer(filename, graph->hashsize, graph->nlayers, layer))
+        return 0;
+    layer->nbase = graph->ncommits;
+    if (layer->ncommits > UINT32_MAX - graph->ncommits) {
+        munmap((void *) layer->data, layer->size);
+        return 0;
+    }
+    graph->ncommits += layer->ncommits;
+    graph->nlayers++;
+    return 1;
+}
+
+commitgraph_t *
+open_commit_graph(const char *objdir, int hashsize)
+{
+    char filename[1024], line[128];
+    commitgraph_t *graph;
+    FILE *chain;
+
+    snprintf(filename, sizeof(filename), "%s/info/commit-graph", objdir);
+    if (isfile(filename)) {
+        graph = new_graph(hashsize, 1);
+        if (graph != NULL && !add_layer(graph, filename)) {
+            free_commit_graph(graph);
+            graph = NULL;
+        }
+        return graph;
+    }
+
+    snprintf(filename, sizeof(filename),
+             "%s/info/commit-graphs/commit-graph-chain", objdir);
+    chain = fopen(filename, "r");
+    if (chain == NULL) {
+        debug("no commit-graph in '%s'", objdir);
+        return NULL;
+    }
+    graph = new_graph(hashsize, GRAPH_MAX_LAYERS);
+    while (graph != NULL && fgets(line, sizeof(line), chain) != NULL) {
+        chop_newline(line);
+        if (graph->nlayers == GRAPH_MAX_LAYERS ||
+            strlen(line) != (size_t) hashsize * 2)
+            goto err;
+        snprintf(filename, sizeof(filename),
+                 "%s/info/commit-graphs/graph-%s.graph", objdir, line);
+        if (!add_layer(graph, filename))
+            goto err;
+    }
+    fclose(chain);
+    if (graph != NULL && graph->nlayers == 0) {
+        free_commit_graph(graph);
+        return NULL;
+    }
+    return graph;
+
+ err:
+    debug("'%s': broken commit-graph chain", filename);
+    fclose(chain);
+    free_commit_graph(graph);
+    return NULL;
+}
+
+void
+free_commit_graph(commitgraph_t *graph)
+{
+    if (graph == NULL)
+        return;
+    for (int i = 0; i < graph->nlayers; i++)
+        munmap((void *) graph->layers[i].data, graph->layers[i].size);
+    free(graph->layers);
+    free(graph);
+}
+
+int
+find_graph_commit(const commitgraph_t *graph, const unsigned char *oid,
+                  uint32_t *pos)
+{
+    int hashsize = graph->hashsize;
+
+    for (int i = graph->nlayers - 1; i >= 0; i--) {
+        const graph_layer_t *layer = &graph->layers[i];
+        uint32_t lo = oid[0] ? get_be32(layer->fanout + (oid[0] - 1) * 4) : 0;
+        uint32_t hi = get_be32(layer->fanout + oid[0] * 4);
+        if (hi > layer->ncommits)
+            continue;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            int cmp = memcmp(layer->oids + (size_t) mid * hashsize,
+                             oid, hashsize);
+            if (cmp == 0) {
+                *pos = layer->nbase + mid;
+                return 1;
+            }
+            if (cmp < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+    return 0;
+}
+
+static const graph_layer_t *
+find_layer(const commitgraph_t *graph, uint32_t pos)
+{
+    for (int i = graph->nlayers - 1; i >= 0; i--) {
+        if (pos >= graph->layers[i].nbase)
+            return &graph->layers[i];
+    }
+    return NULL;
+}
+
+/* Return the CDAT record of the commit at pos. */
+static const unsigned char *
+commit_data(const commitgraph_t *graph, uint32_t pos,
+            const graph_layer_t **layer)
+{
+    *layer = find_layer(graph, pos);
+    return ((*layer)->cdat +
+            (size_t) (pos - (*layer)->nbase) * (graph->hashsize + 16));
+}
+
+/* Topological level of the commit at pos: always greater than that of
+ * any of its parents, or 0 if git did not compute it.
+ */
+static uint32_t
+generation(const commitgraph_t *graph, uint32_t pos)
+{
+    const graph_layer_t *layer;
+    const unsigned char *cdat = commit_data(graph, pos, &layer);
+    return get_be32(cdat + graph->hashsize + 8) >> 2;
+}
+
+/* Commit time of the commit at pos: 34 bits, after the generation. */
+uint64_t
+graph_commit_time(const commitgraph_t *graph, uint32_t pos)
+{
+    const graph_layer_t *layer;
+    const unsigned char *cdat = commit_data(graph, pos, &layer);
+    return ((uint64_t) (get_be32(cdat + graph->hashsize + 8) & 3) << 32 |
+            get_be32(cdat + graph->hashsize + 12));
+}
+
+/* Object ID of the root tree of the commit at pos. */
+const unsigned char *
+graph_commit_tree(const commitgraph_t *graph, uint32_t pos)
+{
+    const graph_layer_t *layer;
+    return commit_data(graph, pos, &layer);
+}
+
+/* Binary max-heap of commit positions, by generation. */
+typedef struct {
+    uint32_t *pos;
+    uint32_t *gen;
+    size_t len, size;
+} commit_queue_t;
+
+static int
+queue_put(commit_queue_t *queue, uint32_t pos, uint32_t gen)
+{
+    if (queue->len == queue->size) {
+        size_t size = queue->size ? queue->size * 2 : 256;
+        uint32_t *newpos = realloc(queue->pos, size * sizeof(uint32_t));
+        if (newpos == NULL)
+            return 0;
+        queue->pos = newpos;
+        uint32_t *newgen = realloc(queue->gen, size * sizeof(uint32_t));
+        if (newgen == NULL)
+            return 0;
+        queue->gen = newgen;
+        queue->size = size;
+    }
+    size_t i = queue->len++;
+    while (i > 0 && queue->gen[(i - 1) / 2] < gen) {
+        queue->pos[i] = queue->pos[(i - 1) / 2];
+        queue->gen[i] = queue->gen[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    queue->pos[i] = pos;
+    queue->gen[i] = gen;
+    return 1;
+}
+
+static uint32_t
+queue_get(commit_queue_t *queue)
+{
+    uint32_t top = queue->pos[0];
+    uint32_t pos = queue->pos[--queue->len];
+    uint32_t gen = queue->gen[queue->len];
+    size_t i = 0;
+
+    while (2 * i + 1 < queue->len) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < queue->len && queue->gen[child + 1] > queue->gen[child])
+            child++;
+        if (queue->gen[child] <= gen)
+            break;
+        queue->pos[i] = queue->pos[child];
+        queue->gen[i] = queue->gen[child];
+        i = child;
+    }
+    queue->pos[i] = pos;
+    queue->gen[i] = gen;
+    return top;
+}
+
+typedef struct {
+    const commitgraph_t *graph;
+    unsigned char *flags;               /* one per commit */
+    commit_queue_t queue;
+    size_t nonstale;                    /* queued commits not STALE */
+} graph_walk_t;
+
+/* Pass flags on to the commit at pos.  Return 0 on error. */
+static int
+mark_commit(graph_walk_t *walk, uint32_t pos, unsigned char flags)
+{
+    unsigned char old;
+
+    if (pos >= walk->graph->ncommits)
+        return 0;
+    old = walk->flags[pos];
+    if (!(old & SEEN)) {
+        uint32_t gen = generation(walk->graph, pos);
+        if (gen == 0) {
+            debug("commit-graph has no generation numbers");
+            return 0;
+        }
+        walk->flags[pos] = flags | SEEN;
+        if (flags != STALE)
+            walk->nonstale++;
+        return queue_put(&walk->queue, pos, gen);
+    }
+    /* still queued: its children all have higher generation numbers,
+     * so they were visited first */
+    walk->flags[pos] = old | flags;
+    if ((old & STALE) != STALE && (walk->flags[pos] & STALE) == STALE)
+        walk->nonstale--;
+    return 1;
+}
+
+static int
+mark_parents(graph_walk_t *walk, uint32_t pos, unsigned char flags)
+{
+    const graph_layer_t *layer;
+    const unsigned char *cdat = commit_data(walk->graph, pos, &layer);
+    uint32_t parent1 = get_be32(cdat + walk->graph->hashsize);
+    uint32_t parent2 = get_be32(cdat + walk->graph->hashsize + 4);
+
+    if (parent1 == GRAPH_PARENT_NONE)
+        return 1;
+    if (!mark_commit(walk, parent1, flags))
+        return 0;
+    if (parent2 == GRAPH_PARENT_NONE)
+        return 1;
+    if (!(parent2 & GRAPH_EXTRA_EDGES))
+        return mark_commit(walk, parent2, flags);
+
+    /* octopus merge: the other parents are listed in EDGE */
+    for (size_t i = parent2 & ~GRAPH_EXTRA_EDGES; ; i++) {
+        if (i >= layer->nedges)
+            return 0;
+        uint32_t edge = get_be32(layer->edges + i * 4);
+        if (!mark_commit(walk, edge & ~GRAPH_EDGE_LAST, flags))
+            return 0;
+        if (edge & GRAPH_EDGE_LAST)
+            return 1;
+    }
+}
+
+int
+graph_ahead_behind(const commitgraph_t *graph, uint32_t a, uint32_t b,
+                   unsigned int *ahead, unsigned int *behind)
+{
+    graph_walk_t walk;
+    int ok = 0;
+
+    *ahead = *behind = 0;
+    if (a == b)
+        return 1;
+    memset(&walk, 0, sizeof(walk));
+    walk.graph = graph;
+    walk.flags = calloc(graph->ncommits, 1);
+    if (walk.flags == NULL)
+        return 0;
+    if (!mark_commit(&walk, a, FROM_A) || !mark_commit(&walk, b, FROM_B))
+        goto done;
+
+    /* once every queued commit is reachable from both, so is
+     * everything behind them */
+    while (walk.nonstale > 0) {
+        uint32_t pos = queue_get(&walk.queue);
+        unsigned char flags = walk.flags[pos] & STALE;
+        if (flags != STALE)
+            walk.nonstale--;
+        if (flags == FROM_A)
+            (*ahead)++;
+        else if (flags == FROM_B)
+            (*behind)++;
+        if (!mark_parents(&walk, pos, flags))
+            goto done;
+    }
+    ok = 1;
+
+ done:
+    free(walk.flags);
+    free(walk.queue.pos);
+    free(walk.queue.gen);
+    return ok;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITGRAPH_H
+#define GITGRAPH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* One commit-graph file: either objects/info/commit-graph, or one
+ * layer of a split graph listed in
+ * objects/info/commit-graphs/commit-graph-chain.
+ */
+typedef struct {
+    const unsigned char *data;          /* whole file, mmap()ed */
+    size_t size;
+    uint32_t ncommits;                  /* commits in this file */
+    uint32_t nbase;                     /* commits in the layers below */
+    const unsigned char *fanout;        /* OIDF chunk */
+    const unsigned char *oids;          /* OIDL chunk */
+    const unsigned char *cdat;          /* CDAT chunk */
+    const unsigned char *edges;         /* EDGE chunk (octopus merges) */
+    size_t nedges;
+} graph_layer_t;
+
+/* git's commit-graph: every commit it knows about has a position
+ * (counting up through the layers, base first), its parents'
+ * positions and a generation number.
+ */
+typedef struct {
+    int hashsize;
+    graph_layer_t *layers;              /* base first */
+    int nlayers;
+    uint32_t ncommits;                  /* in all layers */
+} commitgraph_t;
+
+/* mmap() the commit-graph of the object directory objdir (e.g.
+ * ".git/objects"), or the layers of its split commit-graph.  Return
+ * NULL if there is none or it is corrupt.  Caller must free the result
+ * with free_commit_graph().
+ */
+commitgraph_t *
+open_commit_graph(const char *objdir, int hashsize);
+
+void
+free_commit_graph(commitgraph_t *graph);
+
+/* Find the commit with binary object ID oid.  Store its position in
+ * *pos and return 1, or return 0 if the graph does not have it.
+ */
+int
+find_graph_commit(const commitgraph_t *graph, const unsigned char *oid,
+                  uint32_t *pos);
+
+/* Return the committer time (seconds since the epoch) of the commit at
+ * pos.
+ */
+uint64_t
+graph_commit_time(const commitgraph_t *graph, uint32_t pos);
+
+/* Return the binary object ID of the root tree of the commit at pos
+ * (it points into the graph).
+ */
+const unsigned char *
+graph_commit_tree(const commitgraph_t *graph, uint32_t pos);
+
+/* Count the commits reachable from commit a but not from b (*ahead),
+ * and from b but not from a (*behind), like "git rev-list --count
+ * --left-right a...b".  Commits are visited in order of decreasing
+ * generation number, so the walk stops as soon as it only has commits
+ * left that both can reach.  Return 1 on success, 0 if the graph is
+ * corrupt or lacks generation numbers.
+ */
+int
+graph_ahead_behind(const commitgraph_t *graph, uint32_t a, uint32_t b,
+                   unsigned int *ahead, unsigned int *behind);
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "githash.h"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void
+sha1_block(uint32_t *state, const unsigned char *p)
+{
+    uint32_t w[80];
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+        e = state[4];
+
+    for (int i = 0; i < 16; i++)
+        w[i] = get_be32(p + 4 * i);
+    for (int i = 16; i < 80; i++)
+        w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+#define SHA1_ROUND(f, k, i) do {                                \
+        uint32_t t = ROL(a, 5) + (f) + e + (k) + w[i];          \
+        e = d;                                                  \
+        d = c;                                                  \
+        c = ROL(b, 30);                                         \
+        b = a;                                                  \
+        a = t;                                                  \
+    } while (0)
+
+    for (int i = 0; i < 20; i++)
+        SHA1_ROUND(d ^ (b & (c ^ d)), 0x5a827999, i);
+    for (int i = 20; i < 40; i++)
+        SHA1_ROUND(b ^ c ^ d, 0x6ed9eba1, i);
+    for (int i = 40; i < 60; i++)
+        SHA1_ROUND((b & c) | (d & (b | c)), 0x8f1bbcdc, i);
+    for (int i = 60; i < 80; i++)
+        SHA1_ROUND(b ^ c ^ d, 0xca62c1d6, i);
+#undef SHA1_ROUND
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+static void
+sha256_block(uint32_t *state, const unsigned char *p)
+{
+    uint32_t w[64], s[8];
+
+    for (int i = 0; i < 16; i++)
+        w[i] = get_be32(p + 4 * i);
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    memcpy(s, state, sizeof(s));
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = (s[7] + (ROR(s[4], 6) ^ ROR(s[4], 11) ^ ROR(s[4], 25)) +
+                       ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i]);
+        uint32_t t2 = ((ROR(s[0], 2) ^ ROR(s[0], 13) ^ ROR(s[0], 22)) +
+                       ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2])));
+        memmove(s + 1, s, 7 * sizeof(uint32_t));
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; i++)
+        state[i] += s[i];
+}
+
+static void
+hash_block(githash_t *hash, const unsigned char *p)
+{
+    if (hash->hashsize == 32)
+        sha256_block(hash->state, p);
+    else
+        sha1_block(hash->state, p);
+}
+
+void
+githash_init(githash_t *hash, int hashsize)
+{
+    static const uint32_t sha1_init[5] = {
+        0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+    };
+    static const uint32_t sha256_init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memset(hash, 0, sizeof(githash_t));
+    hash->hashsize = hashsize;
+    if (hashsize == 32)
+        memcpy(hash->state, sha256_init, sizeof(sha256_init));
+    else
+        memcpy(hash->state, sha1_init, sizeof(sha1_init));
+}
+
+void
+githash_update(githash_t *hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    hash->length += len;
+    if (hash->used > 0) {
+        size_t n = 64 - hash->used;
+        if (n > len)
+            n = len;
+        memcpy(hash->block + hash->used, p, n);
+        hash->used += n;
+        p += n;
+        len -= n;
+        if (hash->used < 64)
+            return;
+        hash_block(hash, hash->block);
+        hash->used = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64)
+        hash_block(hash, p);
+    memcpy(hash->block, p, len);
+    hash->used = len;
+}
+
+void
+githash_final(githash_t *hash, unsigned char *oid)
+{
+    uint64_t bits = hash->length * 8;
+
+    /* 0x80, zeros, then the length in bits: both hashes pad alike */
+    hash->block[hash->used++] = 0x80;
+    if (hash->used > 56) {
+        memset(hash->block + hash->used, 0, 64 - hash->used);
+        hash_block(hash, hash->block);
+        hash->used = 0;
+    }
+    memset(hash->block + hash->used, 0, 56 - hash->used);
+    for (int i = 0; i < 8; i++)
+        hash->block[56 + i] = bits >> (56 - 8 * i);
+    hash_block(hash, hash->block);
+
+    for (int i = 0; i < hash->hashsize / 4; i++) {
+        oid[4 * i] = hash->state[i] >> 24;
+        oid[4 * i + 1] = hash->state[i] >> 16;
+        oid[4 * i + 2] = hash->state[i] >> 8;
+        oid[4 * i + 3] = hash->state[i];
+    }
+}
+
+int
+hash_blob_file(const char *path, const struct stat *statbuf,
+               int hashsize, unsigned char *oid)
+{
+    githash_t hash;
+    char header[32], buf[65536];
+    long long size = statbuf->st_size, total = 0;
+    int fd = -1;
+    ssize_t n;
+
+    githash_init(&hash, hashsize);
+    githash_update(&hash, header,
+                   snprintf(header, sizeof(header), "blob %lld", size) + 1);
+
+    if (S_ISLNK(statbuf->st_mode)) {
+        n = readlink(path, buf, sizeof(buf));
+        if (n != size) {
+            debug("failed to read symlink '%s'", path);
+            return 0;
+        }
+        githash_update(&hash, buf, n);
+        githash_final(&hash, oid);
+        return 1;
+    }
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        goto err;
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            goto err;
+        }
+        total += n;
+        if (total > size)
+            goto err;
+        githash_update(&hash, buf, n);
+    }
+    close(fd);
+    fd = -1;
+    if (total != size)
+        goto err;
+    githash_final(&hash, oid);
+    return 1;
+
+ err:
+    debug("failed to hash '%s'", path);
+    if (fd >= 0)
+        close(fd);
+    return 0;
+}
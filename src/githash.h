@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITHASH_H
+#define GITHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/* The state of a SHA-1 (hashsize 20) or SHA-256 (hashsize 32)
+ * computation: git names objects by one or the other, depending on
+ * extensions.objectFormat.
+ */
+typedef struct {
+    int hashsize;
+    uint32_t state[8];
+    uint64_t length;                    /* bytes hashed so far */
+    unsigned char block[64];
+    size_t used;                        /* bytes in block */
+} githash_t;
+
+void
+githash_init(githash_t *hash, int hashsize);
+
+void
+githash_update(githash_t *hash, const void *data, size_t len);
+
+/* Store the hashsize bytes of the digest in oid. */
+void
+githash_final(githash_t *hash, unsigned char *oid);
+
+/* Compute the object ID that git would give the file path as a blob:
+ * the hash of "blob <size>" NUL <content>, where the content of a
+ * symlink is its target.  No filters or end-of-line conversion are
+ * applied.  statbuf is lstat() of path.  Return 1 on success, 0 if
+ * path cannot be read or changed size while being read.
+ */
+int
+hash_blob_file(const char *path, const struct stat *statbuf,
+               int hashsize, unsigned char *oid);
+
+#endif
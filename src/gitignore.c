@@ -0,0 +1,450 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "gitignore.h"
+
+/* Match the bracket expression at *pp (just after the "[") against c,
+ * and move *pp past its closing "]".  Return 1 if c matches, 0 if not,
+ * -1 if there is no closing "]".
+ */
+static int
+match_bracket(const char **pp, unsigned char c)
+{
+    static const struct {
+        const char *name;
+        int (*test)(int);
+    } classes[] = {
+        {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+        {"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+        {"lower", islower}, {"print", isprint}, {"punct", ispunct},
+        {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+    };
+    const char *p = *pp;
+    int negated = 0, matched = 0;
+
+    if (*p == '!' || *p == '^') {
+        negated = 1;
+        p++;
+    }
+    for (int first = 1; *p != ']' || first; first = 0) {
+        unsigned char lo;
+        if (*p == '\0')
+            return -1;
+        if (p[0] == '[' && p[1] == ':') {
+            const char *end = strstr(p + 2, ":]");
+            if (end == NULL)
+                return -1;
+            for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+                if (strlen(classes[i].name) == (size_t) (end - p - 2) &&
+                    strncmp(classes[i].name, p + 2, end - p - 2) == 0 &&
+                    classes[i].test(c))
+                    matched = 1;
+            }
+            p = end + 2;
+            continue;
+        }
+        if (*p == '\\' && p[1] != '\0')
+            p++;
+        lo = *p++;
+        if (p[0] == '-' && p[1] != ']' && p[1] != '\0') {
+            unsigned char hi;
+            p++;
+            if (*p == '\\' && p[1] != '\0')
+                p++;
+            hi = *p++;
+            if (lo <= c && c <= hi)
+                matched = 1;
+        }
+        else if (lo == c)
+            matched = 1;
+    }
+    *pp = p + 1;
+    return matched != negated;
+}
+
+static int
+wildmatch(const char *start, const char *p, const char *t)
+{
+    for (; *p != '\0'; p++, t++) {
+        switch (*p) {
+        case '?':
+            if (*t == '\0' || *t == '/')
+                return 0;
+            break;
+
+        case '*':
+            if (p[1] == '*' && (p == start || p[-1] == '/') &&
+                (p[2] == '\0' || p[2] == '/')) {
+                /* "**": any number of directories */
+                if (p[2] == '\0')
+                    return 1;
+                if (wildmatch(start, p + 3, t))
+                    return 1;
+                for (; *t != '\0'; t++) {
+                    if (*t == '/' && wildmatch(start, p + 3, t + 1))
+                        return 1;
+                }
+                return 0;
+            }
+            while (p[1] == '*')
+                p++;
+            /* "*": anything but "/" */
+            for (;; t++) {
+                if (wildmatch(start, p + 1, t))
+                    return 1;
+                if (*t == '\0' || *t == '/')
+                    return 0;
+            }
+
+        case '[': {
+            const char *q = p + 1;
+            if (*t == '\0' || *t == '/' ||
+                match_bracket(&q, (unsigned char) *t) != 1)
+                return 0;
+            p = q - 1;
+            break;
+        }
+
+        case '\\':
+            p++;
+            if (*p == '\0')
+                return 0;
+            /* fall through */
+        default:
+            if (*p != *t)
+                return 0;
+        }
+    }
+    return *t == '\0';
+}
+
+int
+glob_match(const char *pattern, const char *text)
+{
+    return wildmatch(pattern, pattern, text);
+}
+
+static int
+has_glob(const char *s, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (strchr("*?[\\", s[i]) != NULL)
+            return 1;
+    }
+    return 0;
+}
+
+/* Parse one line of an ignore file, in place.  Return 0 for blank
+ * lines and comments.
+ */
+static int
+parse_pattern(char *line, ignore_pattern_t *pattern)
+{
+    size_t len = strlen(line);
+
+    memset(pattern, 0, sizeof(ignore_pattern_t));
+    if (len > 0 && line[len - 1] == '\r')
+        line[--len] = '\0';
+    /* trailing spaces are ignored unless escaped */
+    while (len > 0 && line[len - 1] == ' ' &&
+           !(len > 1 && line[len - 2] == '\\'))
+        line[--len] = '\0';
+    if (len == 0 || line[0] == '#')
+        return 0;
+    if (line[0] == '!') {
+        pattern->negated = 1;
+        line++;
+        len--;
+    }
+    if (len > 0 && line[len - 1] == '/') {
+        pattern->dir_only = 1;
+        line[--len] = '\0';
+    }
+    if (len == 0)
+        return 0;
+    pattern->basename = (memchr(line, '/', len) == NULL);
+    if (line[0] == '/') {
+        line++;
+        len--;
+    }
+
+    pattern->pattern = line;
+    pattern->len = len;
+    pattern->literal = line;
+    if (!has_glob(line, len)) {
+        pattern->kind = IGNORE_LITERAL;
+        pattern->literal_len = len;
+    }
+    else if (pattern->basename && line[0] == '*' &&
+             !has_glob(line + 1, len - 1)) {
+        pattern->kind = IGNORE_SUFFIX;
+        pattern->literal = line + 1;
+        pattern->literal_len = len - 1;
+    }
+    else if (pattern->basename && line[len - 1] == '*' &&
+             !has_glob(line, len - 1)) {
+        pattern->kind = IGNORE_PREFIX;
+        pattern->literal_len = len - 1;
+    }
+    else {
+        /* the text before the first wildcard must match literally */
+        pattern->kind = IGNORE_GLOB;
+        pattern->literal_len = strcspn(line, "*?[\\");
+    }
+    return 1;
+}
+
+/* Classes of slots: a pattern without "/" matches a name at any
+ * depth, one with "/" the whole path. */
+enum {
+    SLOT_PATH,
+    SLOT_NAME,
+    SLOT_SUFFIX,
+};
+
+static size_t
+hash_slot(int class, const char *s, size_t len)
+{
+    size_t hash = 2166136261u ^ class;
+
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char) s[i]) * 16777619u;
+    return hash;
+}
+
+static ignore_slot_t *
+find_slot(const ignore_list_t *list, int class, const char *s, size_t len)
+{
+    for (size_t i = hash_slot(class, s, len) & (list->nslots - 1); ;
+         i = (i + 1) & (list->nslots - 1)) {
+        ignore_slot_t *slot = &list->slots[i];
+        if (slot->key == NULL ||
+            (slot->class == class && slot->len == len &&
+             memcmp(slot->key, s, len) == 0))
+            return slot;
+    }
+}
+
+/* Hash the literal and suffix patterns of list, and keep the indices
+ * of the others.  Return 0 if out of memory.
+ */
+static int
+index_patterns(ignore_list_t *list)
+{
+    list->nslots = 16;
+    while (list->nslots < 2 * (size_t) list->npatterns)
+        list->nslots *= 2;
+    list->slots = calloc(list->nslots, sizeof(ignore_slot_t));
+    list->others = malloc(list->npatterns * sizeof(int));
+    if (list->slots == NULL || list->others == NULL)
+        return 0;
+
+    for (int i = 0; i < list->npatterns; i++) {
+        const ignore_pattern_t *pattern = &list->patterns[i];
+        int class;
+
+        if (pattern->kind == IGNORE_LITERAL)
+            class = pattern->basename ? SLOT_NAME : SLOT_PATH;
+        else if (pattern->kind == IGNORE_SUFFIX)
+            class = SLOT_SUFFIX;
+        else {
+            list->others[list->nothers++] = i;
+            continue;
+        }
+        ignore_slot_t *slot = find_slot(list, class, pattern->literal,
+                                        pattern->literal_len);
+        if (slot->key == NULL) {
+            slot->key = pattern->literal;
+            slot->len = pattern->literal_len;
+            slot->class = class;
+            slot->last_file = -1;
+            if (class == SLOT_SUFFIX) {
+                int j;
+                for (j = 0; j < list->nsuffix_lens &&
+                         list->suffix_lens[j] != slot->len; j++)
+                    ;
+                if (j < list->nsuffix_lens)
+                    ;
+                else if (j < (int) (sizeof(list->suffix_lens) /
+                                    sizeof(list->suffix_lens[0])))
+                    list->suffix_lens[list->nsuffix_lens++] = slot->len;
+                else
+                    list->any_suffix_len = 1;
+            }
+        }
+        slot->last = i;
+        if (!pattern->dir_only)
+            slot->last_file = i;
+    }
+    return 1;
+}
+
+ignore_list_t *
+read_ignore_list(const char *filename, const char *base, size_t baselen,
+                 const ignore_list_t *parent)
+{
+    ignore_list_t *list;
+    FILE *file;
+    long size;
+    int maxpatterns = 0;
+
+    file = fopen(filename, "r");
+    if (file == NULL)
+        return NULL;
+    list = calloc(1, sizeof(ignore_list_t));
+    if (list == NULL ||
+        fseek(file, 0, SEEK_END) < 0 || (size = ftell(file)) < 0 ||
+        fseek(file, 0, SEEK_SET) < 0 ||
+        (list->buf = malloc(size + 1)) == NULL ||
+        fread(list->buf, 1, size, file) != (size_t) size)
+        goto err;
+    fclose(file);
+    file = NULL;
+    list->buf[size] = '\0';
+    list->base = strndup(base, baselen);
+    list->baselen = baselen;
+    list->parent = parent;
+
+    for (char *line = list->buf; line != NULL && *line != '\0'; ) {
+        char *eol = strchr(line, '\n');
+        if (eol != NULL)
+            *eol++ = '\0';
+        if (list->npatterns == maxpatterns) {
+            maxpatterns = maxpatterns ? maxpatterns * 2 : 16;
+            ignore_pattern_t *patterns = realloc(
+                list->patterns, maxpatterns * sizeof(ignore_pattern_t));
+            if (patterns == NULL)
+                goto err;
+            list->patterns = patterns;
+        }
+        if (parse_pattern(line, &list->patterns[list->npatterns]))
+            list->npatterns++;
+        line = eol;
+    }
+    if (list->base == NULL || list->npatterns == 0 ||
+        !index_patterns(list))
+        goto err;
+    debug("read %d patterns from '%s'", list->npatterns, filename);
+    return list;
+
+ err:
+    if (file != NULL)
+        fclose(file);
+    free_ignore_list(list);
+    return NULL;
+}
+
+void
+free_ignore_list(ignore_list_t *list)
+{
+    if (list == NULL)
+        return;
+    free(list->base);
+    free(list->patterns);
+    free(list->buf);
+    free(list->slots);
+    free(list->others);
+    free(list);
+}
+
+static int
+match_pattern(const ignore_pattern_t *pattern,
+              const char *name, size_t namelen)
+{
+    switch (pattern->kind) {
+    case IGNORE_PREFIX:
+        return (namelen >= pattern->literal_len &&
+                memcmp(name, pattern->literal, pattern->literal_len) == 0);
+    case IGNORE_GLOB:
+    default:                            /* the rest are hashed */
+        return (namelen >= pattern->literal_len &&
+                memcmp(name, pattern->literal, pattern->literal_len) == 0 &&
+                glob_match(pattern->pattern, name));
+    }
+}
+
+/* Return the index of the last pattern in slot that applies, or -1. */
+static int
+slot_match(const ignore_list_t *list, int class, const char *s, size_t len,
+           int isdir)
+{
+    const ignore_slot_t *slot = find_slot(list, class, s, len);
+
+    if (slot->key == NULL)
+        return -1;
+    return isdir ? slot->last : slot->last_file;
+}
+
+/* Return the index of the last pattern of list that matches, or -1. */
+static int
+last_match(const ignore_list_t *list, const char *name, size_t namelen,
+           const char *relpath, size_t rellen, int isdir)
+{
+    int last, i;
+
+    last = slot_match(list, SLOT_NAME, name, namelen, isdir);
+    i = slot_match(list, SLOT_PATH, relpath, rellen, isdir);
+    if (i > last)
+        last = i;
+    if (list->any_suffix_len) {
+        for (size_t len = 0; len <= namelen; len++) {
+            i = slot_match(list, SLOT_SUFFIX, name + namelen - len, len,
+                           isdir);
+            if (i > last)
+                last = i;
+        }
+    }
+    else {
+        for (int j = 0; j < list->nsuffix_lens; j++) {
+            size_t len = list->suffix_lens[j];
+            if (len > namelen)
+                continue;
+            i = slot_match(list, SLOT_SUFFIX, name + namelen - len, len,
+                           isdir);
+            if (i > last)
+                last = i;
+        }
+    }
+
+    /* only a later pattern can override what the hash found */
+    for (int j = list->nothers - 1; j >= 0 && list->others[j] > last; j--) {
+        const ignore_pattern_t *pattern = &list->patterns[list->others[j]];
+        if (pattern->dir_only && !isdir)
+            continue;
+        if (pattern->basename
+            ? match_pattern(pattern, name, namelen)
+            : match_pattern(pattern, relpath, rellen))
+            return list->others[j];
+    }
+    return last;
+}
+
+int
+is_ignored(const ignore_list_t *list, const char *path, size_t pathlen,
+           int isdir)
+{
+    const char *slash = strrchr(path, '/');
+    const char *name = slash != NULL ? slash + 1 : path;
+    size_t namelen = pathlen - (name - path);
+
+    for (; list != NULL; list = list->parent) {
+        /* relative to the directory of the ignore file */
+        int i = last_match(list, name, namelen, path + list->baselen,
+                           pathlen - list->baselen, isdir);
+        if (i >= 0)
+            return !list->patterns[i].negated;
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITIGNORE_H
+#define GITIGNORE_H
+
+#include <stddef.h>
+
+/* How a pattern is matched: most lines of real ignore files are a
+ * plain name ("build"), a suffix ("*.o") or a prefix ("core.*"), which
+ * need no glob matching at all.
+ */
+typedef enum {
+    IGNORE_LITERAL,
+    IGNORE_SUFFIX,                      /* "*" + literal */
+    IGNORE_PREFIX,                      /* literal + "*" */
+    IGNORE_GLOB,
+} ignore_kind_t;
+
+typedef struct {
+    const char *pattern;                /* without "!", "/" or escapes */
+    size_t len;
+    const char *literal;                /* the literal part of it */
+    size_t literal_len;
+    ignore_kind_t kind;
+    unsigned int negated:1;             /* "!pattern" */
+    unsigned int dir_only:1;            /* "pattern/" */
+    unsigned int basename:1;            /* no "/": match at any depth */
+} ignore_pattern_t;
+
+/* A slot of the hash table of an ignore list's literal patterns: all
+ * the patterns that are the same name, path or "*" + suffix.  The last
+ * matching pattern wins, so only the last of them matters: or, for a
+ * file, the last that is not "dir/" only.
+ */
+typedef struct {
+    const char *key;                    /* NULL if the slot is free */
+    size_t len;
+    int class;                          /* name, path or suffix */
+    int last;                           /* index of the pattern */
+    int last_file;                      /* -1 if all are "dir/" */
+} ignore_slot_t;
+
+/* The patterns of one ignore file (.gitignore, .git/info/exclude or
+ * core.excludesFile).  Per-directory lists are chained to the lists of
+ * their parent directories, innermost first, ending with the global
+ * ones.
+ */
+typedef struct ignore_list {
+    char *base;                         /* dir of a .gitignore, e.g.
+                                           "src/" (or "") */
+    size_t baselen;
+    ignore_pattern_t *patterns;
+    int npatterns;
+    char *buf;                          /* the file, chopped into lines */
+    const struct ignore_list *parent;
+
+    /* the literal and suffix patterns, hashed; the rest, in order */
+    ignore_slot_t *slots;
+    size_t nslots;
+    size_t suffix_lens[16];             /* distinct suffix lengths */
+    int nsuffix_lens;
+    int any_suffix_len;                 /* more than fit in suffix_lens */
+    int *others;
+    int nothers;
+} ignore_list_t;
+
+/* Read the ignore file filename, whose patterns are relative to the
+ * directory in the first baselen bytes of base (which end with "/", or
+ * are empty for the top of the working dir), and chain it to parent.
+ * Return NULL if the file does not exist or cannot be read, or has no
+ * patterns; caller must free the result with free_ignore_list().
+ */
+ignore_list_t *
+read_ignore_list(const char *filename, const char *base, size_t baselen,
+                 const ignore_list_t *parent);
+
+void
+free_ignore_list(ignore_list_t *list);
+
+/* Decide whether path (pathlen bytes, NUL-terminated, relative to the
+ * top of the working dir, without a trailing slash) is ignored by list
+ * or the lists it is chained to.  The innermost list with a matching
+ * pattern decides, and within a list the last matching pattern, as in
+ * gitignore(5).  Literal patterns are looked up rather than tried one
+ * by one.  Return 1 if path is ignored, 0 if not (or if it is
+ * re-included by a "!" pattern).
+ */
+int
+is_ignored(const ignore_list_t *list, const char *path, size_t pathlen,
+           int isdir);
+
+/* Match text against the shell glob pattern, the way git's wildmatch()
+ * does with WM_PATHNAME: "*", "?" and "[...]" do not match "/", but
+ * "**" between slashes matches any number of directories.
+ */
+int
+glob_match(const char *pattern, const char *text);
+
+#endif
@@ -0,0 +1,1008 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "../config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "gitindex.h"
+
+/* size of the fixed part of an entry: 10 32-bit stat fields, the
+ * object ID, and the 16-bit flags word */
+#define ENTRY_FIXED_LEN(hashsize) (40 + (hashsize) + 2)
+
+int
+decode_varint(const unsigned char *p, const unsigned char *end, size_t *value)
+{
+    const unsigned char *start = p;
+    size_t val;
+
+    if (p >= end)
+        return 0;
+    val = *p & 0x7f;
+    while (*p++ & 0x80) {
+        if (p >= end)
+            return 0;
+        val = ((val + 1) << 7) | (*p & 0x7f);
+    }
+    *value = val;
+    return p - start;
+}
+
+/* Return the size of the on-disk entry at pos, or 0 if it runs past
+ * end.  Only for index versions 2 and 3, where entries are padded to a
+ * multiple of 8 bytes.
+ */
+static size_t
+padded_entry_size(const gitindex_t *index,
+                  const unsigned char *pos, const unsigned char *end)
+{
+    size_t fixed = ENTRY_FIXED_LEN(index->hashsize);
+    if (pos + fixed > end)
+        return 0;
+    unsigned int flags = get_be16(pos + fixed - 2);
+    if (flags & CE_EXTENDED)
+        fixed += 2;
+    if (pos + fixed > end)
+        return 0;
+
+    size_t namelen = flags & CE_NAMEMASK;
+    const unsigned char *name = pos + fixed;
+    if (namelen == CE_NAMEMASK) {
+        const unsigned char *nul = memchr(name, '\0', end - name);
+        if (nul == NULL)
+            return 0;
+        namelen = nul - name;
+    }
+    size_t size = (fixed + namelen + 8) & ~7;
+    if (pos + size > end || name[namelen] != '\0')
+        return 0;
+    return size;
+}
+
+/* Skip over all entries without decoding them, to find where the
+ * extensions start.  Return NULL if the entries are corrupt.
+ */
+static const unsigned char *
+skip_entries(const gitindex_t *index)
+{
+    const unsigned char *pos = index->entries;
+    unsigned int i;
+
+    for (i = 0; i < index->nondisk; i++) {
+        if (index->version < 4) {
+            size_t size = padded_entry_size(index, pos, index->end);
+            if (size == 0)
+                return NULL;
+            pos += size;
+        }
+        else {
+            size_t fixed = ENTRY_FIXED_LEN(index->hashsize), strip;
+            if (pos + fixed > index->end)
+                return NULL;
+            if (get_be16(pos + fixed - 2) & CE_EXTENDED)
+                fixed += 2;
+            pos += fixed;
+            int n = decode_varint(pos, index->end, &strip);
+            if (n == 0)
+                return NULL;
+            pos += n;
+            const unsigned char *nul = memchr(pos, '\0', index->end - pos);
+            if (nul == NULL)
+                return NULL;
+            pos = nul + 1;
+        }
+    }
+    return pos;
+}
+
+/* If the index ends with an EOIE ("end of index entries") extension,
+ * return the start of the extensions that it records, else NULL.
+ */
+static const unsigned char *
+find_eoie(const gitindex_t *index)
+{
+    size_t eoie_size = 4 + index->hashsize;
+    const unsigned char *ext = index->end - 8 - eoie_size;
+
+    if (ext < index->entries ||
+        memcmp(ext, "EOIE", 4) != 0 || get_be32(ext + 4) != eoie_size)
+        return NULL;
+
+    const unsigned char *start = index->data + get_be32(ext + 8);
+    if (start < index->entries || start > ext)
+        return NULL;
+    return start;
+}
+
+/* Walk the extensions to check that they are well-formed and that
+ * there are none that git requires readers to understand (signature
+ * starting with a lowercase letter) other than the ones we know.
+ */
+static int
+check_extensions(const gitindex_t *index)
+{
+    const unsigned char *pos = index->extensions;
+
+    while (pos < index->end) {
+        if (pos + 8 > index->end)
+            return 0;
+        size_t size = get_be32(pos + 4);
+        if (size > (size_t) (index->end - pos - 8))
+            return 0;
+        if (pos[0] >= 'a' && pos[0] <= 'z' &&
+            memcmp(pos, "link", 4) != 0 && memcmp(pos, "sdir", 4) != 0) {
+            debug("index has unsupported extension '%.4s'", pos);
+            return 0;
+        }
+        pos += 8 + size;
+    }
+    return 1;
+}
+
+static unsigned int
+count_bits(const unsigned char *bitmap, size_t nbits)
+{
+    unsigned int count = 0;
+    for (size_t i = 0; i < nbits; i++) {
+        if (BITMAP_TEST(bitmap, i))
+            count++;
+    }
+    return count;
+}
+
+/* If index is split, open the shared index named by its "link"
+ * extension (in the same directory as filename) and work out how many
+ * entries the two make together.  Return 0 on error.
+ */
+static int
+open_shared_index(gitindex_t *index, const char *filename)
+{
+    const unsigned char *link, *end;
+    char path[1024], hex[2 * 32 + 1];
+    size_t size, n;
+    int i;
+
+    link = find_index_extension(index, "link", &size);
+    if (link == NULL)
+        return 1;
+    if (size < (size_t) index->hashsize)
+        goto corrupt;
+    end = link + size;
+
+    for (i = 0; i < index->hashsize; i++) {
+        if (link[i] != 0)
+            break;
+    }
+    if (i == index->hashsize)
+        return 1;               /* null: everything is in this file */
+    for (i = 0; i < index->hashsize; i++)
+        sprintf(hex + 2 * i, "%02x", link[i]);
+
+    if (size > (size_t) index->hashsize) {
+        const unsigned char *p = link + index->hashsize;
+        n = read_ewah(p, end, &index->delete_bitmap, &index->ndelete);
+        if (n == 0)
+            goto corrupt;
+        p += n;
+        n = read_ewah(p, end, &index->replace_bitmap, &index->nreplace);
+        if (n == 0)
+            goto corrupt;
+    }
+
+    const char *slash = strrchr(filename, '/');
+    int dirlen = slash != NULL ? slash - filename + 1 : 0;
+    snprintf(path, sizeof(path), "%.*ssharedindex.%s", dirlen, filename, hex);
+    index->base = open_git_index(path, index->hashsize);
+    if (index->base == NULL)
+        return 0;
+    if (index->base->base != NULL ||
+        index->ndelete > index->base->nentries ||
+        index->nreplace > index->base->nentries)
+        goto corrupt;
+
+    unsigned int ndeleted = count_bits(index->delete_bitmap, index->ndelete);
+    index->nreplaced = count_bits(index->replace_bitmap, index->nreplace);
+    if (index->nreplaced > index->nondisk)
+        goto corrupt;
+    index->nentries = (index->base->nentries - ndeleted +
+                       index->nondisk - index->nreplaced);
+    debug("split index: %u entries in all, %u replaced, %u deleted",
+          index->nentries, index->nreplaced, ndeleted);
+    return 1;
+
+ corrupt:
+    debug("'%s': corrupt split index link", filename);
+    return 0;
+}
+
+gitindex_t *
+open_git_index(const char *filename, int hashsize)
+{
+    gitindex_t *index = NULL;
+    struct stat statbuf;
+    void *data = MAP_FAILED;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        debug("error opening '%s': %s", filename, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &statbuf) < 0) {
+        debug("failed to stat() '%s': %s", filename, strerror(errno));
+        goto err;
+    }
+    if (statbuf.st_size < 12 + hashsize) {
+        debug("'%s' is too short to be a git index", filename);
+        goto err;
+    }
+    data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        debug("failed to mmap() '%s': %s", filename, strerror(errno));
+        goto err;
+    }
+    close(fd);
+    fd = -1;
+
+    index = calloc(1, sizeof(gitindex_t));
+    if (index == NULL)
+        goto err;
+    index->data = data;
+    index->size = statbuf.st_size;
+    index->hashsize = hashsize;
+    index->mtime_sec = statbuf.st_mtime;
+    index->mtime_nsec = ST_MTIME_NSEC(&statbuf);
+    index->entries = index->data + 12;
+    index->end = index->data + index->size - hashsize;
+
+    if (memcmp(index->data, "DIRC", 4) != 0) {
+        debug("'%s': bad signature", filename);
+        goto err;
+    }
+    index->version = get_be32(index->data + 4);
+    if (index->version < 2 || index->version > 4) {
+        debug("'%s': unsupported index version %u", filename, index->version);
+        goto err;
+    }
+    index->nondisk = index->nentries = get_be32(index->data + 8);
+
+    index->extensions = find_eoie(index);
+    if (index->extensions == NULL)
+        index->extensions = skip_entries(index);
+    if (index->extensions == NULL || !check_extensions(index)) {
+        debug("'%s': corrupt or unsupported index", filename);
+        goto err;
+    }
+
+    debug("read index '%s': version %u, %u entries",
+          filename, index->version, index->nentries);
+    if (!open_shared_index(index, filename)) {
+        free_git_index(index);
+        return NULL;
+    }
+    return index;
+
+ err:
+    if (fd >= 0)
+        close(fd);
+    if (index != NULL)
+        free(index);
+    if (data != MAP_FAILED)
+        munmap(data, statbuf.st_size);
+    return NULL;
+}
+
+void
+free_git_index(gitindex_t *index)
+{
+    if (index != NULL) {
+        free_git_index(index->base);
+        free(index->delete_bitmap);
+        free(index->replace_bitmap);
+        munmap((void *) index->data, index->size);
+        free(index);
+    }
+}
+
+const unsigned char *
+find_index_extension(const gitindex_t *index, const char *sig, size_t *size)
+{
+    const unsigned char *pos = index->extensions;
+
+    /* already validated by check_extensions() */
+    while (pos < index->end) {
+        size_t extsize = get_be32(pos + 4);
+        if (memcmp(pos, sig, 4) == 0) {
+            *size = extsize;
+            return pos + 8;
+        }
+        pos += 8 + extsize;
+    }
+    return NULL;
+}
+
+/* Position cursor before the first entry in the file of index. */
+static void
+init_file_cursor(gitindex_cursor_t *cursor, const gitindex_t *index)
+{
+    memset(cursor, 0, sizeof(gitindex_cursor_t));
+    cursor->index = index;
+    cursor->pos = index->entries;
+    cursor->remaining = index->nondisk;
+}
+
+void
+init_index_cursor(gitindex_cursor_t *cursor, const gitindex_t *index)
+{
+    init_file_cursor(cursor, index);
+    if (index->base != NULL) {
+        /* on failure, next_index_entry() reports a corrupt index */
+        cursor->split = calloc(3, sizeof(gitindex_cursor_t));
+        if (cursor->split != NULL) {
+            init_file_cursor(&cursor->split[0], index->base);
+            init_file_cursor(&cursor->split[1], index);
+            init_file_cursor(&cursor->split[2], index);
+        }
+        cursor->took = -1;
+    }
+}
+
+void
+free_index_cursor(gitindex_cursor_t *cursor)
+{
+    free(cursor->pathbuf);
+    cursor->pathbuf = NULL;
+    cursor->pathbufsize = 0;
+    if (cursor->split != NULL) {
+        for (int i = 0; i < 3; i++)
+            free_index_cursor(&cursor->split[i]);
+        free(cursor->split);
+        cursor->split = NULL;
+    }
+}
+
+/* Rebuild a version 4 path: drop strip bytes from the end of the
+ * previous path and append suffix.  The first entry of a cursor (of
+ * an IEOT block, that is) has no previous path: git writes its full
+ * name there, with whatever strip count the previous entry implies.
+ */
+static int
+expand_path(gitindex_cursor_t *cursor,
+            size_t strip, const char *suffix, size_t suffixlen)
+{
+    size_t prevlen = cursor->pathbuf != NULL ? cursor->entry.pathlen : 0;
+    if (cursor->pathbuf == NULL)
+        strip = 0;
+    if (strip > prevlen)
+        return 0;
+    size_t len = prevlen - strip + suffixlen;
+    if (len + 1 > cursor->pathbufsize) {
+        size_t size = cursor->pathbufsize ? cursor->pathbufsize : 256;
+        while (size < len + 1)
+            size *= 2;
+        char *buf = realloc(cursor->pathbuf, size);
+        if (buf == NULL)
+            return 0;
+        cursor->pathbuf = buf;
+        cursor->pathbufsize = size;
+    }
+    memcpy(cursor->pathbuf + prevlen - strip, suffix, suffixlen);
+    cursor->pathbuf[len] = '\0';
+    cursor->entry.path = cursor->pathbuf;
+    cursor->entry.pathlen = len;
+    return 1;
+}
+
+/* Decode the fixed-size part of the on-disk entry at pos.  Return its
+ * size, or 0 if it runs past the entries.
+ */
+static size_t
+decode_entry(const gitindex_t *index,
+             const unsigned char *pos, gitindex_entry_t *entry)
+{
+    size_t fixed = ENTRY_FIXED_LEN(index->hashsize);
+    if (pos + fixed > index->extensions)
+        return 0;
+
+    entry->ondisk = pos;
+    entry->ctime_sec = get_be32(pos);
+    entry->ctime_nsec = get_be32(pos + 4);
+    entry->mtime_sec = get_be32(pos + 8);
+    entry->mtime_nsec = get_be32(pos + 12);
+    entry->dev = get_be32(pos + 16);
+    entry->ino = get_be32(pos + 20);
+    entry->mode = get_be32(pos + 24);
+    entry->uid = get_be32(pos + 28);
+    entry->gid = get_be32(pos + 32);
+    entry->size = get_be32(pos + 36);
+    entry->oid = pos + 40;
+    entry->flags = get_be16(pos + fixed - 2);
+    if (entry->flags & CE_EXTENDED) {
+        if (index->version < 3 || pos + fixed + 2 > index->extensions)
+            return 0;
+        entry->flags |= get_be16(pos + fixed) << 16;
+        fixed += 2;
+    }
+    return fixed;
+}
+
+void
+read_index_entry(const gitindex_t *index, const unsigned char *ondisk,
+                 const char *path, gitindex_entry_t *entry)
+{
+    /* entries of a split index may live in the shared index */
+    if (index->base != NULL &&
+        (ondisk < index->data || ondisk >= index->data + index->size))
+        index = index->base;
+    decode_entry(index, ondisk, entry);
+    entry->path = path;
+    entry->pathlen = strlen(path);
+}
+
+/* Move to the next shared entry that is not deleted, taking its data
+ * from the replacing entry if it is replaced.
+ */
+static int
+next_base_entry(gitindex_cursor_t *cursor)
+{
+    const gitindex_t *index = cursor->index;
+    gitindex_cursor_t *base = &cursor->split[0];
+    gitindex_cursor_t *replaced = &cursor->split[1];
+    int status;
+
+    while ((status = next_index_entry(base)) > 0) {
+        unsigned int pos = cursor->base_pos++;
+        if (pos < index->ndelete && BITMAP_TEST(index->delete_bitmap, pos))
+            continue;
+        cursor->base_entry = base->entry;
+        if (pos < index->nreplace && BITMAP_TEST(index->replace_bitmap, pos)) {
+            /* same path, new everything else */
+            if (next_index_entry(replaced) <= 0)
+                return -1;
+            cursor->base_entry = replaced->entry;
+            cursor->base_entry.path = base->entry.path;
+            cursor->base_entry.pathlen = base->entry.pathlen;
+        }
+        break;
+    }
+    cursor->have_base = status > 0;
+    return status < 0 ? -1 : 1;
+}
+
+/* next_index_entry() for a split index: merge the shared entries with
+ * the ones added by .git/index, which follow the replacing ones.
+ */
+static int
+next_split_entry(gitindex_cursor_t *cursor)
+{
+    gitindex_cursor_t *added = &cursor->split[2];
+    int status;
+
+    if (cursor->took < 0) {
+        for (unsigned int i = 0; i < cursor->index->nreplaced; i++) {
+            if (next_index_entry(added) <= 0)
+                return -1;
+        }
+        if (next_base_entry(cursor) < 0)
+            return -1;
+        cursor->took = 1;       /* so the first added entry is read */
+    }
+    else if (cursor->took == 0 && next_base_entry(cursor) < 0)
+        return -1;
+    if (cursor->took == 1) {
+        if ((status = next_index_entry(added)) < 0)
+            return -1;
+        cursor->have_added = status;
+    }
+
+    if (!cursor->have_base && !cursor->have_added)
+        return 0;
+    int cmp;
+    if (!cursor->have_added)
+        cmp = -1;
+    else if (!cursor->have_base)
+        cmp = 1;
+    else {
+        cmp = strcmp(cursor->base_entry.path, added->entry.path);
+        if (cmp == 0)
+            cmp = (CE_STAGE(cursor->base_entry.flags) -
+                   CE_STAGE(added->entry.flags));
+    }
+    if (cmp < 0) {
+        cursor->entry = cursor->base_entry;
+        cursor->took = 0;
+    }
+    else {
+        cursor->entry = added->entry;
+        cursor->took = 1;
+    }
+    return 1;
+}
+
+int
+next_index_entry(gitindex_cursor_t *cursor)
+{
+    const gitindex_t *index = cursor->index;
+    const unsigned char *pos = cursor->pos;
+    gitindex_entry_t *entry = &cursor->entry;
+
+    if (cursor->split != NULL)
+        return next_split_entry(cursor);
+    if (cursor->took < 0)
+        return -1;              /* init_index_cursor() failed */
+    if (cursor->remaining == 0)
+        return 0;
+
+    size_t fixed = decode_entry(index, pos, entry);
+    if (fixed == 0)
+        return -1;
+
+    if (index->version < 4) {
+        size_t size = padded_entry_size(index, pos, index->extensions);
+        if (size == 0)
+            return -1;
+        entry->path = (const char *) pos + fixed;
+        entry->pathlen = strlen(entry->path);
+        cursor->pos = pos + size;
+    }
+    else {
+        size_t strip;
+        const unsigned char *suffix = pos + fixed;
+        int n = decode_varint(suffix, index->extensions, &strip);
+        if (n == 0)
+            return -1;
+        suffix += n;
+        const unsigned char *nul =
+            memchr(suffix, '\0', index->extensions - suffix);
+        if (nul == NULL ||
+            !expand_path(cursor, strip, (const char *) suffix, nul - suffix))
+            return -1;
+        cursor->pos = nul + 1;
+    }
+    cursor->remaining--;
+    return 1;
+}
+
+/* A run of entries that can be decoded on its own: an IEOT ("index
+ * entry offset table") block, or the whole index.
+ */
+typedef struct {
+    const unsigned char *pos;           /* first entry */
+    unsigned int nentries;
+    unsigned int first;                 /* position of the first entry */
+} index_block_t;
+
+/* Read the IEOT extension into *blocks (caller frees).  Return the
+ * number of blocks, or 0 if there is no usable IEOT.  Version 4
+ * indexes restart path compression at each block, so every block can
+ * be decoded by a fresh cursor.
+ */
+static unsigned int
+read_ieot(const gitindex_t *index, index_block_t **blocks)
+{
+    const unsigned char *ext, *prev;
+    size_t size;
+    unsigned int nblocks, i, first;
+
+    ext = find_index_extension(index, "IEOT", &size);
+    if (ext == NULL || size < 4 || get_be32(ext) != 1 || (size - 4) % 8 != 0)
+        return 0;
+    nblocks = (size - 4) / 8;
+    if (nblocks == 0)
+        return 0;
+    *blocks = malloc(nblocks * sizeof(index_block_t));
+    if (*blocks == NULL)
+        return 0;
+
+    prev = index->entries;
+    first = 0;
+    for (i = 0; i < nblocks; i++) {
+        index_block_t *block = &(*blocks)[i];
+        uint32_t offset = get_be32(ext + 4 + i * 8);
+        block->pos = index->data + offset;
+        block->nentries = get_be32(ext + 8 + i * 8);
+        block->first = first;
+        if (offset > index->size || block->pos < prev ||
+            block->pos >= index->extensions ||
+            block->nentries > index->nondisk - first)
+            goto err;
+        prev = block->pos;
+        first += block->nentries;
+    }
+    if (first != index->nondisk)
+        goto err;
+    return nblocks;
+
+ err:
+    debug("index has a corrupt IEOT extension: ignoring it");
+    free(*blocks);
+    *blocks = NULL;
+    return 0;
+}
+
+typedef struct {
+    const gitindex_t *index;
+    index_visitor_t visit;
+    void *data;
+    index_block_t *blocks;
+    unsigned int nblocks;
+    unsigned int next;                  /* next block to scan */
+    int result;
+#if HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+} index_scan_t;
+
+static void
+scan_lock(index_scan_t *scan)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_lock(&scan->lock);
+#endif
+}
+
+static void
+scan_unlock(index_scan_t *scan)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_unlock(&scan->lock);
+#endif
+}
+
+/* Merge a block's verdict into the overall one: 1 beats -1 beats 0. */
+static void
+merge_result(index_scan_t *scan, int result)
+{
+    scan_lock(scan);
+    if (result > 0 || (result < 0 && scan->result == 0))
+        scan->result = result;
+    scan_unlock(scan);
+}
+
+/* Scan one block; give up early if another block has settled it. */
+static int
+scan_block(index_scan_t *scan, const index_block_t *block)
+{
+    gitindex_cursor_t cursor;
+    unsigned int pos = block->first;
+    int status, result = 0;
+
+    init_index_cursor(&cursor, scan->index);
+    cursor.pos = block->pos;
+    cursor.remaining = block->nentries;
+    while ((status = next_index_entry(&cursor)) > 0) {
+        int verdict = scan->visit(&cursor.entry, pos++, scan->data);
+        if (verdict > 0) {
+            result = 1;
+            break;
+        }
+        if (verdict < 0)
+            result = -1;
+        if (pos % 1024 == 0) {
+            scan_lock(scan);
+            int done = scan->result > 0;
+            scan_unlock(scan);
+            if (done)
+                break;
+        }
+    }
+    if (status < 0) {
+        debug("corrupt index entry after '%s'",
+              cursor.entry.path ? cursor.entry.path : "");
+        result = -1;
+    }
+    free_index_cursor(&cursor);
+    return result;
+}
+
+static void *
+scan_worker(void *arg)
+{
+    index_scan_t *scan = arg;
+
+    while (1) {
+        scan_lock(scan);
+        const index_block_t *block = NULL;
+        if (scan->result <= 0 && scan->next < scan->nblocks)
+            block = &scan->blocks[scan->next++];
+        scan_unlock(scan);
+        if (block == NULL)
+            break;
+        merge_result(scan, scan_block(scan, block));
+    }
+    return NULL;
+}
+
+int
+scan_index(const gitindex_t *index, int nthreads,
+           index_visitor_t visit, void *data)
+{
+    index_block_t whole;
+    index_scan_t scan;
+
+    memset(&scan, 0, sizeof(scan));
+    scan.index = index;
+    scan.visit = visit;
+    scan.data = data;
+    /* IEOT of a split index only covers the entries in its own file */
+    if (nthreads > 1 && index->base == NULL)
+        scan.nblocks = read_ieot(index, &scan.blocks);
+    if (scan.nblocks < 2) {
+        free(scan.blocks);
+        whole.pos = index->entries;
+        whole.nentries = index->nondisk;
+        whole.first = 0;
+        scan.blocks = &whole;
+        scan.nblocks = 1;
+        nthreads = 1;
+    }
+
+#if HAVE_PTHREAD
+    pthread_mutex_init(&scan.lock, NULL);
+    if (nthreads > 1) {
+        pthread_t threads[MAX_INDEX_THREADS];
+        int nstarted = 0;
+
+        if (nthreads > MAX_INDEX_THREADS)
+            nthreads = MAX_INDEX_THREADS;
+        if ((unsigned int) nthreads > scan.nblocks)
+            nthreads = scan.nblocks;
+        debug("scanning %u index blocks with %d threads",
+              scan.nblocks, nthreads);
+        for (int i = 0; i < nthreads; i++) {
+            if (pthread_create(&threads[i], NULL, scan_worker, &scan) != 0)
+                break;
+            nstarted++;
+        }
+        if (nstarted == 0)
+            scan_worker(&scan); /* no threads after all: do it here */
+        for (int i = 0; i < nstarted; i++)
+            pthread_join(threads[i], NULL);
+    }
+    else
+        scan_worker(&scan);
+    pthread_mutex_destroy(&scan.lock);
+#else
+    scan_worker(&scan);
+#endif
+
+    if (scan.blocks != &whole)
+        free(scan.blocks);
+    return scan.result;
+}
+
+int
+index_entry_changed(const gitindex_t *index,
+                    const gitindex_entry_t *entry,
+                    const struct stat *statbuf,
+                    int trust_exec_bit, int trust_ctime, int check_stat)
+{
+    switch (entry->mode & GIT_MODE_TYPE) {
+    case GIT_MODE_FILE:
+        if (!S_ISREG(statbuf->st_mode))
+            return 1;
+        if (trust_exec_bit && ((entry->mode ^ statbuf->st_mode) & S_IXUSR))
+            return 1;
+        break;
+    case GIT_MODE_SYMLINK:
+        if (!S_ISLNK(statbuf->st_mode))
+            return 1;
+        break;
+    case GIT_MODE_GITLINK:
+        /* submodule: git only cares that it is still a directory */
+        return !S_ISDIR(statbuf->st_mode);
+    default:
+        return 1;
+    }
+
+    /* the fields git's match_stat_data() compares */
+    trust_ctime = trust_ctime && check_stat;
+    if (entry->mtime_sec != (uint32_t) statbuf->st_mtime ||
+        (check_stat &&
+         entry->mtime_nsec != (uint32_t) ST_MTIME_NSEC(statbuf)) ||
+        (trust_ctime &&
+         (entry->ctime_sec != (uint32_t) statbuf->st_ctime ||
+          entry->ctime_nsec != (uint32_t) ST_CTIME_NSEC(statbuf))) ||
+        (check_stat &&
+         (entry->ino != (uint32_t) statbuf->st_ino ||
+          entry->uid != (uint32_t) statbuf->st_uid ||
+          entry->gid != (uint32_t) statbuf->st_gid)) ||
+        entry->size != (uint32_t) statbuf->st_size) {
+        /* A size of 0 means git never checked the file after writing
+         * the entry (read-tree), or "smudged" it as racy when it wrote
+         * the index: as in git's ie_modified(), only the content can
+         * tell. */
+        return entry->size == 0 ? -1 : 1;
+    }
+
+    /* Stat data matches, but if the file was modified in the same tick
+     * as the index was written, git could not tell the difference
+     * either: it is racily clean. */
+    if (index->mtime_sec < entry->mtime_sec ||
+        (index->mtime_sec == entry->mtime_sec &&
+         index->mtime_nsec <= entry->mtime_nsec))
+        return -1;
+    return 0;
+}
+
+int
+stat_data_changed(const unsigned char *ondisk, const struct stat *statbuf)
+{
+    /* dev (at offset 16) is not compared, as in git */
+    return (get_be32(ondisk) != (uint32_t) statbuf->st_ctime ||
+            get_be32(ondisk + 4) != (uint32_t) ST_CTIME_NSEC(statbuf) ||
+            get_be32(ondisk + 8) != (uint32_t) statbuf->st_mtime ||
+            get_be32(ondisk + 12) != (uint32_t) ST_MTIME_NSEC(statbuf) ||
+            get_be32(ondisk + 20) != (uint32_t) statbuf->st_ino ||
+            get_be32(ondisk + 24) != (uint32_t) statbuf->st_uid ||
+            get_be32(ondisk + 28) != (uint32_t) statbuf->st_gid ||
+            get_be32(ondisk + 32) != (uint32_t) statbuf->st_size);
+}
+
+size_t
+read_ewah(const unsigned char *data, const unsigned char *end,
+          unsigned char **bitmap, size_t *nbits)
+{
+    const unsigned char *words;
+    size_t nwords, i, bit = 0;
+    unsigned char *bits;
+
+    if (end - data < 8)
+        return 0;
+    *nbits = get_be32(data);
+    nwords = get_be32(data + 4);
+    words = data + 8;
+    if ((size_t) (end - words) < nwords * 8 + 4)
+        return 0;
+
+    bits = calloc(*nbits / 8 + 1, 1);
+    if (bits == NULL)
+        return 0;
+
+    /* Each run-length word (RLW) says: "running length" words of all
+     * 0 or all 1 bits, followed by "literal count" words to take
+     * as-is. */
+    i = 0;
+    while (i < nwords) {
+        uint64_t rlw = get_be64(words + i++ * 8);
+        size_t run_end = bit + ((rlw >> 1) & 0xffffffff) * 64;
+        size_t nliterals = rlw >> 33;
+
+        if (rlw & 1) {
+            for (; bit < run_end && bit < *nbits; bit++)
+                bits[bit / 8] |= 1 << (bit % 8);
+        }
+        bit = run_end;
+        for (; nliterals > 0 && i < nwords; nliterals--) {
+            uint64_t word = get_be64(words + i++ * 8);
+            for (int k = 0; k < 64; k++, bit++) {
+                if (((word >> k) & 1) && bit < *nbits)
+                    bits[bit / 8] |= 1 << (bit % 8);
+            }
+        }
+    }
+
+    *bitmap = bits;
+    /* skip the words and the trailing position of the last RLW */
+    return 8 + nwords * 8 + 4;
+}
+
+static int
+compare_paths(const void *a, const void *b)
+{
+    return strcmp(((const gitindex_path_t *) a)->path,
+                  ((const gitindex_path_t *) b)->path);
+}
+
+int
+load_index_paths(const gitindex_t *index, gitindex_paths_t *paths)
+{
+    gitindex_cursor_t cursor;
+    size_t total = 0;
+    unsigned int i;
+    int status;
+
+    memset(paths, 0, sizeof(gitindex_paths_t));
+    paths->paths = malloc((index->nentries + 1) * sizeof(gitindex_path_t));
+    if (paths->paths == NULL)
+        return 0;
+
+    /* Version 4 paths only exist in the cursor's buffer, so they must
+     * be copied: first find out how much room they need. */
+    if (index->version >= 4 ||
+        (index->base != NULL && index->base->version >= 4)) {
+        init_index_cursor(&cursor, index);
+        while ((status = next_index_entry(&cursor)) > 0)
+            total += cursor.entry.pathlen + 1;
+        free_index_cursor(&cursor);
+        if (status < 0 || (paths->buf = malloc(total)) == NULL)
+            goto err;
+    }
+
+    char *copy = paths->buf;
+    init_index_cursor(&cursor, index);
+    for (i = 0; (status = next_index_entry(&cursor)) > 0; i++) {
+        paths->paths[i].ondisk = cursor.entry.ondisk;
+        if (copy == NULL) {
+            /* NUL-terminated in the mmap()ed file */
+            paths->paths[i].path = cursor.entry.path;
+        }
+        else {
+            memcpy(copy, cursor.entry.path, cursor.entry.pathlen + 1);
+            paths->paths[i].path = copy;
+            copy += cursor.entry.pathlen + 1;
+        }
+    }
+    free_index_cursor(&cursor);
+    if (status < 0)
+        goto err;
+    paths->npaths = i;
+
+    /* entries are sorted by path already, except that unmerged
+     * entries repeat a path: sorting keeps this robust either way */
+    qsort(paths->paths, paths->npaths, sizeof(gitindex_path_t), compare_paths);
+    return 1;
+
+ err:
+    free_index_paths(paths);
+    return 0;
+}
+
+void
+free_index_paths(gitindex_paths_t *paths)
+{
+    free(paths->paths);
+    free(paths->buf);
+    memset(paths, 0, sizeof(gitindex_paths_t));
+}
+
+unsigned int
+index_path_pos(const gitindex_paths_t *paths, const char *path)
+{
+    unsigned int lo = 0, hi = paths->npaths;
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (strcmp(paths->paths[mid].path, path) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+const gitindex_path_t *
+find_index_path(const gitindex_paths_t *paths, const char *path)
+{
+    unsigned int pos = index_path_pos(paths, path);
+    if (pos < paths->npaths && strcmp(paths->paths[pos].path, path) == 0)
+        return &paths->paths[pos];
+    return NULL;
+}
+
+int
+index_has_dir(const gitindex_paths_t *paths, const char *dir)
+{
+    size_t len = strlen(dir);
+    unsigned int pos = index_path_pos(paths, dir);
+    return (pos < paths->npaths &&
+            strncmp(paths->paths[pos].path, dir, len) == 0);
+}
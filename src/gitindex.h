@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITINDEX_H
+#define GITINDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Bits of the 16-bit flags word of an on-disk index entry, plus the
+ * extended flags (index version >= 3) shifted up by 16 bits.
+ */
+#define CE_NAMEMASK       0x0fff
+#define CE_STAGEMASK      0x3000
+#define CE_EXTENDED       0x4000
+#define CE_VALID          0x8000
+#define CE_INTENT_TO_ADD  (0x2000 << 16)
+#define CE_SKIP_WORKTREE  (0x4000 << 16)
+
+#define CE_STAGE(flags)   (((flags) & CE_STAGEMASK) >> 12)
+
+/* Modes that git records in the index. */
+#define GIT_MODE_TYPE     0170000
+#define GIT_MODE_FILE     0100000
+#define GIT_MODE_SYMLINK  0120000
+#define GIT_MODE_GITLINK  0160000
+#define GIT_MODE_DIR      0040000
+
+/* A read-only view of .git/index.  The file is mmap()ed and entries
+ * are decoded one at a time by a cursor, so even a huge index costs
+ * nothing but page faults to scan.
+ *
+ * With core.splitIndex, .git/index only holds the entries that changed
+ * since .git/sharedindex.<hash> was written, plus a "link" extension
+ * naming that file and saying which of its entries are replaced or
+ * deleted.  The shared index is then opened as base, and cursors see
+ * the two merged, just as git does.
+ */
+typedef struct gitindex {
+    const unsigned char *data;          /* whole file, mmap()ed */
+    size_t size;
+    unsigned int version;               /* 2, 3 or 4 */
+    unsigned int nentries;              /* entries, after merging base */
+    unsigned int nondisk;               /* entries in this file */
+    int hashsize;                       /* 20 (SHA-1) or 32 (SHA-256) */
+    const unsigned char *entries;       /* first entry */
+    const unsigned char *extensions;    /* first extension */
+    const unsigned char *end;           /* start of trailing checksum */
+    uint32_t mtime_sec, mtime_nsec;     /* of the index file itself */
+
+    /* split index only */
+    struct gitindex *base;              /* the shared index */
+    unsigned char *delete_bitmap;       /* base entries to drop */
+    size_t ndelete;
+    unsigned char *replace_bitmap;      /* base entries to replace */
+    size_t nreplace;
+    unsigned int nreplaced;             /* leading entries that replace */
+} gitindex_t;
+
+/* One decoded index entry; see Documentation/gitformat-index.txt in
+ * the git sources for the meaning of the fields.
+ */
+typedef struct {
+    uint32_t ctime_sec, ctime_nsec;
+    uint32_t mtime_sec, mtime_nsec;
+    uint32_t dev, ino, mode, uid, gid, size;
+    const unsigned char *oid;           /* points into the index */
+    unsigned int flags;                 /* CE_* bits */
+    const char *path;                   /* NUL-terminated */
+    size_t pathlen;
+    const unsigned char *ondisk;        /* start of the on-disk entry */
+} gitindex_entry_t;
+
+typedef struct gitindex_cursor {
+    const gitindex_t *index;
+    const unsigned char *pos;           /* next on-disk entry */
+    unsigned int remaining;             /* entries left after pos */
+    char *pathbuf;                      /* previous path (version 4) */
+    size_t pathbufsize;
+    gitindex_entry_t entry;             /* current entry */
+
+    /* split index only: cursors over the shared index, the replacing
+     * entries and the added entries, merged by path */
+    struct gitindex_cursor *split;
+    gitindex_entry_t base_entry;        /* next shared entry, if any */
+    int have_base, have_added;
+    unsigned int base_pos;
+    int took;                           /* stream that entry came from */
+} gitindex_cursor_t;
+
+/* mmap() the index file filename and validate its header.  hashsize
+ * is the size of object IDs in this repository.  Return NULL (after
+ * a debug() message) if the file is missing, truncated or in a format
+ * we do not understand.  Caller must free the result with
+ * free_git_index().
+ */
+gitindex_t *
+open_git_index(const char *filename, int hashsize);
+
+void
+free_git_index(gitindex_t *index);
+
+/* Find the extension with signature sig (e.g. "TREE").  Return a
+ * pointer to its payload and store the payload size in *size, or
+ * return NULL if the index has no such extension.
+ */
+const unsigned char *
+find_index_extension(const gitindex_t *index, const char *sig, size_t *size);
+
+/* Position cursor before the first entry of index. */
+void
+init_index_cursor(gitindex_cursor_t *cursor, const gitindex_t *index);
+
+/* Decode the next entry into cursor->entry.  Return 1 on success, 0
+ * at the end of the entries, -1 if the index is corrupt.
+ */
+int
+next_index_entry(gitindex_cursor_t *cursor);
+
+void
+free_index_cursor(gitindex_cursor_t *cursor);
+
+/* Called by scan_index() for each entry, with the entry's position in
+ * the index.  Return 0 if the entry is fine, -1 if it cannot be judged
+ * (keep going: another entry may settle it), 1 to stop the scan.
+ */
+typedef int (*index_visitor_t)(const gitindex_entry_t *entry,
+                               unsigned int pos, void *data);
+
+#define MAX_INDEX_THREADS 16
+
+/* Call visit for the entries of index.  If nthreads > 1 and git wrote
+ * an IEOT extension, the blocks it lists are scanned by up to nthreads
+ * threads at once (so visit must be thread-safe, and entries are not
+ * seen in order); otherwise the entries are scanned in order.  Return
+ * 1 if visit stopped the scan, else -1 if any entry could not be
+ * judged or the index is corrupt, else 0.
+ */
+int
+scan_index(const gitindex_t *index, int nthreads,
+           index_visitor_t visit, void *data);
+
+/* Compare the cached stat data of entry with statbuf, the way git's
+ * ie_match_stat() does: ctime only if trust_ctime (core.trustctime),
+ * and the nanoseconds, inode, uid and gid only if check_stat (unless
+ * core.checkStat is "minimal").  Return 1 if they differ, 0 if they
+ * match and
+ * the entry can be trusted, -1 if only the file content can tell:
+ * they match but the entry is "racy" (modified in the same timestamp
+ * tick that the index was written), or they differ but the entry's
+ * size was zeroed ("smudged") by git to mark it racy.
+ */
+int
+index_entry_changed(const gitindex_t *index,
+                    const gitindex_entry_t *entry,
+                    const struct stat *statbuf,
+                    int trust_exec_bit, int trust_ctime, int check_stat);
+
+/* Size of git's on-disk "struct stat_data", as used by the untracked
+ * cache: ctime, mtime, dev, ino, uid, gid, size.
+ */
+#define STAT_DATA_LEN 36
+
+/* Return true if the on-disk stat data at ondisk no longer matches
+ * statbuf.
+ */
+int
+stat_data_changed(const unsigned char *ondisk, const struct stat *statbuf);
+
+/* Decode an EWAH-compressed bitmap (as serialized by git's ewah_io.c)
+ * starting at data into a plain bitmap of *nbits bits, one per bit of
+ * **bitmap (caller frees).  Return the number of bytes consumed, or 0
+ * if the bitmap is corrupt or runs past end.
+ */
+size_t
+read_ewah(const unsigned char *data, const unsigned char *end,
+          unsigned char **bitmap, size_t *nbits);
+
+#define BITMAP_TEST(bitmap, i) ((bitmap)[(i) / 8] & (1 << ((i) % 8)))
+
+/* Decode git's offset-varint at p.  Return the number of bytes
+ * consumed, or 0 if the number runs past end.
+ */
+int
+decode_varint(const unsigned char *p, const unsigned char *end,
+              size_t *value);
+
+/* Sorted array of the paths of all entries in an index, for lookups
+ * by path.
+ */
+typedef struct {
+    const char *path;
+    const unsigned char *ondisk;        /* for read_index_entry() */
+} gitindex_path_t;
+
+typedef struct {
+    gitindex_path_t *paths;
+    unsigned int npaths;
+    char *buf;                          /* copies of version 4 paths */
+} gitindex_paths_t;
+
+/* Fill paths from index.  Return 1 on success, 0 on error.  Caller
+ * must free the result with free_index_paths().
+ */
+int
+load_index_paths(const gitindex_t *index, gitindex_paths_t *paths);
+
+void
+free_index_paths(gitindex_paths_t *paths);
+
+/* Return the position of the first path >= path. */
+unsigned int
+index_path_pos(const gitindex_paths_t *paths, const char *path);
+
+/* Return the entry for path, or NULL if path is not in the index. */
+const gitindex_path_t *
+find_index_path(const gitindex_paths_t *paths, const char *path);
+
+/* Decode the stat data, object ID and flags of the on-disk entry at
+ * ondisk into entry, and set entry->path to path.
+ */
+void
+read_index_entry(const gitindex_t *index, const unsigned char *ondisk,
+                 const char *path, gitindex_entry_t *entry);
+
+/* Return true if any path in the index starts with dir (which must
+ * end with "/").
+ */
+int
+index_has_dir(const gitindex_paths_t *paths, const char *dir);
+
+#endif
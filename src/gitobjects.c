@@ -0,0 +1,575 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "../config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "common.h"
+#include "gitobjects.h"
+
+int
+parse_commit_time(const char *buf, long *when)
+{
+    const char *line = strstr(buf, "\ncommitter ");
+    if (line == NULL)
+        return 0;
+    const char *eol = strchr(line + 1, '\n');
+    if (eol == NULL)
+        return 0;
+
+    /* "committer Name <email> 1234567890 +0100" */
+    const char *gt = NULL;
+    for (const char *p = line + 1; p < eol; p++) {
+        if (*p == '>')
+            gt = p;
+    }
+    if (gt == NULL)
+        return 0;
+    char *end;
+    *when = strtol(gt + 1, &end, 10);
+    return end > gt + 1;
+}
+
+#if HAVE_ZLIB
+
+/* pack object types */
+#define OBJ_COMMIT     1
+#define OBJ_TREE       2
+#define OBJ_BLOB       3
+#define OBJ_TAG        4
+#define OBJ_OFS_DELTA  6
+#define OBJ_REF_DELTA  7
+
+/* git itself stops at a depth of 4095, but never writes deeper chains
+ * than --depth (default 50) */
+#define MAX_DELTA_DEPTH 1000
+
+static const char *type_names[] = {
+    NULL, "commit", "tree", "blob", "tag", NULL, NULL, NULL,
+};
+
+typedef struct {
+    char *name;                         /* path of the .pack file */
+    const unsigned char *idx;           /* the .idx file, mmap()ed */
+    size_t idxsize;
+    const unsigned char *pack;          /* mmap()ed on first use */
+    size_t packsize;
+    uint32_t nobjects;
+} gitpack_t;
+
+struct gitobjects {
+    char *objdir;
+    int hashsize;
+    gitpack_t *packs;
+    int npacks;
+};
+
+static const unsigned char *
+map_file(const char *filename, size_t *size)
+{
+    struct stat statbuf;
+    void *data;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &statbuf) < 0 || statbuf.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        debug("failed to mmap() '%s': %s", filename, strerror(errno));
+        return NULL;
+    }
+    *size = statbuf.st_size;
+    return data;
+}
+
+/* Check a version 2 pack index: header, fan-out table, object IDs,
+ * CRCs, offsets (and large offsets), two checksums.
+ */
+static int
+check_pack_index(gitpack_t *pack, int hashsize)
+{
+    size_t n;
+
+    if (pack->idxsize < (size_t) (8 + 256 * 4 + 2 * hashsize) ||
+        memcmp(pack->idx, "\377tOc", 4) != 0 || get_be32(pack->idx + 4) != 2)
+        return 0;
+    pack->nobjects = get_be32(pack->idx + 8 + 255 * 4);
+    n = pack->nobjects;
+    return (pack->idxsize >=
+            8 + 256 * 4 + n * (hashsize + 4 + 4) + 2 * hashsize);
+}
+
+gitobjects_t *
+open_git_objects(const char *objdir, int hashsize)
+{
+    gitobjects_t *objects;
+    char dirname[1024], filename[1280];
+    struct dirent *ent;
+    DIR *dir;
+    int size = 0;
+
+    objects = calloc(1, sizeof(gitobjects_t));
+    if (objects == NULL)
+        return NULL;
+    objects->objdir = strdup(objdir);
+    objects->hashsize = hashsize;
+
+    snprintf(dirname, sizeof(dirname), "%s/pack", objdir);
+    dir = opendir(dirname);
+    if (dir == NULL)
+        return objects;         /* only loose objects, then */
+    while ((ent = readdir(dir)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        if (len < 5 || strcmp(ent->d_name + len - 4, ".idx") != 0)
+            continue;
+        if (objects->npacks == size) {
+            size = size ? size * 2 : 8;
+            gitpack_t *packs = realloc(objects->packs,
+                                       size * sizeof(gitpack_t));
+            if (packs == NULL)
+                break;
+            objects->packs = packs;
+        }
+        gitpack_t *pack = &objects->packs[objects->npacks];
+        memset(pack, 0, sizeof(gitpack_t));
+        snprintf(filename, sizeof(filename), "%s/%s", dirname, ent->d_name);
+        pack->idx = map_file(filename, &pack->idxsize);
+        if (pack->idx == NULL)
+            continue;
+        if (!check_pack_index(pack, hashsize)) {
+            debug("'%s': not a pack index we understand", filename);
+            munmap((void *) pack->idx, pack->idxsize);
+            continue;
+        }
+        strcpy(filename + strlen(filename) - 4, ".pack");
+        pack->name = strdup(filename);
+        objects->npacks++;
+    }
+    closedir(dir);
+    debug("found %d packs in '%s'", objects->npacks, dirname);
+    return objects;
+}
+
+void
+free_git_objects(gitobjects_t *objects)
+{
+    if (objects == NULL)
+        return;
+    for (int i = 0; i < objects->npacks; i++) {
+        gitpack_t *pack = &objects->packs[i];
+        munmap((void *) pack->idx, pack->idxsize);
+        if (pack->pack != NULL)
+            munmap((void *) pack->pack, pack->packsize);
+        free(pack->name);
+    }
+    free(objects->packs);
+    free(objects->objdir);
+    free(objects);
+}
+
+/* Binary search the index of pack for oid; store the object's offset
+ * in the pack in *offset.
+ */
+static int
+find_in_pack(const gitpack_t *pack, const unsigned char *oid, int hashsize,
+             uint64_t *offset)
+{
+    const unsigned char *fanout = pack->idx + 8;
+    const unsigned char *oids = fanout + 256 * 4;
+    size_t n = pack->nobjects;
+    uint32_t lo = oid[0] ? get_be32(fanout + (oid[0] - 1) * 4) : 0;
+    uint32_t hi = get_be32(fanout + oid[0] * 4);
+
+    if (hi > n)
+        return 0;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(oids + (size_t) mid * hashsize, oid, hashsize);
+        if (cmp < 0)
+            lo = mid + 1;
+        else if (cmp > 0)
+            hi = mid;
+        else {
+            const unsigned char *offsets = oids + n * (hashsize + 4);
+            uint32_t off = get_be32(offsets + (size_t) mid * 4);
+            if (off & 0x80000000) {
+                /* index into the table of 64-bit offsets */
+                const unsigned char *large =
+                    offsets + n * 4 + (size_t) (off & 0x7fffffff) * 8;
+                if (large + 8 > pack->idx + pack->idxsize - 2 * hashsize)
+                    return 0;
+                *offset = get_be64(large);
+            }
+            else
+                *offset = off;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Inflate exactly outlen bytes of the zlib stream at in to a new
+ * NUL-terminated buffer.
+ */
+static char *
+inflate_bytes(const unsigned char *in, size_t inlen, size_t outlen)
+{
+    z_stream stream;
+    char *out;
+    int status;
+
+    out = malloc(outlen + 1);
+    if (out == NULL)
+        return NULL;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) {
+        free(out);
+        return NULL;
+    }
+    stream.next_in = (unsigned char *) in;
+    stream.avail_in = inlen > UINT32_MAX ? UINT32_MAX : inlen;
+    stream.next_out = (unsigned char *) out;
+    stream.avail_out = outlen;
+    do {
+        status = inflate(&stream, Z_SYNC_FLUSH);
+    } while (status == Z_OK && stream.avail_out > 0);
+    inflateEnd(&stream);
+    if (stream.avail_out > 0) {
+        free(out);
+        return NULL;
+    }
+    out[outlen] = '\0';
+    return out;
+}
+
+static size_t
+delta_size(const unsigned char **p, const unsigned char *end)
+{
+    size_t size = 0;
+    int shift = 0;
+    unsigned char c;
+
+    do {
+        if (*p >= end || shift > 56)
+            return (size_t) -1;
+        c = *(*p)++;
+        size |= (size_t) (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return size;
+}
+
+/* Apply the delta (as git's patch-delta.c does) to base. */
+static char *
+apply_delta(const char *base, size_t baselen,
+            const unsigned char *delta, size_t deltalen, size_t *outlen)
+{
+    const unsigned char *p = delta, *end = delta + deltalen;
+    char *out, *o;
+
+    if (delta_size(&p, end) != baselen)
+        return NULL;
+    *outlen = delta_size(&p, end);
+    if (*outlen == (size_t) -1 || (out = malloc(*outlen + 1)) == NULL)
+        return NULL;
+    o = out;
+    while (p < end) {
+        unsigned char c = *p++;
+        if (c & 0x80) {
+            /* copy from base: which offset and size bytes follow is
+             * given by the low bits of c */
+            size_t off = 0, size = 0;
+            for (int i = 0; i < 4; i++) {
+                if ((c & (1 << i)) && p < end)
+                    off |= (size_t) *p++ << (8 * i);
+            }
+            for (int i = 0; i < 3; i++) {
+                if ((c & (0x10 << i)) && p < end)
+                    size |= (size_t) *p++ << (8 * i);
+            }
+            if (size == 0)
+                size = 0x10000;
+            if (off + size > baselen || size > (size_t) (out + *outlen - o))
+                goto err;
+            memcpy(o, base + off, size);
+            o += size;
+        }
+        else if (c > 0) {
+            /* insert c literal bytes */
+            if (c > end - p || c > out + *outlen - o)
+                goto err;
+            memcpy(o, p, c);
+            o += c;
+            p += c;
+        }
+        else
+            goto err;
+    }
+    if (o != out + *outlen)
+        goto err;
+    out[*outlen] = '\0';
+    return out;
+
+ err:
+    free(out);
+    return NULL;
+}
+
+static long
+read_object(gitobjects_t *objects, const unsigned char *oid, int depth,
+            int *type, char **buf, size_t limit);
+
+/* Unpack the object at offset in pack. */
+static long
+unpack_object(gitobjects_t *objects, gitpack_t *pack, uint64_t offset,
+              int depth, int *type, char **buf, size_t limit)
+{
+    const unsigned char *p, *end;
+    size_t size, baselen, outlen = 0;
+    char *base = NULL;
+    unsigned char c;
+    int shift = 4;
+
+    if (pack->pack == NULL) {
+        pack->pack = map_file(pack->name, &pack->packsize);
+        if (pack->pack == NULL) {
+            debug("cannot read pack '%s'", pack->name);
+            return -1;
+        }
+        /* a header and a trailing checksum, at the very least */
+        if (pack->packsize < 12 + (size_t) objects->hashsize) {
+            debug("pack '%s' is truncated", pack->name);
+            munmap((void *) pack->pack, pack->packsize);
+            pack->pack = NULL;
+            return -1;
+        }
+    }
+    if (depth > MAX_DELTA_DEPTH ||
+        offset >= pack->packsize - objects->hashsize)
+        return -1;
+    p = pack->pack + offset;
+    end = pack->pack + pack->packsize - objects->hashsize;
+
+    /* header: type and size, in a varint */
+    c = *p++;
+    *type = (c >> 4) & 7;
+    size = c & 0x0f;
+    while (c & 0x80) {
+        if (p >= end || shift > 56)
+            return -1;
+        c = *p++;
+        size |= (size_t) (c & 0x7f) << shift;
+        shift += 7;
+    }
+
+    switch (*type) {
+    case OBJ_COMMIT:
+    case OBJ_TREE:
+    case OBJ_BLOB:
+    case OBJ_TAG:
+        if (limit > 0 && limit < size)
+            size = limit;
+        *buf = inflate_bytes(p, end - p, size);
+        return *buf != NULL ? (long) size : -1;
+
+    case OBJ_OFS_DELTA: {
+        /* base is earlier in this pack */
+        uint64_t back;
+        if (p >= end)
+            return -1;
+        c = *p++;
+        back = c & 0x7f;
+        while (c & 0x80) {
+            if (p >= end || back > (UINT64_MAX >> 8))
+                return -1;
+            c = *p++;
+            back = ((back + 1) << 7) | (c & 0x7f);
+        }
+        if (back > offset)
+            return -1;
+        long len = unpack_object(objects, pack, offset - back, depth + 1,
+                                 type, &base, 0);
+        if (len < 0)
+            return -1;
+        baselen = len;
+        break;
+    }
+
+    case OBJ_REF_DELTA: {
+        /* base is anywhere, by object ID */
+        if (end - p < objects->hashsize)
+            return -1;
+        long len = read_object(objects, p, depth + 1, type, &base, 0);
+        if (len < 0)
+            return -1;
+        baselen = len;
+        p += objects->hashsize;
+        break;
+    }
+
+    default:
+        return -1;
+    }
+
+    unsigned char *delta = (unsigned char *) inflate_bytes(p, end - p, size);
+    if (delta == NULL) {
+        free(base);
+        return -1;
+    }
+    *buf = apply_delta(base, baselen, delta, size, &outlen);
+    free(delta);
+    free(base);
+    return *buf != NULL ? (long) outlen : -1;
+}
+
+/* Read a loose object: "<type> <size>\0<data>", all deflated. */
+static long
+read_loose_object(gitobjects_t *objects, const unsigned char *oid,
+                  int *type, char **buf, size_t limit)
+{
+    char filename[1024], hex[2 * 32 + 1], header[64];
+    const unsigned char *data;
+    size_t datasize, size;
+    z_stream stream;
+    char *nul, *out = NULL;
+    int status;
+
+    dump_hex(hex, (const char *) oid, objects->hashsize);
+    snprintf(filename, sizeof(filename), "%s/%.2s/%s",
+             objects->objdir, hex, hex + 2);
+    data = map_file(filename, &datasize);
+    if (data == NULL)
+        return -1;
+
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK)
+        goto err;
+    stream.next_in = (unsigned char *) data;
+    stream.avail_in = datasize;
+    stream.next_out = (unsigned char *) header;
+    stream.avail_out = sizeof(header) - 1;
+    do {
+        status = inflate(&stream, Z_SYNC_FLUSH);
+        nul = memchr(header, '\0', sizeof(header) - 1 - stream.avail_out);
+    } while (nul == NULL && status == Z_OK && stream.avail_out > 0);
+    if (nul == NULL)
+        goto err;
+
+    char *space = strchr(header, ' ');
+    if (space == NULL)
+        goto err;
+    *type = 0;
+    for (int i = 1; i < 8; i++) {
+        if (type_names[i] != NULL &&
+            strncmp(header, type_names[i], space - header) == 0 &&
+            type_names[i][space - header] == '\0')
+            *type = i;
+    }
+    size = strtoul(space + 1, NULL, 10);
+    if (*type == 0)
+        goto err;
+
+    /* some of the data is already in header, after the NUL */
+    if (limit > 0 && limit < size)
+        size = limit;
+    out = malloc(size + 1);
+    if (out == NULL)
+        goto err;
+    size_t have = (char *) stream.next_out - nul - 1;
+    if (have > size)
+        have = size;
+    memcpy(out, nul + 1, have);
+    stream.next_out = (unsigned char *) out + have;
+    stream.avail_out = size - have;
+    while (stream.avail_out > 0 && status == Z_OK)
+        status = inflate(&stream, Z_SYNC_FLUSH);
+    if (stream.avail_out > 0)
+        goto err;
+    inflateEnd(&stream);
+    munmap((void *) data, datasize);
+    out[size] = '\0';
+    *buf = out;
+    return size;
+
+ err:
+    debug("'%s': corrupt loose object", filename);
+    inflateEnd(&stream);
+    munmap((void *) data, datasize);
+    free(out);
+    return -1;
+}
+
+static long
+read_object(gitobjects_t *objects, const unsigned char *oid, int depth,
+            int *type, char **buf, size_t limit)
+{
+    uint64_t offset;
+
+    for (int i = 0; i < objects->npacks; i++) {
+        gitpack_t *pack = &objects->packs[i];
+        if (find_in_pack(pack, oid, objects->hashsize, &offset))
+            return unpack_object(objects, pack, offset, depth,
+                                 type, buf, limit);
+    }
+    return read_loose_object(objects, oid, type, buf, limit);
+}
+
+long
+read_git_object(gitobjects_t *objects, const unsigned char *oid,
+                char *type, size_t typesize, char **buf, size_t limit)
+{
+    int typenum;
+    long len = read_object(objects, oid, 0, &typenum, buf, limit);
+    if (len >= 0)
+        snprintf(type, typesize, "%s", type_names[typenum]);
+    return len;
+}
+
+#else /* !HAVE_ZLIB */
+
+gitobjects_t *
+open_git_objects(const char *objdir, int hashsize)
+{
+    debug("built without zlib: cannot read git objects");
+    return NULL;
+}
+
+void
+free_git_objects(gitobjects_t *objects)
+{
+}
+
+long
+read_git_object(gitobjects_t *objects, const unsigned char *oid,
+                char *type, size_t typesize, char **buf, size_t limit)
+{
+    return -1;
+}
+
+#endif
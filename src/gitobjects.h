@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITOBJECTS_H
+#define GITOBJECTS_H
+
+#include <stddef.h>
+
+/* A git object directory (e.g. ".git/objects"): its loose objects and
+ * its packs.  Pack indexes (.idx) are mmap()ed when the store is
+ * opened, and the packs themselves on first use.
+ */
+typedef struct gitobjects gitobjects_t;
+
+/* Open the object directory objdir, whose object IDs are hashsize
+ * bytes long.  Return NULL if vcprompt was built without zlib, since
+ * every object is compressed.  Caller must free the result with
+ * free_git_objects().
+ */
+gitobjects_t *
+open_git_objects(const char *objdir, int hashsize);
+
+void
+free_git_objects(gitobjects_t *objects);
+
+/* Find the object with binary ID oid, as a loose object or by binary
+ * search in the pack indexes, and inflate it to *buf (NUL-terminated;
+ * caller frees).  If limit is not 0, inflate no more than limit bytes
+ * of it: enough for the header of a commit, say.  Copy its type
+ * ("commit", "tree", ...) to type.  Return the number of bytes in
+ * *buf, or -1 if the object is missing or corrupt.
+ */
+long
+read_git_object(gitobjects_t *objects, const unsigned char *oid,
+                char *type, size_t typesize, char **buf, size_t limit);
+
+/* Find the committer time in the text of commit object buf and store
+ * it in *when.  Return 1 on success.
+ */
+int
+parse_commit_time(const char *buf, long *when);
+
+#endif
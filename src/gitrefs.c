@@ -0,0 +1,545 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "gitindex.h"
+#include "gitrefs.h"
+
+/* A record is a "<oid> <refname>" line, plus an optional "^<oid>" line
+ * with the peeled value of an annotated tag.  Back up from p to the
+ * start of the record containing it.
+ */
+static const char *
+record_start(const char *buf, const char *p)
+{
+    while (p > buf && (p[-1] != '\n' || p[0] == '^'))
+        p--;
+    return p;
+}
+
+static const char *
+record_end(const char *p, const char *end)
+{
+    while (++p < end && (p[-1] != '\n' || p[0] == '^'))
+        ;
+    return p;
+}
+
+/* Compare refname with the name in the record at rec: like strcmp(). */
+static int
+compare_record(const char *rec, const char *end, const char *refname)
+{
+    const char *name = memchr(rec, ' ', end - rec);
+    if (name == NULL)
+        return 1;               /* garbage: treat as greater */
+    for (name++; name < end && *name != '\n'; name++, refname++) {
+        if (*refname == '\0')
+            return 1;           /* record is longer */
+        if ((unsigned char) *name != (unsigned char) *refname)
+            return (unsigned char) *name - (unsigned char) *refname;
+    }
+    return *refname == '\0' ? 0 : -1;
+}
+
+static const char *
+find_record_sorted(const char *start, const char *end, const char *refname)
+{
+    const char *lo = start, *hi = end;
+
+    while (lo < hi) {
+        const char *mid = record_start(start, lo + (hi - lo) / 2);
+        int cmp = compare_record(mid, end, refname);
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+            lo = record_end(mid, end);
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+static const char *
+find_record_unsorted(const char *start, const char *end, const char *refname)
+{
+    const char *rec;
+
+    for (rec = start; rec < end; rec = record_end(rec, end)) {
+        if (*rec != '#' && compare_record(rec, end, refname) == 0)
+            return rec;
+    }
+    return NULL;
+}
+
+int
+read_packed_ref(const char *filename, const char *refname,
+                char *buf, int size)
+{
+    struct stat statbuf;
+    const char *data, *start, *end, *rec;
+    int sorted = 0, found = 0;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        debug("error opening '%s': %s", filename, strerror(errno));
+        return 0;
+    }
+    if (fstat(fd, &statbuf) < 0 || statbuf.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        debug("failed to mmap() '%s': %s", filename, strerror(errno));
+        return 0;
+    }
+    start = data;
+    end = data + statbuf.st_size;
+
+    /* optional header: "# pack-refs with: peeled fully-peeled sorted " */
+    if (*start == '#') {
+        const char *eol = memchr(start, '\n', end - start);
+        if (eol == NULL)
+            eol = end;
+        for (const char *p = start; p + 7 <= eol; p++) {
+            if (memcmp(p, " sorted", 7) == 0 && (p + 7 == eol || p[7] == ' ')) {
+                sorted = 1;
+                break;
+            }
+        }
+        start = eol < end ? eol + 1 : end;
+    }
+
+    if (sorted)
+        rec = find_record_sorted(start, end, refname);
+    else
+        rec = find_record_unsorted(start, end, refname);
+    if (rec != NULL) {
+        const char *space = memchr(rec, ' ', end - rec);
+        int len = space - rec;
+        if (len >= size)
+            len = size - 1;
+        memcpy(buf, rec, len);
+        buf[len] = '\0';
+        found = 1;
+        debug("found '%s' in %s '%s'", refname,
+              sorted ? "sorted" : "unsorted", filename);
+    }
+    else
+        debug("'%s' not found in '%s'", refname, filename);
+
+    munmap((void *) data, statbuf.st_size);
+    return found;
+}
+
+/* A reftable is a sequence of blocks: ref blocks ('r') sorted by ref
+ * name, then optional ref index blocks ('i') that map the last name in
+ * each ref block to its position, then object and log blocks, which we
+ * never read, then a footer with the positions of each section.
+ */
+
+#define REFTABLE_FOOTER_LEN(header) ((header) + 5 * 8 + 4)
+#define REFTABLE_MAX_KEY    4096
+#define REFTABLE_MAX_LEVELS 16
+#define REFTABLE_MAX_TABLES 1024
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t header_len;                  /* 24 in version 1, 28 in 2 */
+    uint32_t block_size;                /* 0 if blocks are not aligned */
+    uint64_t ref_index;                 /* 0 if there is no ref index */
+    uint64_t ref_end;                   /* end of the ref blocks */
+    uint64_t end;                       /* start of the footer */
+    int hashsize;
+} reftable_t;
+
+typedef struct {
+    char type;                          /* 'r', 'i', ... */
+    const unsigned char *start;         /* the first block starts with
+                                           the file header */
+    const unsigned char *records;
+    const unsigned char *restarts;      /* uint24 offsets from start */
+    unsigned int nrestarts;
+    size_t full_size;                   /* up to the next block */
+} reftable_block_t;
+
+static uint32_t
+get_be24(const unsigned char *p)
+{
+    return ((uint32_t) p[0] << 16) | ((uint32_t) p[1] << 8) | p[2];
+}
+
+static int
+open_reftable(const char *filename, reftable_t *table)
+{
+    struct stat statbuf;
+    const unsigned char *data, *footer;
+    int fd;
+
+    memset(table, 0, sizeof(reftable_t));
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        debug("error opening '%s': %s", filename, strerror(errno));
+        return 0;
+    }
+    if (fstat(fd, &statbuf) < 0 ||
+        statbuf.st_size < 24 + REFTABLE_FOOTER_LEN(24)) {
+        close(fd);
+        return 0;
+    }
+    data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        debug("failed to mmap() '%s': %s", filename, strerror(errno));
+        return 0;
+    }
+    table->data = data;
+    table->size = statbuf.st_size;
+
+    /* header: "REFT", version, uint24 block size, uint64 min and max
+     * update index, and in version 2 the hash function */
+    if (memcmp(data, "REFT", 4) != 0 || (data[4] != 1 && data[4] != 2))
+        goto err;
+    table->header_len = data[4] == 1 ? 24 : 28;
+    table->hashsize = 20;
+    if (data[4] == 2) {
+        if (table->size < 28 + REFTABLE_FOOTER_LEN(28))
+            goto err;
+        if (memcmp(data + 24, "s256", 4) == 0)
+            table->hashsize = 32;
+        else if (memcmp(data + 24, "sha1", 4) != 0)
+            goto err;
+    }
+    table->block_size = get_be24(data + 5);
+
+    /* footer: the header again, then the positions of the ref index,
+     * the object blocks (shifted left 5 bits), the object index, the
+     * log blocks and the log index, and a CRC-32 */
+    table->end = table->size - REFTABLE_FOOTER_LEN(table->header_len);
+    footer = data + table->end;
+    if (memcmp(footer, data, table->header_len) != 0)
+        goto err;
+    footer += table->header_len;
+    table->ref_index = get_be64(footer);
+    uint64_t sections[3] = {
+        table->ref_index, get_be64(footer + 8) >> 5, get_be64(footer + 24)};
+    table->ref_end = table->end;
+    for (int i = 0; i < 3; i++) {
+        if (sections[i] != 0 && sections[i] < table->ref_end)
+            table->ref_end = sections[i];
+    }
+    return 1;
+
+ err:
+    debug("'%s' is not a reftable", filename);
+    munmap((void *) data, table->size);
+    return 0;
+}
+
+static void
+close_reftable(reftable_t *table)
+{
+    munmap((void *) table->data, table->size);
+}
+
+/* Find the block at position off.  Blocks other than ref and index
+ * blocks are not checked, only their type is set.
+ */
+static int
+read_block(const reftable_t *table, uint64_t off, reftable_block_t *block)
+{
+    size_t header = off == 0 ? table->header_len : 0;
+    uint32_t len;
+
+    if (off >= table->end || table->end - off < header + 4 + 2)
+        return 0;
+    block->start = table->data + off;
+    block->type = block->start[header];
+    if (block->type != 'r' && block->type != 'i')
+        return 1;
+
+    /* <type> <uint24 len> records... restarts... <uint16 nrestarts>,
+     * where len counts from the start of the block */
+    len = get_be24(block->start + header + 1);
+    if (len < header + 4 + 2 || len > table->end - off)
+        return 0;
+    block->nrestarts = get_be16(block->start + len - 2);
+    if (block->nrestarts == 0 ||
+        3 * block->nrestarts > len - 2 - header - 4)
+        return 0;
+    block->records = block->start + header + 4;
+    block->restarts = block->start + len - 2 - 3 * block->nrestarts;
+
+    /* aligned blocks are padded with NULs up to the block size */
+    if (table->block_size == 0 ||
+        (len < table->block_size && off + len < table->end &&
+         block->start[len] != '\0'))
+        block->full_size = len;
+    else
+        block->full_size = table->block_size;
+    return 1;
+}
+
+/* Decode the key of the record at p, which shares its first bytes with
+ * the previous key (*keylen bytes of key), and its value type.  Return
+ * the start of the value, or NULL if the record is corrupt.
+ */
+static const unsigned char *
+decode_key(const reftable_block_t *block, const unsigned char *p,
+           char *key, size_t *keylen, unsigned int *type)
+{
+    size_t prefix, suffix;
+    int n;
+
+    if ((n = decode_varint(p, block->restarts, &prefix)) == 0)
+        return NULL;
+    p += n;
+    if ((n = decode_varint(p, block->restarts, &suffix)) == 0)
+        return NULL;
+    p += n;
+    *type = suffix & 7;
+    suffix >>= 3;
+    if (prefix > *keylen || suffix >= REFTABLE_MAX_KEY - prefix ||
+        suffix > (size_t) (block->restarts - p))
+        return NULL;
+    memcpy(key + prefix, p, suffix);
+    *keylen = prefix + suffix;
+    key[*keylen] = '\0';
+    return p + suffix;
+}
+
+/* Skip the value of the record whose key ends at p. */
+static const unsigned char *
+skip_value(const reftable_t *table, const reftable_block_t *block,
+           const unsigned char *p, unsigned int type)
+{
+    size_t value, len = 0;
+    int n;
+
+    /* index records have a block position; ref records an update
+     * index, then nothing (deleted), one or two object IDs (the second
+     * is the peeled tag), or the target of a symbolic ref */
+    if ((n = decode_varint(p, block->restarts, &value)) == 0)
+        return NULL;
+    p += n;
+    if (block->type == 'r') {
+        if (type == 1)
+            len = table->hashsize;
+        else if (type == 2)
+            len = 2 * table->hashsize;
+        else if (type == 3) {
+            if ((n = decode_varint(p, block->restarts, &len)) == 0)
+                return NULL;
+            p += n;
+        }
+        else if (type != 0)
+            return NULL;
+    }
+    if (len > (size_t) (block->restarts - p))
+        return NULL;
+    return p + len;
+}
+
+static int
+compare_key(const char *key, size_t keylen, const char *name, size_t namelen)
+{
+    int cmp = memcmp(key, name, keylen < namelen ? keylen : namelen);
+    if (cmp != 0)
+        return cmp;
+    return keylen < namelen ? -1 : keylen > namelen;
+}
+
+/* Find the first record in block whose key is not less than name:
+ * binary search the restart points, whose keys are stored in full,
+ * then scan from the last one not greater than name.  Copy its key to
+ * key, and set *value to its value.  Return 1 if found, 0 if every key
+ * in block is less than name, -1 if the block is corrupt.
+ */
+static int
+seek_block(const reftable_t *table, const reftable_block_t *block,
+           const char *name, char *key, size_t *keylen,
+           unsigned int *type, const unsigned char **value)
+{
+    size_t namelen = strlen(name);
+    unsigned int lo = 0, hi = block->nrestarts;
+    const unsigned char *p;
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        p = block->start + get_be24(block->restarts + 3 * mid);
+        *keylen = 0;
+        if (p < block->records || p >= block->restarts ||
+            decode_key(block, p, key, keylen, type) == NULL)
+            return -1;
+        if (compare_key(key, *keylen, name, namelen) > 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    p = lo > 0 ? block->start + get_be24(block->restarts + 3 * (lo - 1))
+               : block->records;
+    *keylen = 0;
+    while (p < block->restarts) {
+        if ((p = decode_key(block, p, key, keylen, type)) == NULL)
+            return -1;
+        if (compare_key(key, *keylen, name, namelen) >= 0) {
+            *value = p;
+            return 1;
+        }
+        if ((p = skip_value(table, block, p, *type)) == NULL)
+            return -1;
+    }
+    return 0;
+}
+
+/* Look up refname in one table.  Return 1 if found, 0 if not, or -1 if
+ * the table deletes it or is corrupt: either way, older tables must
+ * not be asked.
+ */
+static int
+lookup_reftable(const reftable_t *table, const char *refname,
+                char *buf, int size)
+{
+    char key[REFTABLE_MAX_KEY];
+    size_t keylen, pos;
+    unsigned int type;
+    const unsigned char *value;
+    reftable_block_t block;
+    uint64_t off = table->ref_index;
+    int levels = 0, found, n;
+
+    if (table->ref_end <= table->header_len)
+        return 0;               /* no refs at all */
+    for (;;) {
+        if (!read_block(table, off, &block))
+            goto corrupt;
+        if (block.type != 'r' && block.type != 'i')
+            return 0;           /* no refs at all */
+        found = seek_block(table, &block, refname, key, &keylen,
+                           &type, &value);
+        if (found < 0)
+            goto corrupt;
+        if (block.type == 'i') {
+            /* the first block whose last key is not less than refname */
+            if (found == 0)
+                return 0;
+            if (decode_varint(value, block.restarts, &pos) == 0 ||
+                ++levels > REFTABLE_MAX_LEVELS)
+                goto corrupt;
+            off = pos;
+        }
+        else if (found == 0 && table->ref_index == 0) {
+            /* no index: on to the next ref block */
+            off += block.full_size;
+            if (off >= table->ref_end)
+                return 0;
+        }
+        else if (found == 0 || strcmp(key, refname) != 0)
+            return 0;
+        else
+            break;
+    }
+
+    /* skip the update index */
+    if ((n = decode_varint(value, block.restarts, &pos)) == 0)
+        goto corrupt;
+    value += n;
+    if (type == 0) {
+        debug("reftable: '%s' was deleted", refname);
+        return -1;
+    }
+    if (type == 3) {
+        size_t len;
+        if ((n = decode_varint(value, block.restarts, &len)) == 0 ||
+            len > (size_t) (block.restarts - value - n))
+            goto corrupt;
+        snprintf(buf, size, "ref: %.*s", (int) len, value + n);
+    }
+    else if ((type == 1 || type == 2) &&
+             block.restarts - value >= table->hashsize) {
+        char hex[2 * 32 + 1];
+        dump_hex(hex, (const char *) value, table->hashsize);
+        snprintf(buf, size, "%s", hex);
+    }
+    else
+        goto corrupt;
+    return 1;
+
+ corrupt:
+    debug("reftable: corrupt table");
+    return -1;
+}
+
+int
+read_reftable_ref(const char *dir, const char *refname,
+                  char *buf, int size)
+{
+    char filename[1024];
+    char *list = NULL, *tables[REFTABLE_MAX_TABLES];
+    int ntables = 0, found = 0;
+    FILE *file;
+    long len;
+
+    snprintf(filename, sizeof(filename), "%s/tables.list", dir);
+    file = fopen(filename, "r");
+    if (file == NULL) {
+        debug("error opening '%s': %s", filename, strerror(errno));
+        return 0;
+    }
+    if (fseek(file, 0, SEEK_END) < 0 || (len = ftell(file)) < 0 ||
+        fseek(file, 0, SEEK_SET) < 0 ||
+        (list = malloc(len + 1)) == NULL ||
+        fread(list, 1, len, file) != (size_t) len) {
+        fclose(file);
+        free(list);
+        return 0;
+    }
+    fclose(file);
+    list[len] = '\0';
+
+    /* oldest first, one table per line */
+    for (char *line = list; *line != '\0'; ) {
+        char *eol = strchr(line, '\n');
+        if (eol != NULL)
+            *eol++ = '\0';
+        if (*line != '\0' && ntables < REFTABLE_MAX_TABLES)
+            tables[ntables++] = line;
+        line = eol != NULL ? eol : line + strlen(line);
+    }
+
+    for (int i = ntables - 1; i >= 0 && found == 0; i--) {
+        reftable_t table;
+        snprintf(filename, sizeof(filename), "%s/%s", dir, tables[i]);
+        if (!open_reftable(filename, &table)) {
+            found = -1;
+            break;
+        }
+        found = lookup_reftable(&table, refname, buf, size);
+        close_reftable(&table);
+    }
+    free(list);
+    if (found > 0)
+        debug("found '%s' in reftable: '%s'", refname, buf);
+    else
+        debug("'%s' not found in reftables", refname);
+    return found > 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITREFS_H
+#define GITREFS_H
+
+/* Look up refname (e.g. "refs/heads/master") in the packed-refs file
+ * filename.  The file is mmap()ed and, if git says it is sorted,
+ * binary searched; otherwise it is scanned.  On success copy the hex
+ * object ID to buf (up to size-1 chars, NUL-terminated) and return 1.
+ * Return 0 if the file is missing or does not have refname.
+ */
+int
+read_packed_ref(const char *filename, const char *refname,
+                char *buf, int size);
+
+/* Look up refname (e.g. "HEAD" or "refs/heads/master") in the stack
+ * of reftables in directory dir (e.g. ".git/reftable"), newest table
+ * first, as listed in its tables.list.  Each table is mmap()ed and
+ * searched through its ref index, if it has one, and then the restart
+ * points of a single ref block.  If refname is a symbolic ref, copy
+ * "ref: <target>" to buf, as .git/HEAD would have it; otherwise the
+ * hex object ID.  Return 1 if found, 0 if the stack is missing or does
+ * not have refname (or a newer table deleted it).
+ */
+int
+read_reftable_ref(const char *dir, const char *refname,
+                  char *buf, int size);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "gitsparse.h"
+
+static int
+add_dir(char ***dirs, size_t *ndirs, const char *dir, size_t len)
+{
+    char **more = realloc(*dirs, (*ndirs + 1) * sizeof(char *));
+    char *copy;
+
+    if (more == NULL)
+        return 0;
+    *dirs = more;
+    if ((copy = malloc(len + 1)) == NULL)
+        return 0;
+    /* drop the backslashes that escape glob characters in names */
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (dir[i] == '\\' && i + 1 < len)
+            i++;
+        copy[n++] = dir[i];
+    }
+    copy[n] = '\0';
+    (*dirs)[(*ndirs)++] = copy;
+    return 1;
+}
+
+static void
+free_dirs(char **dirs, size_t ndirs)
+{
+    for (size_t i = 0; i < ndirs; i++)
+        free(dirs[i]);
+    free(dirs);
+}
+
+int
+read_sparse_cone(const char *filename, sparse_cone_t *cone)
+{
+    char line[4096];
+    char **dirs = NULL, **parents = NULL;
+    size_t ndirs = 0, nparents = 0;
+    FILE *file;
+    int ok = 1;
+
+    memset(cone, 0, sizeof(sparse_cone_t));
+    file = fopen(filename, "r");
+    if (file == NULL)
+        return 0;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#' ||
+            strcmp(line, "/*") == 0 || strcmp(line, "!/*/") == 0)
+            continue;
+        if (len > 5 && strncmp(line, "!/", 2) == 0 &&
+            strcmp(line + len - 3, "/*/") == 0)
+            ok = add_dir(&parents, &nparents, line + 2, len - 4);
+        else if (len > 2 && line[0] == '/' && line[len - 1] == '/' &&
+                 strpbrk(line, "*?[") == NULL)
+            ok = add_dir(&dirs, &ndirs, line + 1, len - 1);
+        else {
+            debug("sparse-checkout: '%s' is not a cone pattern", line);
+            ok = 0;
+        }
+    }
+    fclose(file);
+    if (!ok) {
+        free_dirs(dirs, ndirs);
+        free_dirs(parents, nparents);
+        return 0;
+    }
+
+    /* a directory whose subdirectories are dropped again is a parent;
+     * the others are checked out in full */
+    for (size_t i = 0; i < ndirs; i++) {
+        int parent = 0;
+        for (size_t j = 0; j < nparents; j++)
+            parent |= (strcmp(dirs[i], parents[j]) == 0);
+        if (parent)
+            free(dirs[i]);
+        else
+            dirs[cone->nrecursive++] = dirs[i];
+    }
+    cone->recursive = dirs;
+    cone->parents = parents;
+    cone->nparents = nparents;
+    debug("sparse-checkout: cone of %zu dirs, %zu parents",
+          cone->nrecursive, cone->nparents);
+    return 1;
+}
+
+void
+free_sparse_cone(sparse_cone_t *cone)
+{
+    free_dirs(cone->recursive, cone->nrecursive);
+    free_dirs(cone->parents, cone->nparents);
+    memset(cone, 0, sizeof(sparse_cone_t));
+}
+
+int
+in_sparse_cone(const sparse_cone_t *cone, const char *dir, size_t len)
+{
+    for (size_t i = 0; i < cone->nrecursive; i++) {
+        size_t rlen = strlen(cone->recursive[i]);
+        /* inside a recursive dir, or on the way to one */
+        if (strncmp(dir, cone->recursive[i], rlen < len ? rlen : len) == 0)
+            return 1;
+    }
+    for (size_t i = 0; i < cone->nparents; i++) {
+        if (strlen(cone->parents[i]) == len &&
+            strncmp(dir, cone->parents[i], len) == 0)
+            return 1;
+    }
+    return 0;
+}
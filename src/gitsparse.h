@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITSPARSE_H
+#define GITSPARSE_H
+
+#include <stddef.h>
+
+/* The directories of a cone-mode sparse checkout, as written by "git
+ * sparse-checkout set --cone" to .git/info/sparse-checkout: after a
+ * header that keeps the files at the top and drops every directory,
+ * each directory to check out in full is listed as "/A/B/", and each
+ * of its parents as "/A/" followed by a pattern that drops the
+ * parent's own subdirectories again.
+ */
+typedef struct {
+    char **recursive;                   /* e.g. "A/B/" */
+    size_t nrecursive;
+    char **parents;                     /* e.g. "A/" */
+    size_t nparents;
+} sparse_cone_t;
+
+/* Read the cone from filename.  Return 1 on success, 0 if the file is
+ * missing or is not in cone mode (then nothing is pruned).  Caller
+ * must free the result with free_sparse_cone().
+ */
+int
+read_sparse_cone(const char *filename, sparse_cone_t *cone);
+
+void
+free_sparse_cone(sparse_cone_t *cone);
+
+/* Return true if directory dir (relative to the top of the working
+ * dir, with a trailing "/") has files in the cone.
+ */
+int
+in_sparse_cone(const sparse_cone_t *cone, const char *dir, size_t len);
+
+#endif
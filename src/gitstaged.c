@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "gitindex.h"
+#include "gitobjects.h"
+#include "gitstaged.h"
+
+/* No sane repository nests trees this deep. */
+#define MAX_TREE_DEPTH 256
+#define PATH_BUFSIZE   4096
+
+/* One node of the cache-tree: a directory, the number of index entries
+ * under it and, if they have not changed since, its tree's object ID.
+ */
+typedef struct cache_tree {
+    const char *name;                   /* "" for the root */
+    size_t namelen;
+    long nentries;                      /* -1 if invalidated */
+    const unsigned char *oid;           /* NULL if invalidated */
+    int nsubtrees;
+    struct cache_tree *subtrees;
+} cache_tree_t;
+
+typedef struct {
+    gitindex_cursor_t cursor;
+    int status;                         /* last next_index_entry() */
+    int hashsize;
+    const char *objdir;
+    gitobjects_t *objects;              /* opened on first use */
+    int ntrees;                         /* tree objects read */
+} tree_diff_t;
+
+static void
+free_cache_tree(cache_tree_t *node)
+{
+    for (int i = 0; i < node->nsubtrees; i++)
+        free_cache_tree(&node->subtrees[i]);
+    free(node->subtrees);
+}
+
+/* Parse the node at p, and its subtrees, which follow it depth-first:
+ *   <name> NUL <nentries> SP <nsubtrees> LF [<object ID>]
+ * Return the end of the node, or NULL if the extension is corrupt.
+ */
+static const unsigned char *
+parse_cache_tree(const unsigned char *p, const unsigned char *end,
+                 int hashsize, int depth, cache_tree_t *node)
+{
+    const unsigned char *nul, *eol;
+    char *num;
+
+    memset(node, 0, sizeof(cache_tree_t));
+    if (depth > MAX_TREE_DEPTH ||
+        (nul = memchr(p, '\0', end - p)) == NULL ||
+        (eol = memchr(nul, '\n', end - nul)) == NULL)
+        return NULL;
+    node->name = (const char *) p;
+    node->namelen = nul - p;
+    node->nentries = strtol((const char *) nul + 1, &num, 10);
+    if (*num != ' ')
+        return NULL;
+    long nsubtrees = strtol(num + 1, &num, 10);
+    if (num != (const char *) eol || nsubtrees < 0 || nsubtrees > end - p)
+        return NULL;
+    p = eol + 1;
+    if (node->nentries >= 0) {
+        if (end - p < hashsize)
+            return NULL;
+        node->oid = p;
+        p += hashsize;
+    }
+    if (nsubtrees == 0)
+        return p;
+
+    node->subtrees = calloc(nsubtrees, sizeof(cache_tree_t));
+    if (node->subtrees == NULL)
+        return NULL;
+    for (; node->nsubtrees < nsubtrees; node->nsubtrees++) {
+        p = parse_cache_tree(p, end, hashsize, depth + 1,
+                             &node->subtrees[node->nsubtrees]);
+        if (p == NULL)
+            return NULL;
+    }
+    return p;
+}
+
+static const cache_tree_t *
+find_subtree(const cache_tree_t *node, const char *name, size_t namelen)
+{
+    if (node == NULL)
+        return NULL;
+    for (int i = 0; i < node->nsubtrees; i++) {
+        const cache_tree_t *sub = &node->subtrees[i];
+        if (sub->namelen == namelen && memcmp(sub->name, name, namelen) == 0)
+            return sub;
+    }
+    return NULL;
+}
+
+/* Modes as git compares them: any regular file is 644 or 755. */
+static unsigned int
+canon_mode(unsigned int mode)
+{
+    if ((mode & GIT_MODE_TYPE) == GIT_MODE_FILE)
+        return GIT_MODE_FILE | (mode & 0100 ? 0755 : 0644);
+    return mode & GIT_MODE_TYPE;
+}
+
+static void
+next_entry(tree_diff_t *diff)
+{
+    diff->status = next_index_entry(&diff->cursor);
+}
+
+/* Compare the tree oid, whose path (with a trailing slash unless it is
+ * the root) is the first prefixlen bytes of prefix, with the index
+ * entries from the current one on.  Leave the cursor after the last
+ * entry under prefix.
+ */
+static int
+diff_tree(tree_diff_t *diff, const unsigned char *oid,
+          char *prefix, size_t prefixlen, const cache_tree_t *node,
+          int depth)
+{
+    const gitindex_entry_t *entry = &diff->cursor.entry;
+    char type[16], *buf = NULL;
+    long len;
+    int result = -1;
+
+    if (node != NULL && node->oid != NULL &&
+        memcmp(node->oid, oid, diff->hashsize) == 0) {
+        /* unchanged since git last wrote this tree */
+        for (long i = 0; i < node->nentries && diff->status > 0; i++)
+            next_entry(diff);
+        return diff->status < 0 ? -1 : 0;
+    }
+
+    if (depth > MAX_TREE_DEPTH)
+        return -1;
+    if (diff->objects == NULL) {
+        diff->objects = open_git_objects(diff->objdir, diff->hashsize);
+        if (diff->objects == NULL)
+            return -1;
+    }
+    len = read_git_object(diff->objects, oid, type, sizeof(type), &buf, 0);
+    if (len < 0 || strcmp(type, "tree") != 0) {
+        debug("cannot read tree '%.*s'", (int) prefixlen, prefix);
+        goto done;
+    }
+    diff->ntrees++;
+
+    /* entries: <octal mode> SP <name> NUL <object ID> */
+    const char *p = buf, *end = buf + len;
+    while (p < end) {
+        char *space;
+        unsigned int mode = strtoul(p, &space, 8);
+        const char *name = space + 1;
+        const char *nul = memchr(name, '\0', end - name);
+        if (*space != ' ' || nul == NULL ||
+            end - nul - 1 < diff->hashsize)
+            goto done;
+        const unsigned char *suboid = (const unsigned char *) nul + 1;
+        p = nul + 1 + diff->hashsize;
+
+        size_t namelen = nul - name;
+        size_t pathlen = prefixlen + namelen;
+        if (pathlen + 2 > PATH_BUFSIZE)
+            goto done;
+        memcpy(prefix + prefixlen, name, namelen);
+        prefix[pathlen] = '\0';
+
+        if (diff->status <= 0) {
+            /* removed from the index */
+            result = diff->status < 0 ? -1 : 1;
+            goto done;
+        }
+        if (entry->flags & CE_INTENT_TO_ADD)
+            goto done;
+        if (CE_STAGE(entry->flags) != 0) {
+            debug("index: '%s' is unmerged", entry->path);
+            result = 1;
+            goto done;
+        }
+
+        if ((mode & GIT_MODE_TYPE) == GIT_MODE_DIR) {
+            prefix[pathlen++] = '/';
+            prefix[pathlen] = '\0';
+            if ((entry->mode & GIT_MODE_TYPE) == GIT_MODE_DIR &&
+                strcmp(entry->path, prefix) == 0) {
+                /* a sparse directory entry stands for the whole tree */
+                result = memcmp(entry->oid, suboid, diff->hashsize) != 0;
+                next_entry(diff);
+            }
+            else if (strncmp(entry->path, prefix, pathlen) != 0) {
+                debug("index: '%s' added or removed", prefix);
+                result = 1;
+            }
+            else
+                result = diff_tree(diff, suboid, prefix, pathlen,
+                                   find_subtree(node, name, namelen),
+                                   depth + 1);
+            if (result != 0)
+                goto done;
+        }
+        else {
+            if (strcmp(entry->path, prefix) != 0 ||
+                canon_mode(entry->mode) != canon_mode(mode) ||
+                memcmp(entry->oid, suboid, diff->hashsize) != 0) {
+                debug("index: '%s' is staged", prefix);
+                result = 1;
+                goto done;
+            }
+            next_entry(diff);
+        }
+    }
+
+    /* anything left under prefix was added */
+    prefix[prefixlen] = '\0';
+    if (diff->status < 0)
+        result = -1;
+    else if (diff->status > 0 &&
+             strncmp(entry->path, prefix, prefixlen) == 0) {
+        if (entry->flags & CE_INTENT_TO_ADD)
+            result = -1;
+        else {
+            debug("index: '%s' added", entry->path);
+            result = 1;
+        }
+    }
+    else
+        result = 0;
+
+ done:
+    free(buf);
+    return result;
+}
+
+int
+staged_changes(const gitindex_t *index, const unsigned char *tree,
+               const char *objdir)
+{
+    tree_diff_t diff;
+    cache_tree_t root;
+    const unsigned char *ext;
+    char prefix[PATH_BUFSIZE];
+    size_t size;
+    int result;
+
+    memset(&diff, 0, sizeof(diff));
+    diff.hashsize = index->hashsize;
+    diff.objdir = objdir;
+    init_index_cursor(&diff.cursor, index);
+    next_entry(&diff);
+
+    if (tree == NULL) {
+        /* no commits yet: anything in the index is staged */
+        while (diff.status > 0 && (diff.cursor.entry.flags & CE_INTENT_TO_ADD))
+            next_entry(&diff);
+        free_index_cursor(&diff.cursor);
+        return diff.status;
+    }
+
+    memset(&root, 0, sizeof(root));
+    ext = find_index_extension(index, "TREE", &size);
+    if (ext != NULL && size > 0 &&
+        parse_cache_tree(ext, ext + size, index->hashsize, 0, &root) == NULL) {
+        debug("index: corrupt cache-tree: ignoring it");
+        free_cache_tree(&root);
+        memset(&root, 0, sizeof(root));
+    }
+
+    prefix[0] = '\0';
+    result = diff_tree(&diff, tree, prefix, 0, &root, 0);
+    debug("index: compared with HEAD after reading %d trees", diff.ntrees);
+
+    free_cache_tree(&root);
+    free_git_objects(diff.objects);
+    free_index_cursor(&diff.cursor);
+    return result;
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITSTAGED_H
+#define GITSTAGED_H
+
+#include "gitindex.h"
+
+/* Decide whether the index differs from the tree tree (the binary ID
+ * of HEAD's root tree, or NULL if HEAD has no commits yet), like "git
+ * diff --cached --quiet".  Index entries and tree objects are compared
+ * in step, and every subtree whose ID is still recorded in the
+ * cache-tree (TREE extension) of the index is skipped without reading
+ * it; other tree objects are read from objdir.
+ *
+ * Return 1 if there are staged changes, 0 if not, -1 if we cannot
+ * tell (e.g. objects we cannot read, intent-to-add entries), in which
+ * case caller should ask git.
+ */
+int
+staged_changes(const gitindex_t *index, const unsigned char *tree,
+               const char *objdir);
+
+#endif
@@ -0,0 +1,1062 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "../config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "gitignore.h"
+#include "gitindex.h"
+#include "gituntracked.h"
+
+/* The dir_flags of an untracked cache for the default
+ * status.showUntrackedFiles=normal: DIR_SHOW_OTHER_DIRECTORIES |
+ * DIR_HIDE_EMPTY_DIRECTORIES in git's dir.h.  Git drops a cache made
+ * with other flags, and so do we.
+ */
+#define UNTRACKED_DIR_FLAGS 6
+
+/* One directory block of the UNTR extension. */
+typedef struct {
+    const char *name;                   /* "" for the root */
+    int depth;
+    size_t nuntracked;
+    const char *untracked;              /* nuntracked NUL-terminated names */
+    const unsigned char *stat;          /* NULL if the block is not valid */
+    const unsigned char *exclude_oid;   /* NULL if no per-dir excludes */
+} ucdir_t;
+
+typedef struct {
+    const gitindex_t *index;
+    const unsigned char *pos, *end;
+    ucdir_t *dirs;
+    size_t ndirs, maxdirs;
+    const char *exclude_per_dir;        /* usually ".gitignore" */
+    gitindex_paths_t paths;             /* loaded on first re-read */
+    int have_paths;
+} untracked_cache_t;
+
+static const char *
+read_string(untracked_cache_t *cache)
+{
+    const unsigned char *nul = memchr(cache->pos, '\0',
+                                      cache->end - cache->pos);
+    if (nul == NULL)
+        return NULL;
+    const char *str = (const char *) cache->pos;
+    cache->pos = nul + 1;
+    return str;
+}
+
+static int
+read_number(untracked_cache_t *cache, size_t *value)
+{
+    int n = decode_varint(cache->pos, cache->end, value);
+    cache->pos += n;
+    return n > 0;
+}
+
+/* Parse one directory block and (recursively) its subdirectories; the
+ * blocks are stored in depth-first order.  No path is deeper than
+ * PATH_MAX / 2 directories, each with a name, so a cache that says
+ * otherwise is corrupt. */
+static int
+read_dir_block(untracked_cache_t *cache, int depth)
+{
+    size_t nuntracked, nsubdirs, i;
+    ucdir_t *dir;
+
+    if (cache->ndirs >= cache->maxdirs || depth >= PATH_MAX / 2)
+        return 0;
+    dir = &cache->dirs[cache->ndirs++];
+    dir->depth = depth;
+    if (!read_number(cache, &nuntracked) || !read_number(cache, &nsubdirs))
+        return 0;
+    dir->nuntracked = nuntracked;
+    if ((dir->name = read_string(cache)) == NULL ||
+        (depth > 0 && dir->name[0] == '\0'))
+        return 0;
+    dir->untracked = (const char *) cache->pos;
+    for (i = 0; i < nuntracked; i++) {
+        if (read_string(cache) == NULL)
+            return 0;
+    }
+    for (i = 0; i < nsubdirs; i++) {
+        if (!read_dir_block(cache, depth + 1))
+            return 0;
+    }
+    return 1;
+}
+
+static int
+is_null_oid(const unsigned char *oid, int hashsize)
+{
+    for (int i = 0; i < hashsize; i++) {
+        if (oid[i] != 0)
+            return 0;
+    }
+    return 1;
+}
+
+/* Check that a global exclude file is in the state the cache recorded
+ * (stat data and hash).  Return true if it is. */
+static int
+exclude_file_unchanged(const char *filename,
+                       const unsigned char *stat, const unsigned char *oid,
+                       int hashsize)
+{
+    struct stat statbuf;
+
+    if (filename == NULL || lstat(filename, &statbuf) < 0)
+        return is_null_oid(oid, hashsize);
+    return !stat_data_changed(stat, &statbuf);
+}
+
+/* Check that the per-directory exclude file in dir (path ends with "/"
+ * or is empty) still has the content that the cache recorded.  We
+ * cannot hash files, so this works only if the file is tracked and
+ * unmodified: then the index tells us its object ID. */
+static int
+dir_excludes_unchanged(untracked_cache_t *cache,
+                       const char *path, const ucdir_t *dir)
+{
+    char filename[PATH_MAX];
+    struct stat statbuf;
+
+    if (snprintf(filename, sizeof(filename), "%s%s",
+                 path, cache->exclude_per_dir) >= (int) sizeof(filename))
+        return 0;
+    if (lstat(filename, &statbuf) < 0)
+        return dir->exclude_oid == NULL;
+    if (dir->exclude_oid == NULL)
+        return 0;
+
+    if (!cache->have_paths) {
+        if (!load_index_paths(cache->index, &cache->paths))
+            return 0;
+        cache->have_paths = 1;
+    }
+    const gitindex_path_t *tracked = find_index_path(&cache->paths, filename);
+    if (tracked == NULL)
+        return 0;
+    gitindex_entry_t entry;
+    read_index_entry(cache->index, tracked->ondisk, tracked->path, &entry);
+    return (memcmp(entry.oid, dir->exclude_oid, cache->index->hashsize) == 0 &&
+            index_entry_changed(cache->index, &entry, &statbuf,
+                                0, 1, 1) == 0);
+}
+
+static int
+is_cached_untracked(const ucdir_t *dir, const char *name, int isdir)
+{
+    const char *p = dir->untracked;
+    size_t len = strlen(name);
+
+    for (size_t i = 0; i < dir->nuntracked; i++) {
+        size_t plen = strlen(p);
+        if (strncmp(p, name, len) == 0 &&
+            (plen == len || (isdir && plen == len + 1 && p[len] == '/')))
+            return 1;
+        p += plen + 1;
+    }
+    return 0;
+}
+
+static int
+has_dir_block(const untracked_cache_t *cache, size_t idx, const char *name)
+{
+    int depth = cache->dirs[idx].depth;
+    for (size_t i = idx + 1;
+         i < cache->ndirs && cache->dirs[i].depth > depth; i++) {
+        if (cache->dirs[i].depth == depth + 1 &&
+            strcmp(cache->dirs[i].name, name) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* Read again a directory whose stat data changed since git cached it
+ * (or that git invalidated, e.g. because a file in it was added to the
+ * index).  Tracked entries and subdirectories with their own block are
+ * fine; an entry that the cache lists as untracked means there are
+ * still untracked files.  Anything else is new (or changed) since the
+ * cache was written and we cannot tell whether it is ignored, except
+ * for entries whose inode has not changed since a valid directory was
+ * cached: those must have been ignored back then, and still are.
+ */
+static int
+reread_dir(untracked_cache_t *cache, size_t idx, char *path, size_t pathlen)
+{
+    const ucdir_t *dir = &cache->dirs[idx];
+    struct dirent *dirent;
+    struct stat statbuf;
+    DIR *dirp;
+    int result = 0;
+
+    if (!cache->have_paths) {
+        if (!load_index_paths(cache->index, &cache->paths))
+            return -1;
+        cache->have_paths = 1;
+    }
+
+    debug("untracked cache: re-reading '%s'", pathlen ? path : ".");
+    dirp = opendir(pathlen ? path : ".");
+    if (dirp == NULL)
+        return -1;
+    while (result == 0 && (dirent = readdir(dirp)) != NULL) {
+        const char *name = dirent->d_name;
+        size_t namelen = strlen(name);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            (pathlen == 0 && strcmp(name, ".git") == 0))
+            continue;
+        if (pathlen + namelen + 2 > PATH_MAX) {
+            result = -1;
+            break;
+        }
+        memcpy(path + pathlen, name, namelen + 1);
+        if (find_index_path(&cache->paths, path) != NULL)
+            continue;
+        if (lstat(path, &statbuf) < 0) {
+            result = -1;
+            break;
+        }
+        int isdir = S_ISDIR(statbuf.st_mode);
+        if (isdir) {
+            strcpy(path + pathlen + namelen, "/");
+            int tracked = index_has_dir(&cache->paths, path);
+            path[pathlen + namelen] = '\0';
+            if (tracked) {
+                if (!has_dir_block(cache, idx, name))
+                    result = -1;
+                continue;
+            }
+        }
+        if (dir->stat == NULL) {
+            /* invalidated: its list of untracked files is gone too */
+            debug("untracked cache: '%s' is not tracked", path);
+            result = -1;
+        }
+        else if (is_cached_untracked(dir, name, isdir)) {
+            debug("untracked cache: '%s' is still untracked", path);
+            result = 1;
+        }
+        else if (get_be32(dir->stat + 8) > (uint32_t) statbuf.st_ctime ||
+                 (get_be32(dir->stat + 8) == (uint32_t) statbuf.st_ctime &&
+                  get_be32(dir->stat + 12) >
+                  (uint32_t) ST_CTIME_NSEC(&statbuf)))
+            continue;           /* unchanged, so still ignored */
+        else {
+            debug("untracked cache: '%s' is new", path);
+            result = -1;
+        }
+    }
+    closedir(dirp);
+    path[pathlen] = '\0';
+    return result;
+}
+
+static int
+check_dirs(untracked_cache_t *cache)
+{
+    char path[PATH_MAX];
+    size_t pathlen[PATH_MAX / 2];
+    size_t i;
+
+    for (i = 0; i < cache->ndirs; i++) {
+        const ucdir_t *dir = &cache->dirs[i];
+        struct stat statbuf;
+        size_t len = dir->depth > 0 ? pathlen[dir->depth - 1] : 0;
+        size_t namelen = strlen(dir->name);
+
+        if (dir->depth > 0) {
+            if (len + namelen + 2 > sizeof(path))
+                return -1;
+            memcpy(path + len, dir->name, namelen);
+            len += namelen;
+            path[len++] = '/';
+        }
+        path[len] = '\0';
+        pathlen[dir->depth] = len;
+
+        if (lstat(len ? path : ".", &statbuf) < 0) {
+            /* gone: its parent changed, so it was re-read */
+            continue;
+        }
+        if (!dir_excludes_unchanged(cache, path, dir)) {
+            debug("untracked cache: excludes in '%s' changed", path);
+            return -1;
+        }
+        if (dir->stat != NULL && !stat_data_changed(dir->stat, &statbuf)) {
+            if (dir->nuntracked > 0) {
+                debug("untracked cache: '%s' has untracked files",
+                      len ? path : ".");
+                return 1;
+            }
+            continue;
+        }
+        int result = reread_dir(cache, i, path, len);
+        if (result != 0)
+            return result;
+    }
+    return 0;
+}
+
+int
+untracked_cache_check(const gitindex_t *index, const char *info_exclude,
+                      const char *excludes_file)
+{
+    untracked_cache_t cache;
+    size_t size, identlen, ndirs, i;
+    unsigned char *valid = NULL, *check_only = NULL, *oid_valid = NULL;
+    size_t nvalid, ncheck_only, noid_valid, n;
+    char cwd[PATH_MAX];
+    int result = -1;
+
+    memset(&cache, 0, sizeof(cache));
+    cache.index = index;
+    cache.pos = find_index_extension(index, "UNTR", &size);
+    if (cache.pos == NULL) {
+        debug("index has no untracked cache");
+        return -1;
+    }
+    cache.end = cache.pos + size;
+
+    /* The cache is only good for the worktree it was made for. */
+    if (!read_number(&cache, &identlen) ||
+        identlen > (size_t) (cache.end - cache.pos) ||
+        getcwd(cwd, sizeof(cwd)) == NULL)
+        goto done;
+    if (identlen < 9 + strlen(cwd) ||
+        memcmp(cache.pos, "Location ", 9) != 0 ||
+        strncmp((const char *) cache.pos + 9, cwd, strlen(cwd)) != 0 ||
+        cache.pos[9 + strlen(cwd)] != ',') {
+        debug("untracked cache: made for another worktree");
+        goto done;
+    }
+    cache.pos += identlen;
+
+    /* global excludes: stat data of .git/info/exclude and
+     * core.excludesFile, dir_flags, then their hashes */
+    int hashsize = index->hashsize;
+    const unsigned char *hdr = cache.pos;
+    if (cache.end - cache.pos < 2 * STAT_DATA_LEN + 4 + 2 * hashsize)
+        goto done;
+    cache.pos += 2 * STAT_DATA_LEN + 4 + 2 * hashsize;
+    if (get_be32(hdr + 2 * STAT_DATA_LEN) != UNTRACKED_DIR_FLAGS) {
+        /* e.g. written by "git status -uall", which lists the files in
+         * untracked directories rather than the directories */
+        debug("untracked cache: made with dir_flags %u, not %u",
+              get_be32(hdr + 2 * STAT_DATA_LEN), UNTRACKED_DIR_FLAGS);
+        goto done;
+    }
+    if (!exclude_file_unchanged(info_exclude, hdr,
+                                hdr + 2 * STAT_DATA_LEN + 4, hashsize) ||
+        !exclude_file_unchanged(excludes_file, hdr + STAT_DATA_LEN,
+                                hdr + 2 * STAT_DATA_LEN + 4 + hashsize,
+                                hashsize)) {
+        debug("untracked cache: global excludes changed");
+        goto done;
+    }
+    if ((cache.exclude_per_dir = read_string(&cache)) == NULL ||
+        !read_number(&cache, &ndirs))
+        goto done;
+    if (ndirs == 0) {
+        debug("untracked cache is empty");
+        goto done;
+    }
+
+    cache.maxdirs = ndirs;
+    cache.dirs = calloc(ndirs, sizeof(ucdir_t));
+    if (cache.dirs == NULL || !read_dir_block(&cache, 0) ||
+        cache.ndirs != ndirs)
+        goto done;
+
+    /* bitmaps: valid (has stat data), check_only, has exclude hash */
+    if ((n = read_ewah(cache.pos, cache.end, &valid, &nvalid)) == 0)
+        goto done;
+    cache.pos += n;
+    if ((n = read_ewah(cache.pos, cache.end, &check_only, &ncheck_only)) == 0)
+        goto done;
+    cache.pos += n;
+    if ((n = read_ewah(cache.pos, cache.end, &oid_valid, &noid_valid)) == 0)
+        goto done;
+    cache.pos += n;
+
+    for (i = 0; i < ndirs && i < nvalid; i++) {
+        if (BITMAP_TEST(valid, i)) {
+            if (cache.end - cache.pos < STAT_DATA_LEN)
+                goto done;
+            cache.dirs[i].stat = cache.pos;
+            cache.pos += STAT_DATA_LEN;
+        }
+    }
+    for (i = 0; i < ndirs && i < noid_valid; i++) {
+        if (BITMAP_TEST(oid_valid, i)) {
+            if (cache.end - cache.pos < hashsize)
+                goto done;
+            cache.dirs[i].exclude_oid = cache.pos;
+            cache.pos += hashsize;
+        }
+    }
+
+    result = check_dirs(&cache);
+    debug("untracked cache: result %d", result);
+
+ done:
+    if (cache.have_paths)
+        free_index_paths(&cache.paths);
+    free(cache.dirs);
+    free(valid);
+    free(check_only);
+    free(oid_valid);
+    return result;
+}
+
+/* Without an untracked cache, walk the working dir: every directory
+ * that is not ignored is read, by up to nthreads threads.  Each thread
+ * has its own deque of directories to read: it pushes the
+ * subdirectories it finds and pops the last one (so it goes depth
+ * first), and when it runs dry it steals the oldest directory from
+ * another thread's deque.  The first untracked file stops them all.
+ */
+
+typedef struct {
+    char *path;                         /* "" or "dir/sub/" */
+    size_t pathlen;
+    const ignore_list_t *ignores;       /* innermost first */
+} walk_dir_t;
+
+typedef struct {
+    walk_dir_t *dirs;
+    size_t head, count, size;           /* dirs[head..count) queued */
+#if HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+} walk_deque_t;
+
+typedef struct {
+    const gitindex_paths_t *paths;
+    const sparse_cone_t *cone;          /* NULL if not sparse */
+    walk_deque_t deques[MAX_WALK_THREADS];
+    int nthreads;
+    int pending;                        /* dirs queued or being read */
+    unsigned int pushes;                /* to spot new work */
+    int result;                         /* 1 found, -1 gave up */
+    ignore_list_t **lists;              /* every .gitignore read */
+    size_t nlists, maxlists;
+#if HAVE_PTHREAD
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+#endif
+} walker_t;
+
+typedef struct {
+    walker_t *walker;
+    int id;
+} walk_thread_t;
+
+static void
+walker_lock(walker_t *walker)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_lock(&walker->lock);
+#endif
+}
+
+static void
+walker_unlock(walker_t *walker)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_unlock(&walker->lock);
+#endif
+}
+
+static void
+deque_lock(walk_deque_t *deque)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_lock(&deque->lock);
+#endif
+}
+
+static void
+deque_unlock(walk_deque_t *deque)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_unlock(&deque->lock);
+#endif
+}
+
+static int
+push_dir(walker_t *walker, int id, const char *path, size_t pathlen,
+         const ignore_list_t *ignores)
+{
+    walk_deque_t *deque = &walker->deques[id];
+    walk_dir_t dir = {strdup(path), pathlen, ignores};
+
+    if (dir.path == NULL)
+        return 0;
+    deque_lock(deque);
+    if (deque->count == deque->size) {
+        /* make room: first by dropping what was stolen */
+        memmove(deque->dirs, deque->dirs + deque->head,
+                (deque->count - deque->head) * sizeof(walk_dir_t));
+        deque->count -= deque->head;
+        deque->head = 0;
+        if (deque->count == deque->size) {
+            size_t size = deque->size ? deque->size * 2 : 64;
+            walk_dir_t *dirs = realloc(deque->dirs, size * sizeof(walk_dir_t));
+            if (dirs == NULL) {
+                deque_unlock(deque);
+                free(dir.path);
+                return 0;
+            }
+            deque->dirs = dirs;
+            deque->size = size;
+        }
+    }
+    deque->dirs[deque->count++] = dir;
+    deque_unlock(deque);
+
+    walker_lock(walker);
+    walker->pending++;
+    walker->pushes++;
+#if HAVE_PTHREAD
+    pthread_cond_signal(&walker->wakeup);
+#endif
+    walker_unlock(walker);
+    return 1;
+}
+
+/* Pop the newest directory of our own deque, or else steal the oldest
+ * one of another; wait if there is none but some are still being read.
+ * Return 0 when the walk is over.
+ */
+static int
+take_dir(walker_t *walker, int id, walk_dir_t *dir)
+{
+    while (1) {
+        walker_lock(walker);
+        unsigned int pushes = walker->pushes;
+        int over = walker->result != 0 || walker->pending == 0;
+        walker_unlock(walker);
+        if (over)
+            return 0;
+
+        for (int i = 0; i < walker->nthreads; i++) {
+            walk_deque_t *deque = &walker->deques[(id + i) % walker->nthreads];
+            int found = 0;
+            deque_lock(deque);
+            if (deque->head < deque->count) {
+                if (i == 0)
+                    *dir = deque->dirs[--deque->count];
+                else
+                    *dir = deque->dirs[deque->head++];
+                found = 1;
+            }
+            deque_unlock(deque);
+            if (found)
+                return 1;
+        }
+
+#if HAVE_PTHREAD
+        walker_lock(walker);
+        if (walker->pushes == pushes && walker->result == 0 &&
+            walker->pending > 0)
+            pthread_cond_wait(&walker->wakeup, &walker->lock);
+        walker_unlock(walker);
+#else
+        (void) pushes;
+#endif
+    }
+}
+
+static void
+finish_dir(walker_t *walker, int result)
+{
+    walker_lock(walker);
+    walker->pending--;
+    if (result > 0 || (result < 0 && walker->result == 0))
+        walker->result = result;
+#if HAVE_PTHREAD
+    if (walker->pending == 0 || walker->result != 0)
+        pthread_cond_broadcast(&walker->wakeup);
+#endif
+    walker_unlock(walker);
+}
+
+/* Read one directory: queue its subdirectories that are not ignored,
+ * and return 1 if it has an untracked file that is not ignored.
+ */
+static int
+walk_one_dir(walker_t *walker, int id, walk_dir_t *dir)
+{
+    const ignore_list_t *ignores = dir->ignores;
+    char path[PATH_MAX];
+    struct dirent *dirent;
+    struct stat statbuf;
+    DIR *dirp;
+    size_t pathlen = dir->pathlen;
+    int result = 0, nread = 0;
+
+    memcpy(path, dir->path, pathlen + 1);
+    if (pathlen + sizeof(".gitignore") > sizeof(path))
+        return -1;
+    strcpy(path + pathlen, ".gitignore");
+    ignore_list_t *list = read_ignore_list(path, dir->path, pathlen, ignores);
+    path[pathlen] = '\0';
+    if (list != NULL) {
+        walker_lock(walker);
+        if (walker->nlists == walker->maxlists) {
+            size_t max = walker->maxlists ? walker->maxlists * 2 : 16;
+            ignore_list_t **lists = realloc(walker->lists,
+                                            max * sizeof(ignore_list_t *));
+            if (lists != NULL) {
+                walker->lists = lists;
+                walker->maxlists = max;
+            }
+        }
+        if (walker->nlists < walker->maxlists)
+            walker->lists[walker->nlists++] = list;
+        else {
+            free_ignore_list(list);
+            result = -1;
+        }
+        walker_unlock(walker);
+        if (result < 0)
+            return -1;
+        ignores = list;
+    }
+
+    dirp = opendir(pathlen ? path : ".");
+    if (dirp == NULL) {
+        debug("walk: cannot read '%s': %s", path, strerror(errno));
+        return -1;
+    }
+    while (result == 0 && (dirent = readdir(dirp)) != NULL) {
+        const char *name = dirent->d_name;
+        size_t namelen = strlen(name);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            (pathlen == 0 && strcmp(name, ".git") == 0))
+            continue;
+        if (++nread % 256 == 0) {
+            walker_lock(walker);
+            int over = walker->result != 0;
+            walker_unlock(walker);
+            if (over)
+                break;
+        }
+        if (pathlen + namelen + 2 > sizeof(path)) {
+            result = -1;
+            break;
+        }
+        memcpy(path + pathlen, name, namelen + 1);
+        if (find_index_path(walker->paths, path) != NULL)
+            continue;           /* tracked file, or submodule */
+        if (lstat(path, &statbuf) < 0) {
+            result = -1;
+            break;
+        }
+        int isdir = S_ISDIR(statbuf.st_mode);
+        if (!isdir && !S_ISREG(statbuf.st_mode) && !S_ISLNK(statbuf.st_mode))
+            continue;           /* git does not track sockets etc. */
+        if (is_ignored(ignores, path, pathlen + namelen, isdir))
+            continue;
+        if (!isdir) {
+            debug("walk: '%s' is untracked", path);
+            result = 1;
+        }
+        else {
+            /* an untracked dir only counts if it has an untracked file
+             * in it, or is another repository */
+            size_t len = pathlen + namelen;
+            strcpy(path + len, "/");
+            if (walker->cone != NULL &&
+                !in_sparse_cone(walker->cone, path, len + 1)) {
+                debug("walk: '%s' is outside the sparse checkout", path);
+                continue;
+            }
+            if (!index_has_dir(walker->paths, path)) {
+                strcpy(path + len, "/.git");
+                int repo = (lstat(path, &statbuf) == 0);
+                path[len + 1] = '\0';
+                if (repo) {
+                    debug("walk: '%s' is an untracked repository", path);
+                    result = 1;
+                    break;
+                }
+            }
+            if (!push_dir(walker, id, path, len + 1, ignores))
+                result = -1;
+        }
+    }
+    closedir(dirp);
+    return result;
+}
+
+static void *
+walk_worker(void *arg)
+{
+    walk_thread_t *self = arg;
+    walker_t *walker = self->walker;
+    walk_dir_t dir;
+
+    while (take_dir(walker, self->id, &dir)) {
+        int result = walk_one_dir(walker, self->id, &dir);
+        free(dir.path);
+        finish_dir(walker, result);
+    }
+    return NULL;
+}
+
+static int
+parallel_walk(const gitindex_t *index, const sparse_cone_t *cone,
+              const ignore_list_t *ignores, int nthreads)
+{
+    walk_thread_t threads[MAX_WALK_THREADS];
+    gitindex_paths_t paths;
+    walker_t walker;
+
+    if (!load_index_paths(index, &paths))
+        return -1;
+    if (nthreads > MAX_WALK_THREADS)
+        nthreads = MAX_WALK_THREADS;
+    memset(&walker, 0, sizeof(walker));
+    walker.paths = &paths;
+    walker.cone = cone;
+    walker.nthreads = nthreads;
+    for (int i = 0; i < nthreads; i++) {
+        threads[i].walker = &walker;
+        threads[i].id = i;
+    }
+#if HAVE_PTHREAD
+    pthread_mutex_init(&walker.lock, NULL);
+    pthread_cond_init(&walker.wakeup, NULL);
+    for (int i = 0; i < nthreads; i++)
+        pthread_mutex_init(&walker.deques[i].lock, NULL);
+#endif
+
+    if (!push_dir(&walker, 0, "", 0, ignores))
+        walker.result = -1;
+#if HAVE_PTHREAD
+    pthread_t tids[MAX_WALK_THREADS];
+    int nstarted = 0;
+
+    debug("walking the working dir with %d threads", nthreads);
+    for (int i = 1; i < nthreads; i++) {
+        if (pthread_create(&tids[i], NULL, walk_worker, &threads[i]) != 0)
+            break;
+        nstarted++;
+    }
+    walk_worker(&threads[0]);
+    for (int i = 1; i <= nstarted; i++)
+        pthread_join(tids[i], NULL);
+#else
+    walk_worker(&threads[0]);
+#endif
+
+    /* anything left over after an early stop */
+    for (int i = 0; i < nthreads; i++) {
+        walk_deque_t *deque = &walker.deques[i];
+        for (size_t j = deque->head; j < deque->count; j++)
+            free(deque->dirs[j].path);
+        free(deque->dirs);
+#if HAVE_PTHREAD
+        pthread_mutex_destroy(&deque->lock);
+#endif
+    }
+#if HAVE_PTHREAD
+    pthread_mutex_destroy(&walker.lock);
+    pthread_cond_destroy(&walker.wakeup);
+#endif
+    for (size_t i = 0; i < walker.nlists; i++)
+        free_ignore_list(walker.lists[i]);
+    free(walker.lists);
+    free_index_paths(&paths);
+    return walker.result;
+}
+
+/* In one thread, the walk needs no table of tracked paths: index
+ * entries are sorted by path, so each directory's listing, sorted the
+ * same way, is merge-joined against the index entries under it with a
+ * single cursor that only ever moves forward.  Memory is what the
+ * directories on the current path take, whatever the size of the
+ * index.
+ */
+
+typedef struct {
+    gitindex_cursor_t cursor;
+    int status;                         /* last next_index_entry() */
+    const sparse_cone_t *cone;          /* NULL if not sparse */
+    char path[PATH_MAX];
+} stream_walk_t;
+
+/* A directory listing entry: dirs get a trailing "/", so that listings
+ * sort like index paths do ("a.c" < "a/" < "a0"). */
+typedef struct {
+    char *name;
+    size_t len;
+    int isdir;
+} listing_entry_t;
+
+static int
+compare_listing(const void *a, const void *b)
+{
+    return strcmp(((const listing_entry_t *) a)->name,
+                  ((const listing_entry_t *) b)->name);
+}
+
+/* Read and sort the directory walk->path (pathlen bytes). */
+static int
+read_listing(stream_walk_t *walk, size_t pathlen,
+             listing_entry_t **listing, size_t *count)
+{
+    struct dirent *dirent;
+    struct stat statbuf;
+    size_t size = 0;
+    DIR *dirp;
+
+    *listing = NULL;
+    *count = 0;
+    dirp = opendir(pathlen ? walk->path : ".");
+    if (dirp == NULL) {
+        debug("walk: cannot read '%s': %s", walk->path, strerror(errno));
+        return 0;
+    }
+    while ((dirent = readdir(dirp)) != NULL) {
+        const char *name = dirent->d_name;
+        size_t namelen = strlen(name);
+        int isdir;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            (pathlen == 0 && strcmp(name, ".git") == 0))
+            continue;
+        if (pathlen + namelen + 2 > sizeof(walk->path))
+            goto err;
+#ifdef DT_DIR
+        if (dirent->d_type == DT_DIR)
+            isdir = 1;
+        else if (dirent->d_type == DT_REG || dirent->d_type == DT_LNK)
+            isdir = 0;
+        else if (dirent->d_type != DT_UNKNOWN)
+            continue;           /* git does not track sockets etc. */
+        else
+#endif
+        {
+            memcpy(walk->path + pathlen, name, namelen + 1);
+            if (lstat(walk->path, &statbuf) < 0)
+                goto err;
+            isdir = S_ISDIR(statbuf.st_mode);
+            if (!isdir && !S_ISREG(statbuf.st_mode) &&
+                !S_ISLNK(statbuf.st_mode))
+                continue;
+        }
+
+        if (*count == size) {
+            size = size ? size * 2 : 32;
+            listing_entry_t *more = realloc(*listing,
+                                            size * sizeof(listing_entry_t));
+            if (more == NULL)
+                goto err;
+            *listing = more;
+        }
+        listing_entry_t *entry = &(*listing)[*count];
+        entry->len = namelen + isdir;
+        entry->isdir = isdir;
+        if ((entry->name = malloc(entry->len + 1)) == NULL)
+            goto err;
+        memcpy(entry->name, name, namelen);
+        strcpy(entry->name + namelen, isdir ? "/" : "");
+        (*count)++;
+    }
+    closedir(dirp);
+    walk->path[pathlen] = '\0';
+    qsort(*listing, *count, sizeof(listing_entry_t), compare_listing);
+    return 1;
+
+ err:
+    closedir(dirp);
+    walk->path[pathlen] = '\0';
+    return 0;
+}
+
+static void
+free_listing(listing_entry_t *listing, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(listing[i].name);
+    free(listing);
+}
+
+/* Merge-join the directory walk->path (pathlen bytes, ending with "/"
+ * unless it is the top) against the index entries from the cursor on,
+ * recursing into subdirectories that are not ignored.  Return 1 at the
+ * first untracked file, 0 if there is none, -1 on error.
+ */
+static int
+stream_dir(stream_walk_t *walk, size_t pathlen, const ignore_list_t *ignores,
+           int depth)
+{
+    const gitindex_entry_t *entry = &walk->cursor.entry;
+    char *path = walk->path;
+    listing_entry_t *listing;
+    size_t count;
+    char **gitlinks = NULL;             /* submodules passed so far */
+    size_t ngitlinks = 0;
+    struct stat statbuf;
+    int result = 0;
+
+    if (depth > PATH_MAX / 2 || pathlen + sizeof(".gitignore") > PATH_MAX)
+        return -1;
+    strcpy(path + pathlen, ".gitignore");
+    ignore_list_t *list = read_ignore_list(path, path, pathlen, ignores);
+    path[pathlen] = '\0';
+    if (list != NULL)
+        ignores = list;
+    if (!read_listing(walk, pathlen, &listing, &count)) {
+        free_ignore_list(list);
+        return -1;
+    }
+
+    for (size_t i = 0; i < count && result == 0; i++) {
+        const listing_entry_t *item = &listing[i];
+        size_t len = pathlen + item->len;
+        memcpy(path + pathlen, item->name, item->len + 1);
+
+        /* skip index entries before this one: files deleted from the
+         * working dir, and submodules (sorted as "sub", not "sub/") */
+        while (walk->status > 0 && strcmp(entry->path, path) < 0) {
+            if ((entry->mode & GIT_MODE_TYPE) == GIT_MODE_GITLINK &&
+                strncmp(entry->path, path, pathlen) == 0 &&
+                strchr(entry->path + pathlen, '/') == NULL) {
+                char **more = realloc(gitlinks,
+                                      (ngitlinks + 1) * sizeof(char *));
+                if (more == NULL)
+                    break;
+                gitlinks = more;
+                gitlinks[ngitlinks] = strdup(entry->path + pathlen);
+                if (gitlinks[ngitlinks] == NULL)
+                    break;
+                ngitlinks++;
+            }
+            walk->status = next_index_entry(&walk->cursor);
+        }
+        if (walk->status < 0 ||
+            (walk->status > 0 && strcmp(entry->path, path) < 0)) {
+            result = -1;        /* corrupt index, or out of memory */
+            break;
+        }
+
+        if (walk->status > 0 && strcmp(entry->path, path) == 0) {
+            /* tracked file (or sparse directory entry) */
+            walk->status = next_index_entry(&walk->cursor);
+            continue;
+        }
+        if (!item->isdir) {
+            if (!is_ignored(ignores, path, len, 0)) {
+                debug("walk: '%s' is untracked", path);
+                result = 1;
+            }
+            continue;
+        }
+
+        int tracked = (walk->status > 0 &&
+                       strncmp(entry->path, path, len) == 0);
+        path[len - 1] = '\0';
+        if (!tracked) {
+            for (size_t j = 0; j < ngitlinks; j++) {
+                if (strcmp(gitlinks[j], path + pathlen) == 0)
+                    tracked = -1;       /* a submodule: not ours */
+            }
+        }
+        if (tracked < 0 || is_ignored(ignores, path, len - 1, 1))
+            continue;
+        if (!tracked) {
+            strcpy(path + len - 1, "/.git");
+            int repo = (lstat(path, &statbuf) == 0);
+            path[len - 1] = '\0';
+            if (repo) {
+                debug("walk: '%s' is an untracked repository", path);
+                result = 1;
+                break;
+            }
+        }
+        path[len - 1] = '/';
+        path[len] = '\0';
+        if (walk->cone != NULL && !in_sparse_cone(walk->cone, path, len)) {
+            debug("walk: '%s' is outside the sparse checkout", path);
+            continue;
+        }
+        result = stream_dir(walk, len, ignores, depth + 1);
+    }
+
+    for (size_t j = 0; j < ngitlinks; j++)
+        free(gitlinks[j]);
+    free(gitlinks);
+    free_listing(listing, count);
+    free_ignore_list(list);
+    path[pathlen] = '\0';
+    return result;
+}
+
+static int
+stream_walk(const gitindex_t *index, const sparse_cone_t *cone,
+            const ignore_list_t *ignores)
+{
+    stream_walk_t walk;
+    int result;
+
+    walk.cone = cone;
+    init_index_cursor(&walk.cursor, index);
+    walk.status = next_index_entry(&walk.cursor);
+    walk.path[0] = '\0';
+    result = walk.status < 0 ? -1 : stream_dir(&walk, 0, ignores, 0);
+    free_index_cursor(&walk.cursor);
+    return result;
+}
+
+int
+untracked_walk(const gitindex_t *index, const char *info_exclude,
+               const char *excludes_file, const sparse_cone_t *cone,
+               int nthreads)
+{
+    ignore_list_t *global = NULL, *exclude = NULL;
+    int result;
+
+    if (excludes_file != NULL)
+        global = read_ignore_list(excludes_file, "", 0, NULL);
+    exclude = read_ignore_list(info_exclude, "", 0, global);
+
+#if !HAVE_PTHREAD
+    nthreads = 1;
+#endif
+    if (nthreads > 1)
+        result = parallel_walk(index, cone,
+                               exclude != NULL ? exclude : global, nthreads);
+    else {
+        debug("walking the working dir in index order");
+        result = stream_walk(index, cone, exclude != NULL ? exclude : global);
+    }
+
+    free_ignore_list(exclude);
+    free_ignore_list(global);
+    debug("walk: result %d", result);
+    return result;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITUNTRACKED_H
+#define GITUNTRACKED_H
+
+#include "gitindex.h"
+#include "gitsparse.h"
+
+/* Decide whether the working dir has untracked files using the
+ * untracked cache that git keeps in the UNTR extension of the index
+ * (see "git update-index --untracked-cache").  Directories whose stat
+ * data still matches the cache are answered from it; only the ones
+ * that changed are read again.  info_exclude is the path of
+ * .git/info/exclude, and excludes_file that of core.excludesFile (NULL
+ * if none).
+ *
+ * Return 1 if there are untracked files, 0 if not, -1 if the cache is
+ * missing, stale or inconclusive, in which case caller should ask git.
+ */
+int
+untracked_cache_check(const gitindex_t *index, const char *info_exclude,
+                      const char *excludes_file);
+
+#define MAX_WALK_THREADS 16
+
+/* Decide whether the working dir has untracked files without the
+ * untracked cache: read every directory that is not ignored, with up to
+ * nthreads threads, and stop at the first untracked file that is not
+ * ignored by .gitignore, info_exclude or excludes_file.  With a
+ * cone-mode sparse checkout (cone not NULL), directories outside the
+ * cone are not read at all.
+ *
+ * Return 1 if there are untracked files, 0 if not, -1 if some
+ * directory could not be read, in which case caller should ask git.
+ */
+int
+untracked_walk(const gitindex_t *index, const char *info_exclude,
+               const char *excludes_file, const sparse_cone_t *cone,
+               int nthreads);
+
+#endif
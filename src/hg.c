@@ -7,7 +7,9 @@
  * (at your option) any later version.
  */
 
+#include <dirent.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,15 +17,14 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
-#if defined __BEOS__ && !defined __HAIKU__
-#include <ByteOrder.h>
-#else
-#include <arpa/inet.h>
-#endif
-
 #include "capture.h"
 #include "common.h"
 #include "hg.h"
+#include "hgbranchmap.h"
+#include "hgdirstate.h"
+#include "hgignore.h"
+#include "hgrc.h"
+#include "hgrevlog.h"
 
 #define NODEID_LEN 20
 
@@ -45,105 +46,30 @@ non_zero(const unsigned char *data, int size)
     return 0;
 }
 
-static int
-is_revlog_inlined(FILE *rlfile)
-{
-    const unsigned int REVLOGNGINLINEDATA = 1 << 16;
-    int revlog_ver;
-    size_t origpos, rlen;
-
-    origpos = ftell(rlfile);
-    rlen = fread(&revlog_ver, sizeof(revlog_ver), 1, rlfile);
-    fseek(rlfile, origpos, SEEK_SET);
-
-    revlog_ver = ntohl(revlog_ver);
-    return (rlen == 1) ? revlog_ver & REVLOGNGINLINEDATA : 0;
-}
-
-typedef struct {
-    char nodeid[NODEID_LEN];
-    int rev;
-    int istip;
-} csinfo_t;
-
-//! get changeset info for the specified nodeid
-static csinfo_t
-get_csinfo(const char *nodeid)
-{
-    // only supports RevlogNG. See mercurial/parsers.c for details.
-    const char *REVLOG_FILENAME = ".hg/store/00changelog.i";
-    const size_t ENTRY_LEN = 64, COMP_LEN_OFS = 8, NODEID_OFS = 32;
-
-    char buf[ENTRY_LEN];
-    FILE *rlfile;
-    int inlined;
-    csinfo_t csinfo = {"", -1, 0};
-    int i;
-
-    rlfile = fopen(REVLOG_FILENAME, "rb");
-    if (!rlfile) {
-        debug("error opening '%s': %s", REVLOG_FILENAME, strerror(errno));
-        return csinfo;
-    }
-
-    inlined = is_revlog_inlined(rlfile);
-
-    for (i = 0; !feof(rlfile); ++i) {
-        size_t comp_len, rlen;
-
-        rlen = fread(buf, 1, ENTRY_LEN, rlfile);
-        if (rlen == 0) break;
-        if (rlen != ENTRY_LEN) {
-            debug("error while reading '%s': incomplete entry (read = %d)",
-                  REVLOG_FILENAME, rlen);
-            break;
-        }
-
-        // already found node but it's not the last one
-        if (csinfo.rev >= 0) {
-            csinfo.istip = 0;
-            break;
-        }
-
-        comp_len = ntohl(*((uint32_t *) (buf + COMP_LEN_OFS)));
-        if (memcmp(nodeid, buf + NODEID_OFS, NODEID_LEN) == 0) {
-            memcpy(csinfo.nodeid, buf + NODEID_OFS, NODEID_LEN);
-            csinfo.rev = i;  // FIXME
-            csinfo.istip = 1;
-        }
-
-        if (inlined) fseek(rlfile, comp_len, SEEK_CUR);
-    }
-
-    fclose(rlfile);
-    return csinfo;
-}
-
+/* Write the revision number of nodeid, or a short hex changeset ID if
+ * the changelog does not have it, to dest.
+ */
 static size_t
-put_nodeid(char *dest, const char *nodeid)
+put_nodeid(char *dest, const char *nodeid, const hgrevlog_t *changelog)
 {
     const size_t SHORT_NODEID_LEN = 6;  // size in binary repr
-    char *p = dest;
+    uint32_t rev;
 
-    csinfo_t csinfo = get_csinfo(nodeid);
-    if (csinfo.rev >= 0) {
-        p += sprintf(p, "%d", csinfo.rev);
-    }
-    else {
-        dump_hex(p, nodeid, SHORT_NODEID_LEN);
-        p += SHORT_NODEID_LEN * 2;
-    }
-    return p - dest;
+    if (changelog != NULL &&
+        find_revlog_node(changelog, (const unsigned char *) nodeid, &rev))
+        return sprintf(dest, "%u", rev);
+    dump_hex(dest, nodeid, SHORT_NODEID_LEN);
+    return SHORT_NODEID_LEN * 2;
 }
 
 static void
-read_parents(vccontext_t *context, result_t *result)
+read_parents(vccontext_t *context, result_t *result,
+             const hgrevlog_t *changelog)
 {
     if (!context->options->show_revision && !context->options->show_patch)
         return;
 
     char *parent_nodes;         /* two binary changeset IDs */
-    size_t readsize;
 
     parent_nodes = malloc(NODEID_LEN * 2);
     if (!parent_nodes) {
@@ -152,31 +78,58 @@ read_parents(vccontext_t *context, result_t *result)
     }
     result->full_revision = parent_nodes;
 
-    debug("reading first %d bytes of dirstate to parent_nodes (%p)",
-          NODEID_LEN * 2, parent_nodes);
-    readsize = read_file(".hg/dirstate", parent_nodes, NODEID_LEN * 2);
-    if (readsize != NODEID_LEN * 2) {
+    debug("reading parents from dirstate to parent_nodes (%p)",
+          parent_nodes);
+    if (!read_hg_parents(".hg", (unsigned char *) parent_nodes)) {
         return;
     }
 
-    readsize = read_file(".hg/dirstate", parent_nodes, NODEID_LEN * 2);
     char destbuf[1024] = {'\0'};
     char *p = destbuf;
 
     // first parent
     if (non_zero((unsigned char *) parent_nodes, NODEID_LEN)) {
-        p += put_nodeid(p, parent_nodes);
+        p += put_nodeid(p, parent_nodes, changelog);
     }
 
     // second parent
     if (non_zero((unsigned char *) parent_nodes + NODEID_LEN, NODEID_LEN)) {
         *p++ = ',';
-        p += put_nodeid(p, parent_nodes + NODEID_LEN);
+        p += put_nodeid(p, parent_nodes + NODEID_LEN, changelog);
     }
 
     result_set_revision(result, destbuf, -1);
 }
 
+/* Count the heads of the working dir's branch, from the branch cache
+ * rather than the changelog, which would take reading every revision's
+ * parents.
+ */
+static void
+read_heads(vccontext_t *context, result_t *result,
+           const hgrevlog_t *changelog)
+{
+    if (!context->options->show_heads)
+        return;
+
+    unsigned char parent_nodes[NODEID_LEN * 2];
+    char branch[1024];
+
+    if (!read_hg_parents(".hg", parent_nodes) ||
+        !non_zero(parent_nodes, NODEID_LEN)) {
+        debug("no parent: not counting heads");
+        return;
+    }
+    if (changelog == NULL) {
+        result->heads = -1;
+        return;
+    }
+    if (!read_first_line(".hg/branch", branch, sizeof(branch)))
+        strcpy(branch, "default");
+    result->heads = read_hg_branch_heads(".hg", changelog, branch,
+                                         parent_nodes, &result->at_head);
+}
+
 static void
 read_patch_name(vccontext_t *context, result_t *result)
 {
@@ -241,6 +194,31 @@ read_patch_name(vccontext_t *context, result_t *result)
     free(last_line);
 }
 
+typedef struct {
+    vccontext_t *context;
+    result_t *result;
+} status_lines_t;
+
+/* line callback for "hg status": stop reading as soon as everything we
+ * need to know is known */
+static int
+read_status_line(char *line, size_t len, void *data)
+{
+    status_lines_t *lines = data;
+    options_t *options = lines->context->options;
+
+    // look for ?, M, etc.
+    if (options->show_unknown && line[0] == '?') {
+        lines->result->unknown = 1;
+    }
+    if (options->show_modified &&
+        (line[0] == 'M' || line[0] == 'A' || line[0] == 'R')) {
+        lines->result->modified = 1;
+    }
+    return ((!options->show_modified || lines->result->modified) &&
+            (!options->show_unknown || lines->result->unknown));
+}
+
 static void
 read_modified_unknown(vccontext_t *context, result_t *result)
 {
@@ -258,27 +236,208 @@ read_modified_unknown(vccontext_t *context, result_t *result)
         // skip it unless the user wants it
         argv[6] = NULL;
     }
-    capture_t *capture = capture_child("hg", argv);
+    status_lines_t lines = {context, result};
+    capture_t *capture = capture_child_lines("hg", argv,
+                                             read_status_line, &lines);
     if (capture == NULL) {
         debug("unable to execute 'hg status'");
         return;
     }
-    char *cstdout = capture->childout.buf;
-    for (char *ch = cstdout; *ch != 0; ch++) {
-        if (ch == cstdout || *(ch-1) == '\n') {
-            // at start of output or start of line: look for ?, M, etc.
-            if (context->options->show_unknown && *ch == '?') {
-                result->unknown = 1;
-            }
-            if (context->options->show_modified &&
-                (*ch == 'M' || *ch == 'A' || *ch == 'R')) {
-                result->modified = 1;
-            }
+    free_capture(capture);
+}
+
+/* Compare each tracked file with what the dirstate says about it, the
+ * way vcprompt-hgst did, and stop at the first change.  Added, removed
+ * and merged files count as changes, missing ones do not ("hg status"
+ * reports them as "!"); so does a file whose mtime Mercurial could not
+ * trust when it wrote the dirstate, since only its content could tell.
+ */
+static int
+dirstate_modified(const hgdirstate_t *dirstate)
+{
+    struct stat statbuf;
+    char path[PATH_MAX];
+
+    for (size_t i = 0; i < dirstate->count; i++) {
+        const dirstate_entry_t *entry = &dirstate->entries[i];
+        if (entry->pathlen >= sizeof(path))
+            return 1;
+        memcpy(path, entry->path, entry->pathlen);
+        path[entry->pathlen] = '\0';
+        if (entry->state != 'r' && lstat(path, &statbuf) < 0)
+            continue;
+        if (entry->state == 'r' || dirstate_entry_changed(entry, &statbuf)) {
+            debug("dirstate: '%s' has changed (state '%c')",
+                  path, entry->state);
+            return 1;
         }
     }
+    return 0;
+}
 
-    cstdout = NULL;
-    free_capture(capture);
+typedef struct {
+    const hgdirstate_t *dirstate;
+    hgignore_t *ignore;
+    int use_mtimes;                     /* trust cached directory mtimes */
+    char path[PATH_MAX];
+} unknown_walk_t;
+
+static int
+walk_subdir(unknown_walk_t *walk, size_t pathlen, size_t namelen,
+            const struct stat *statbuf);
+
+/* Look for a file that is neither tracked nor ignored in the directory
+ * whose path (ending in "/", or empty for the root) is the first
+ * pathlen bytes of walk->path, and in its subdirectories.  Return 1 if
+ * there is one, 0 if not, -1 if a directory cannot be read.
+ */
+static int
+walk_unknown(unknown_walk_t *walk, size_t pathlen)
+{
+    DIR *dirp;
+    struct dirent *dirent;
+    struct stat statbuf;
+    int result = 0;
+
+    walk->path[pathlen] = '\0';
+    dirp = opendir(pathlen > 0 ? walk->path : ".");
+    if (dirp == NULL) {
+        debug("walk: cannot read '%s': %s", walk->path, strerror(errno));
+        return errno == ENOENT ? 0 : -1;
+    }
+    while (result == 0 && (dirent = readdir(dirp)) != NULL) {
+        const char *name = dirent->d_name;
+        size_t namelen = strlen(name);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            (pathlen == 0 && strcmp(name, ".hg") == 0))
+            continue;
+        if (pathlen + namelen + 5 > sizeof(walk->path)) {
+            result = -1;
+            break;
+        }
+        memcpy(walk->path + pathlen, name, namelen + 1);
+        if (find_dirstate_entry(walk->dirstate,
+                                walk->path, pathlen + namelen) != NULL ||
+            hg_ignored(walk->ignore, walk->path))
+            continue;
+        if (lstat(walk->path, &statbuf) < 0) {
+            result = -1;
+            break;
+        }
+        if (S_ISDIR(statbuf.st_mode))
+            result = walk_subdir(walk, pathlen, namelen, &statbuf);
+        else if (S_ISREG(statbuf.st_mode) || S_ISLNK(statbuf.st_mode)) {
+            debug("walk: '%s' is unknown", walk->path);
+            result = 1;
+        }
+    }
+    closedir(dirp);
+    return result;
+}
+
+/* Like walk_unknown(), for a directory that has not changed since hg
+ * last listed it and found nothing unknown: there is no need to read
+ * it, only to walk the subdirectories the dirstate knows about.
+ */
+static int
+walk_known_subdirs(unknown_walk_t *walk, size_t pathlen)
+{
+    const hgdirstate_t *dirstate = walk->dirstate;
+    struct stat statbuf;
+    int result = 0;
+
+    for (size_t i = find_dirstate_dirs(dirstate, walk->path, pathlen);
+         result == 0 && i < dirstate->ndirs; i++) {
+        const dirstate_dir_t *dir = &dirstate->dirs[i];
+        if (dir->pathlen < pathlen ||
+            memcmp(dir->path, walk->path, pathlen) != 0)
+            break;
+        size_t namelen = dir->pathlen - pathlen;
+        if (namelen == 0 ||
+            memchr(dir->path + pathlen, '/', namelen) != NULL)
+            continue;                   /* not a child */
+        if (pathlen + namelen + 5 > sizeof(walk->path))
+            return -1;
+        memcpy(walk->path + pathlen, dir->path + pathlen, namelen);
+        walk->path[pathlen + namelen] = '\0';
+        if (hg_ignored(walk->ignore, walk->path) ||
+            lstat(walk->path, &statbuf) < 0 || !S_ISDIR(statbuf.st_mode))
+            continue;
+        result = walk_subdir(walk, pathlen, namelen, &statbuf);
+    }
+    return result;
+}
+
+/* Walk the subdirectory whose name (namelen bytes) follows the pathlen
+ * bytes of its parent in walk->path, and which statbuf describes,
+ * unless it is a nested repository: hg skips those.  With use_mtimes,
+ * only read it if it changed since hg cached its mtime.
+ */
+static int
+walk_subdir(unknown_walk_t *walk, size_t pathlen, size_t namelen,
+            const struct stat *statbuf)
+{
+    const hgdirstate_t *dirstate = walk->dirstate;
+    size_t dirlen = pathlen + namelen;
+
+    strcpy(walk->path + dirlen, "/.hg");
+    if (isdir(walk->path))
+        return 0;
+    walk->path[dirlen] = '/';
+    walk->path[dirlen + 1] = '\0';
+    if (walk->use_mtimes) {
+        size_t i = find_dirstate_dirs(dirstate, walk->path, dirlen);
+        if (i < dirstate->ndirs && dirstate->dirs[i].pathlen == dirlen &&
+            dirstate_dir_unchanged(&dirstate->dirs[i], statbuf)) {
+            debug("walk: '%s' has not changed since hg listed it",
+                  walk->path);
+            return walk_known_subdirs(walk, dirlen + 1);
+        }
+    }
+    return walk_unknown(walk, dirlen + 1);
+}
+
+/* Answer %m and %u from .hg/dirstate and the ignore files, without
+ * running anything.  Return 0 if the dirstate cannot be read, or the working
+ * dir cannot be walked, in which case caller should fall back to
+ * vcprompt-hgst.
+ */
+static int
+hg_status(vccontext_t *context, result_t *result)
+{
+    hgdirstate_t *dirstate = read_hg_dirstate(".hg");
+    int ok = 1;
+
+    if (dirstate == NULL)
+        return 0;
+    if (context->options->show_modified)
+        result->modified = dirstate_modified(dirstate);
+    if (context->options->show_unknown) {
+        unknown_walk_t walk;
+        hgrc_t config;
+        read_hgrc(&config);
+        hgignore_t *ignore = read_hg_ignores(&config);
+        free_hgrc(&config);
+        if (ignore == NULL) {
+            free_hg_dirstate(dirstate);
+            return 0;
+        }
+        walk.dirstate = dirstate;
+        walk.ignore = ignore;
+        /* the mtimes are only good for the ignore files hg last used */
+        walk.use_mtimes = dirstate->ndirs > 0 &&
+            hgignore_hash_matches(ignore, dirstate->ignore_hash);
+        debug("walk: %susing cached directory mtimes",
+              walk.use_mtimes ? "" : "not ");
+        int unknown = walk_unknown(&walk, 0);
+        if (unknown >= 0)
+            result->unknown = unknown;
+        else
+            ok = 0;
+        free_hgignore(ignore);
+    }
+    free_hg_dirstate(dirstate);
+    return ok;
 }
 
 static result_t*
@@ -301,11 +460,17 @@ hg_get_info(vccontext_t *context)
         result_set_branch(result, "default");
     }
 
-    read_parents(context, result);
+    hgrevlog_t *changelog = NULL;
+    if (context->options->show_revision || context->options->show_heads)
+        changelog = open_hg_revlog(".hg/store", "00changelog");
+    read_parents(context, result, changelog);
+    read_heads(context, result, changelog);
+    free_hg_revlog(changelog);
     read_patch_name(context, result);
 /*     read_modified_unknown(context, result); */
 
-    if (context->options->show_modified || context->options->show_unknown) {
+    if ((context->options->show_modified || context->options->show_unknown) &&
+        !hg_status(context, result)) {
         int status = system(context->options->show_unknown ? "vcprompt-hgst -u" : "vcprompt-hgst");
         if (WEXITSTATUS(status) <= 3) {
             if (WEXITSTATUS(status) & 1<<0)
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "hgbranchmap.h"
+
+#define NODEID_LEN 20
+#define HEX_LEN (NODEID_LEN * 2)
+
+/* The repo views whose branch caches answer "hg heads": "visible"
+ * hides obsolete changesets, "served" secret ones too, and the latter
+ * is the one Mercurial updates after every transaction.
+ */
+static const char *cache_names[] = {
+    "branch2-visible",
+    "branch2-served",
+    NULL,
+};
+
+/* Return 1 if the file statbuf describes was modified no earlier than
+ * filename, or if there is no such file.
+ */
+static int
+not_older_than(const struct stat *statbuf, const char *filename)
+{
+    struct stat other;
+
+    if (stat(filename, &other) < 0)
+        return 1;
+    if (statbuf->st_mtime != other.st_mtime)
+        return statbuf->st_mtime > other.st_mtime;
+    return ST_MTIME_NSEC(statbuf) >= ST_MTIME_NSEC(&other);
+}
+
+/* Check the first line of a branch cache, "<tip node> <tip rev>
+ * [<hash of filtered revs>]", against changelog.  Revisions committed
+ * since, or a strip, change the tip.  Hiding changesets may not, but it
+ * writes obsstore or phaseroots, which the cache must not be older
+ * than: Mercurial checks the hash of the revisions filtered instead,
+ * which takes working out which ones are.
+ */
+static int
+cache_up_to_date(const char *hgdir, const char *filename,
+                 const struct stat *statbuf, const char *header, size_t len,
+                 const hgrevlog_t *changelog)
+{
+    char buf[32], tiphex[HEX_LEN + 1], path[PATH_MAX];
+    char *end;
+    unsigned long rev;
+    size_t revlen;
+
+    if (len < HEX_LEN + 2 || header[HEX_LEN] != ' ') {
+        debug("'%s': bad header", filename);
+        return 0;
+    }
+    revlen = strcspn(header + HEX_LEN + 1, " \n");
+    if (revlen == 0 || revlen >= sizeof(buf)) {
+        debug("'%s': bad header", filename);
+        return 0;
+    }
+    memcpy(buf, header + HEX_LEN + 1, revlen);
+    buf[revlen] = '\0';
+    rev = strtoul(buf, &end, 10);
+    if (*end != '\0' || rev + 1 != changelog->count) {
+        debug("'%s': tip is rev %s, but the changelog has %u revs",
+              filename, buf, changelog->count);
+        return 0;
+    }
+    dump_hex(tiphex, (const char *) revlog_node(changelog, rev), NODEID_LEN);
+    if (memcmp(header, tiphex, HEX_LEN) != 0) {
+        debug("'%s': tip rev %lu is no longer %.*s",
+              filename, rev, HEX_LEN, header);
+        return 0;
+    }
+
+    snprintf(path, sizeof(path), "%s/store/obsstore", hgdir);
+    if (!not_older_than(statbuf, path)) {
+        debug("'%s' is older than '%s'", filename, path);
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/store/phaseroots", hgdir);
+    if (!not_older_than(statbuf, path)) {
+        debug("'%s' is older than '%s'", filename, path);
+        return 0;
+    }
+    return 1;
+}
+
+/* Count the open heads of branch in one branch cache, after its
+ * header: lines of "<node> <o|c> <branch>", for open or closed heads.
+ */
+static int
+count_heads(const char *start, const char *end, const char *branch,
+            const char *nodehex, int *is_head)
+{
+    size_t branchlen = strlen(branch);
+    int heads = 0;
+
+    while (start < end) {
+        const char *eol = memchr(start, '\n', end - start);
+        if (eol == NULL)
+            eol = end;
+        if (eol - start == (ptrdiff_t) (HEX_LEN + 3 + branchlen) &&
+            start[HEX_LEN] == ' ' && start[HEX_LEN + 2] == ' ' &&
+            memcmp(start + HEX_LEN + 3, branch, branchlen) == 0) {
+            if (start[HEX_LEN + 1] == 'o')
+                heads++;
+            if (memcmp(start, nodehex, HEX_LEN) == 0)
+                *is_head = 1;
+        }
+        start = eol + 1;
+    }
+    return heads;
+}
+
+int
+read_hg_branch_heads(const char *hgdir, const hgrevlog_t *changelog,
+                     const char *branch, const unsigned char *node,
+                     int *is_head)
+{
+    char nodehex[HEX_LEN + 1];
+
+    dump_hex(nodehex, (const char *) node, NODEID_LEN);
+    *is_head = 0;
+    for (const char **name = cache_names; *name != NULL; name++) {
+        char filename[PATH_MAX];
+        struct stat statbuf;
+        const char *data, *eol;
+        int fd, heads = -1;
+
+        snprintf(filename, sizeof(filename), "%s/cache/%s", hgdir, *name);
+        fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            debug("error opening '%s': %s", filename, strerror(errno));
+            continue;
+        }
+        if (fstat(fd, &statbuf) < 0 || statbuf.st_size == 0) {
+            close(fd);
+            continue;
+        }
+        data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            debug("failed to mmap() '%s': %s", filename, strerror(errno));
+            continue;
+        }
+
+        eol = memchr(data, '\n', statbuf.st_size);
+        if (eol != NULL &&
+            cache_up_to_date(hgdir, filename, &statbuf, data, eol - data,
+                             changelog)) {
+            heads = count_heads(eol + 1, data + statbuf.st_size, branch,
+                                nodehex, is_head);
+            debug("'%s': branch '%s' has %d open heads%s", filename,
+                  branch, heads, *is_head ? ", including the parent" : "");
+        }
+        munmap((void *) data, statbuf.st_size);
+        if (heads >= 0)
+            return heads;
+    }
+    return -1;
+}
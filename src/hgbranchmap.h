@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef HGBRANCHMAP_H
+#define HGBRANCHMAP_H
+
+#include "hgrevlog.h"
+
+/* Look up branch in the branch cache of the repository in hgdir
+ * (.hg/cache/branch2-visible, or failing that branch2-served), as long
+ * as it is still valid for changelog: Mercurial writes it along with
+ * the changelog, and only updates it when it next needs it.  Return the
+ * number of open heads of branch, and set *is_head if node (binary) is
+ * one of its heads, open or closed.  Return -1 if there is no cache that
+ * is up to date, which only hg itself can fix.
+ */
+int
+read_hg_branch_heads(const char *hgdir, const hgrevlog_t *changelog,
+                     const char *branch, const unsigned char *node,
+                     int *is_head);
+
+#endif
@@ -0,0 +1,484 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "hgdirstate.h"
+
+/* Mercurial keeps sizes and mtimes in 31 bits */
+#define RANGE_MASK 0x7fffffff
+
+/* v1: state, mode, size, mtime, length */
+#define ENTRY_HEADER_LEN 17
+
+/* v2 docket: marker, parents (32 bytes each, of which a SHA-1 node ID
+ * uses 20), tree metadata, data size, id length, id */
+#define V2_MARKER "dirstate-v2\n"
+#define V2_MARKER_LEN 12
+#define V2_PARENTS 12
+#define V2_PARENT_LEN 32
+#define V2_ROOT_NODES 76
+#define V2_IGNORE_HASH 100
+#define V2_DATA_SIZE 120
+#define V2_ID_LEN 124
+#define V2_ID 125
+
+/* v2 tree node: full path (start, length), base name start, copy
+ * source (start, length), children (start, count), two descendant
+ * counts, flags, size, mtime (seconds, nanoseconds) */
+#define NODE_LEN 44
+#define NODE_PATH 0
+#define NODE_PATH_LEN 4
+#define NODE_CHILDREN 14
+#define NODE_NCHILDREN 18
+#define NODE_FLAGS 30
+#define NODE_SIZE 32
+#define NODE_MTIME_SEC 36
+#define NODE_MTIME_NSEC 40
+
+#define WDIR_TRACKED            (1 << 0)
+#define P1_TRACKED              (1 << 1)
+#define P2_INFO                 (1 << 2)
+#define MODE_EXEC_PERM          (1 << 3)
+#define MODE_IS_SYMLINK         (1 << 4)
+#define EXPECTED_STATE_IS_MODIFIED (1 << 9)
+#define HAS_MODE_AND_SIZE       (1 << 10)
+#define HAS_MTIME               (1 << 11)
+#define MTIME_SECOND_AMBIGUOUS  (1 << 12)
+#define DIRECTORY               (1 << 13)
+#define ALL_UNKNOWN_RECORDED    (1 << 14)
+
+/* deeper than any real working dir, but stops a corrupt (cyclic)
+ * tree */
+#define MAX_TREE_DEPTH 1024
+
+static int
+compare_paths(const char *a, size_t alen, const char *b, size_t blen)
+{
+    int cmp = memcmp(a, b, alen < blen ? alen : blen);
+    if (cmp != 0)
+        return cmp;
+    return (alen > blen) - (alen < blen);
+}
+
+static int
+compare_entries(const void *a, const void *b)
+{
+    const dirstate_entry_t *ea = a, *eb = b;
+    return compare_paths(ea->path, ea->pathlen, eb->path, eb->pathlen);
+}
+
+static int
+compare_dirs(const void *a, const void *b)
+{
+    const dirstate_dir_t *da = a, *db = b;
+    return compare_paths(da->path, da->pathlen, db->path, db->pathlen);
+}
+
+static int
+add_entry(hgdirstate_t *dirstate, size_t *maxentries,
+          const dirstate_entry_t *entry)
+{
+    if (dirstate->count == *maxentries) {
+        *maxentries = *maxentries ? *maxentries * 2 : 256;
+        dirstate_entry_t *entries = realloc(
+            dirstate->entries, *maxentries * sizeof(dirstate_entry_t));
+        if (entries == NULL)
+            return 0;
+        dirstate->entries = entries;
+    }
+    dirstate->entries[dirstate->count++] = *entry;
+    return 1;
+}
+
+static int
+add_dir(hgdirstate_t *dirstate, size_t *maxdirs, const dirstate_dir_t *dir)
+{
+    if (dirstate->ndirs == *maxdirs) {
+        *maxdirs = *maxdirs ? *maxdirs * 2 : 64;
+        dirstate_dir_t *dirs = realloc(
+            dirstate->dirs, *maxdirs * sizeof(dirstate_dir_t));
+        if (dirs == NULL)
+            return 0;
+        dirstate->dirs = dirs;
+    }
+    dirstate->dirs[dirstate->ndirs++] = *dir;
+    return 1;
+}
+
+static int
+read_v1(hgdirstate_t *dirstate, const char *filename)
+{
+    FILE *file;
+    long size;
+    size_t maxentries = 0;
+
+    file = fopen(filename, "rb");
+    if (file == NULL) {
+        debug("error opening '%s': %s", filename, strerror(errno));
+        return 0;
+    }
+    if (fseek(file, 0, SEEK_END) < 0 || (size = ftell(file)) < 0 ||
+        fseek(file, 0, SEEK_SET) < 0 ||
+        (dirstate->buf = malloc(size + 1)) == NULL ||
+        fread(dirstate->buf, 1, size, file) != (size_t) size) {
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+    if (size < 2 * HG_NODEID_LEN)
+        goto corrupt;
+    memcpy(dirstate->parents, dirstate->buf, 2 * HG_NODEID_LEN);
+
+    /* Each path runs up to the next entry's state byte, which becomes
+     * the path's terminating NUL once that entry has been read (the
+     * last path ends at the extra byte at the end of buf).  A copied
+     * file's "\0<copy source>" is cut off the same way. */
+    const unsigned char *p = (unsigned char *) dirstate->buf;
+    const unsigned char *end = p + size;
+    char *lastend = NULL;
+    for (p += 2 * HG_NODEID_LEN; p < end; ) {
+        dirstate_entry_t entry;
+        uint32_t len;
+
+        if (end - p < ENTRY_HEADER_LEN)
+            goto corrupt;
+        entry.state = p[0];
+        entry.mode = get_be32(p + 1);
+        entry.size = (int32_t) get_be32(p + 5);
+        entry.mtime = (int32_t) get_be32(p + 9);
+        entry.mtime_nsec = 0;
+        len = get_be32(p + 13);
+        if (len == 0 || len > (size_t) (end - p - ENTRY_HEADER_LEN))
+            goto corrupt;
+        if (lastend != NULL)
+            *lastend = '\0';
+        entry.path = (const char *) p + ENTRY_HEADER_LEN;
+        lastend = (char *) p + ENTRY_HEADER_LEN + len;
+        entry.pathlen = strnlen(entry.path, len);
+        p += ENTRY_HEADER_LEN + len;
+
+        if (!add_entry(dirstate, &maxentries, &entry))
+            return 0;
+    }
+    if (lastend != NULL)
+        *lastend = '\0';
+    dirstate->version = 1;
+    return 1;
+
+ corrupt:
+    debug("dirstate '%s' is corrupt", filename);
+    return 0;
+}
+
+typedef struct {
+    hgdirstate_t *dirstate;
+    const unsigned char *data;
+    size_t size;
+    size_t maxentries, maxdirs;
+} tree_reader_t;
+
+/* Add the count nodes at offset start, and their descendants, to the
+ * entries and dirs of reader->dirstate.  Return 0 if they run off the
+ * end of the data or out of memory.
+ */
+static int
+read_v2_nodes(tree_reader_t *reader, uint32_t start, uint32_t count,
+              int depth)
+{
+    if (depth > MAX_TREE_DEPTH || start > reader->size ||
+        count > (reader->size - start) / NODE_LEN)
+        return 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const unsigned char *node = reader->data + start + i * NODE_LEN;
+        uint32_t pathstart = get_be32(node + NODE_PATH);
+        unsigned int pathlen = get_be16(node + NODE_PATH_LEN);
+        unsigned int flags = get_be16(node + NODE_FLAGS);
+
+        if (pathstart > reader->size || pathlen > reader->size - pathstart)
+            return 0;
+        const char *path = (const char *) reader->data + pathstart;
+
+        if (flags & (WDIR_TRACKED | P1_TRACKED | P2_INFO)) {
+            dirstate_entry_t entry;
+            int wdir = flags & WDIR_TRACKED, p1 = flags & P1_TRACKED,
+                p2 = flags & P2_INFO;
+
+            /* the same mapping as Mercurial's DirstateEntry::v1_*() */
+            if (!wdir)
+                entry.state = 'r';
+            else if (p1 && p2)
+                entry.state = 'm';
+            else if (!p1 && !p2)
+                entry.state = 'a';
+            else
+                entry.state = 'n';
+            if (flags & MODE_IS_SYMLINK)
+                entry.mode = S_IFLNK | 0777;
+            else
+                entry.mode = S_IFREG | (flags & MODE_EXEC_PERM ? 0755 : 0644);
+            if (p2 && !p1)
+                entry.size = -2;
+            else if ((flags & HAS_MODE_AND_SIZE) &&
+                     !(flags & EXPECTED_STATE_IS_MODIFIED))
+                entry.size = get_be32(node + NODE_SIZE) & RANGE_MASK;
+            else
+                entry.size = -1;
+            if ((flags & HAS_MTIME) && !(flags & MTIME_SECOND_AMBIGUOUS)) {
+                entry.mtime = get_be32(node + NODE_MTIME_SEC) & RANGE_MASK;
+                entry.mtime_nsec = get_be32(node + NODE_MTIME_NSEC);
+            }
+            else {
+                entry.mtime = -1;
+                entry.mtime_nsec = 0;
+            }
+            entry.path = path;
+            entry.pathlen = pathlen;
+            if (!add_entry(reader->dirstate, &reader->maxentries, &entry))
+                return 0;
+        }
+        else {
+            dirstate_dir_t dir;
+
+            dir.path = path;
+            dir.pathlen = pathlen;
+            dir.has_mtime =
+                (flags & (DIRECTORY | HAS_MTIME | ALL_UNKNOWN_RECORDED)) ==
+                (DIRECTORY | HAS_MTIME | ALL_UNKNOWN_RECORDED) &&
+                !(flags & MTIME_SECOND_AMBIGUOUS);
+            dir.mtime_sec = get_be32(node + NODE_MTIME_SEC) & RANGE_MASK;
+            dir.mtime_nsec = get_be32(node + NODE_MTIME_NSEC);
+            if (!add_dir(reader->dirstate, &reader->maxdirs, &dir))
+                return 0;
+        }
+
+        if (!read_v2_nodes(reader, get_be32(node + NODE_CHILDREN),
+                           get_be32(node + NODE_NCHILDREN), depth + 1))
+            return 0;
+    }
+    return 1;
+}
+
+/* Read the docket (already in docket, docketlen bytes long) and the
+ * data file it names. */
+static int
+read_v2(hgdirstate_t *dirstate, const char *hgdir,
+        const unsigned char *docket, size_t docketlen)
+{
+    char filename[PATH_MAX];
+    struct stat statbuf;
+    uint32_t datasize;
+    unsigned int idlen;
+    int fd;
+
+    if (docketlen < V2_ID)
+        return 0;
+    idlen = docket[V2_ID_LEN];
+    if (docketlen < V2_ID + idlen ||
+        snprintf(filename, sizeof(filename), "%s/dirstate.%.*s",
+                 hgdir, (int) idlen, docket + V2_ID) >= (int) sizeof(filename))
+        return 0;
+    memcpy(dirstate->parents, docket + V2_PARENTS, HG_NODEID_LEN);
+    memcpy(dirstate->parents + HG_NODEID_LEN,
+           docket + V2_PARENTS + V2_PARENT_LEN, HG_NODEID_LEN);
+    memcpy(dirstate->ignore_hash, docket + V2_IGNORE_HASH,
+           sizeof(dirstate->ignore_hash));
+    datasize = get_be32(docket + V2_DATA_SIZE);
+    dirstate->version = 2;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        debug("error opening '%s': %s", filename, strerror(errno));
+        return 0;
+    }
+    if (fstat(fd, &statbuf) < 0 || (uint64_t) statbuf.st_size < datasize) {
+        debug("'%s' is shorter than its docket says", filename);
+        close(fd);
+        return 0;
+    }
+    if (datasize > 0) {
+        void *map = mmap(NULL, datasize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            debug("failed to mmap() '%s': %s", filename, strerror(errno));
+            close(fd);
+            return 0;
+        }
+        dirstate->map = map;
+        dirstate->mapsize = datasize;
+    }
+    close(fd);
+
+    /* the data file may have been appended to since the docket was
+     * written: only its first datasize bytes belong to this tree */
+    tree_reader_t reader = {dirstate, dirstate->map, datasize, 0, 0};
+    if (!read_v2_nodes(&reader, get_be32(docket + V2_ROOT_NODES),
+                       get_be32(docket + V2_ROOT_NODES + 4), 0)) {
+        debug("dirstate '%s' is corrupt", filename);
+        return 0;
+    }
+    qsort(dirstate->dirs, dirstate->ndirs, sizeof(dirstate_dir_t),
+          compare_dirs);
+    return 1;
+}
+
+/* Read up to size bytes of hgdir/dirstate into buf: the whole of a
+ * docket, or the parents at the start of a dirstate-v1.  Return the
+ * number of bytes read, or -1.
+ */
+static ssize_t
+read_dirstate_start(const char *hgdir, unsigned char *buf, size_t size)
+{
+    char filename[PATH_MAX];
+    FILE *file;
+    size_t len;
+
+    snprintf(filename, sizeof(filename), "%s/dirstate", hgdir);
+    file = fopen(filename, "rb");
+    if (file == NULL) {
+        debug("error opening '%s': %s", filename, strerror(errno));
+        return -1;
+    }
+    len = fread(buf, 1, size, file);
+    fclose(file);
+    return len;
+}
+
+hgdirstate_t *
+read_hg_dirstate(const char *hgdir)
+{
+    hgdirstate_t *dirstate;
+    unsigned char docket[V2_ID + 256];
+    ssize_t len;
+    int ok;
+
+    len = read_dirstate_start(hgdir, docket, sizeof(docket));
+    if (len < 0)
+        return NULL;
+    dirstate = calloc(1, sizeof(hgdirstate_t));
+    if (dirstate == NULL)
+        return NULL;
+    if (len >= V2_MARKER_LEN && memcmp(docket, V2_MARKER, V2_MARKER_LEN) == 0)
+        ok = read_v2(dirstate, hgdir, docket, len);
+    else {
+        char filename[PATH_MAX];
+        snprintf(filename, sizeof(filename), "%s/dirstate", hgdir);
+        ok = read_v1(dirstate, filename);
+    }
+    if (!ok) {
+        free_hg_dirstate(dirstate);
+        return NULL;
+    }
+
+    /* Mercurial writes v1 entries in no particular order, and v2 keeps
+     * each directory's children sorted by name, not path */
+    qsort(dirstate->entries, dirstate->count, sizeof(dirstate_entry_t),
+          compare_entries);
+    debug("read dirstate-v%d in '%s': %zu entries, %zu directories",
+          dirstate->version, hgdir, dirstate->count, dirstate->ndirs);
+    return dirstate;
+}
+
+void
+free_hg_dirstate(hgdirstate_t *dirstate)
+{
+    if (dirstate == NULL)
+        return;
+    free(dirstate->entries);
+    free(dirstate->dirs);
+    free(dirstate->buf);
+    if (dirstate->map != NULL)
+        munmap(dirstate->map, dirstate->mapsize);
+    free(dirstate);
+}
+
+int
+read_hg_parents(const char *hgdir, unsigned char *parents)
+{
+    unsigned char buf[V2_PARENTS + 2 * V2_PARENT_LEN];
+    ssize_t len;
+
+    len = read_dirstate_start(hgdir, buf, sizeof(buf));
+    if (len >= (ssize_t) sizeof(buf) &&
+        memcmp(buf, V2_MARKER, V2_MARKER_LEN) == 0) {
+        memcpy(parents, buf + V2_PARENTS, HG_NODEID_LEN);
+        memcpy(parents + HG_NODEID_LEN,
+               buf + V2_PARENTS + V2_PARENT_LEN, HG_NODEID_LEN);
+        return 1;
+    }
+    if (len < 2 * HG_NODEID_LEN)
+        return 0;
+    memcpy(parents, buf, 2 * HG_NODEID_LEN);
+    return 1;
+}
+
+const dirstate_entry_t *
+find_dirstate_entry(const hgdirstate_t *dirstate,
+                    const char *path, size_t pathlen)
+{
+    dirstate_entry_t key;
+
+    key.path = path;
+    key.pathlen = pathlen;
+    return bsearch(&key, dirstate->entries, dirstate->count,
+                   sizeof(dirstate_entry_t), compare_entries);
+}
+
+size_t
+find_dirstate_dirs(const hgdirstate_t *dirstate,
+                   const char *prefix, size_t pathlen)
+{
+    size_t lo = 0, hi = dirstate->ndirs;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const dirstate_dir_t *dir = &dirstate->dirs[mid];
+        if (compare_paths(dir->path, dir->pathlen, prefix, pathlen) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int
+dirstate_entry_changed(const dirstate_entry_t *entry,
+                       const struct stat *statbuf)
+{
+    if (entry->state != 'n' || entry->size < 0 || entry->mtime == -1)
+        return 1;
+    if ((entry->mode & S_IFMT) != (statbuf->st_mode & S_IFMT) ||
+        ((entry->mode ^ statbuf->st_mode) & S_IXUSR))
+        return 1;
+    if (entry->mtime_nsec != 0 && ST_MTIME_NSEC(statbuf) != 0 &&
+        entry->mtime_nsec != (unsigned int) ST_MTIME_NSEC(statbuf))
+        return 1;
+    return (entry->size != (int) (statbuf->st_size & RANGE_MASK) ||
+            entry->mtime != (int) (statbuf->st_mtime & RANGE_MASK));
+}
+
+int
+dirstate_dir_unchanged(const dirstate_dir_t *dir, const struct stat *statbuf)
+{
+    uint32_t nsec = ST_MTIME_NSEC(statbuf);
+
+    if (!dir->has_mtime ||
+        dir->mtime_sec != (uint32_t) (statbuf->st_mtime & RANGE_MASK))
+        return 0;
+    return dir->mtime_nsec == 0 || nsec == 0 || dir->mtime_nsec == nsec;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef HGDIRSTATE_H
+#define HGDIRSTATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define HG_NODEID_LEN 20
+
+/* What the dirstate knows about one tracked file. */
+typedef struct {
+    char state;                         /* 'n'ormal, 'a'dded, 'r'emoved
+                                           or 'm'erged */
+    unsigned int mode;
+    int size;                           /* -1: must be compared by
+                                           content, -2: from the other
+                                           parent of a merge */
+    int mtime;                          /* -1: must be compared by
+                                           content */
+    unsigned int mtime_nsec;            /* 0 if not known (v1) */
+    const char *path;                   /* relative to the root; not
+                                           NUL-terminated */
+    size_t pathlen;
+} dirstate_entry_t;
+
+/* A directory in a dirstate-v2 tree.  If it has a cached mtime, all of
+ * its children were tracked or ignored when Mercurial last listed it,
+ * and will be as long as its mtime stays the same.
+ */
+typedef struct {
+    const char *path;                   /* without a trailing slash */
+    size_t pathlen;
+    int has_mtime;
+    uint32_t mtime_sec;                 /* truncated to 31 bits */
+    uint32_t mtime_nsec;
+} dirstate_dir_t;
+
+/* A Mercurial dirstate (.hg/dirstate): the parents of the working dir
+ * and its tracked files, sorted by path and, for dirstate-v2, the
+ * directories of its tree, also sorted.
+ */
+typedef struct {
+    unsigned char parents[2 * HG_NODEID_LEN];
+    dirstate_entry_t *entries;
+    size_t count;
+    dirstate_dir_t *dirs;
+    size_t ndirs;
+    int version;                        /* 1 or 2 */
+    unsigned char ignore_hash[20];      /* v2: of the ignore files when
+                                           the mtimes were cached */
+    char *buf;                          /* v1: the file */
+    void *map;                          /* v2: the data file, mmap()ed */
+    size_t mapsize;
+} hgdirstate_t;
+
+/* Read the dirstate in the .hg directory hgdir.  For dirstate-v1,
+ * .hg/dirstate holds the parents, then for each file
+ *   <state> <mode> <size> <mtime> <length> <path>["\0" <copy source>]
+ * with 32-bit big-endian numbers.  For dirstate-v2, it is a "docket"
+ * naming the data file, .hg/dirstate.<id>, which holds a tree of nodes:
+ * files, with much the same data, and directories.  Return NULL if it
+ * is missing or corrupt; caller must free the result with
+ * free_hg_dirstate().
+ */
+hgdirstate_t *
+read_hg_dirstate(const char *hgdir);
+
+void
+free_hg_dirstate(hgdirstate_t *dirstate);
+
+/* Read just the parents of the working dir from the dirstate in hgdir
+ * (either version) into parents.  Return 1 on success.
+ */
+int
+read_hg_parents(const char *hgdir, unsigned char *parents);
+
+/* Return the entry for path (pathlen bytes), or NULL if it is not
+ * tracked.
+ */
+const dirstate_entry_t *
+find_dirstate_entry(const hgdirstate_t *dirstate,
+                    const char *path, size_t pathlen);
+
+/* Return the index in dirstate->dirs of the first directory whose path
+ * starts with the pathlen bytes of prefix (dirstate->ndirs if none):
+ * the ones that do all follow it.
+ */
+size_t
+find_dirstate_dirs(const hgdirstate_t *dirstate,
+                   const char *prefix, size_t pathlen);
+
+/* Compare entry with statbuf as "hg status" does before it falls back
+ * to comparing content: file type, exec bit, size and mtime, the last
+ * two truncated to 31 bits as Mercurial stores them.  Return 1 if they
+ * differ or the dirstate does not know (added, merged, or a racy mtime),
+ * 0 if they match.
+ */
+int
+dirstate_entry_changed(const dirstate_entry_t *entry,
+                       const struct stat *statbuf);
+
+/* Return 1 if the cached mtime of dir matches statbuf, the way
+ * Mercurial compares them: the nanoseconds only count if both have
+ * them.
+ */
+int
+dirstate_dir_unchanged(const dirstate_dir_t *dir, const struct stat *statbuf);
+
+#endif
@@ -0,0 +1,1195 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <regex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "githash.h"
+#include "hgignore.h"
+
+/* hg gives up on deeper includes, which are probably a loop */
+#define MAX_INCLUDE_DEPTH 10
+
+/* Past this many states, the DFA is thrown away and built again from
+ * scratch: only the states the paths of this working dir reach are
+ * ever built, so this is rare. */
+#define MAX_DFA_STATES 1024
+
+/* Pattern kinds, after the prefix or syntax that names them. */
+enum {
+    KIND_RELRE,                         /* re:, regexp: (the default) */
+    KIND_RELGLOB,                       /* glob: */
+    KIND_ROOTGLOB,                      /* rootglob: */
+    KIND_PATH,                          /* path:, relpath: */
+    KIND_ROOTFILESIN,                   /* rootfilesin: */
+    KIND_INCLUDE,                       /* include: */
+    KIND_SUBINCLUDE,                    /* subinclude: */
+};
+
+static const struct {
+    const char *name;
+    int kind;
+} syntaxes[] = {
+    {"re", KIND_RELRE},
+    {"regexp", KIND_RELRE},
+    {"relre", KIND_RELRE},
+    {"glob", KIND_RELGLOB},
+    {"relglob", KIND_RELGLOB},
+    {"rootglob", KIND_ROOTGLOB},
+    {"path", KIND_PATH},
+    {"relpath", KIND_PATH},
+    {"rootfilesin", KIND_ROOTFILESIN},
+    {"include", KIND_INCLUDE},
+    {"subinclude", KIND_SUBINCLUDE},
+};
+
+/* A set of strings, by open addressing; the lengths of its strings are
+ * kept too, to know which substrings of a path to look up. */
+typedef struct {
+    char **slots;
+    size_t nslots, count;
+    size_t lengths[16];                 /* distinct lengths */
+    int nlengths;
+    int anylength;                      /* more than fit in lengths */
+} strset_t;
+
+/* The NFA that all glob patterns compile to, and the DFA built from it
+ * as paths are matched.  Bytes that every NFA state treats alike share
+ * a class, so each DFA state only needs one transition per class. */
+enum {
+    NFA_SET,                            /* a byte in set, then out */
+    NFA_SPLIT,                          /* out and out1 (if >= 0) */
+    NFA_ACCEPT,                         /* matched, whatever follows */
+    NFA_ACCEPT_AT_END,                  /* matched if at the end */
+};
+
+typedef struct {
+    int type;
+    int out, out1;
+    int set;
+} nfa_state_t;
+
+typedef struct {
+    uint32_t bits[8];
+} byteset_t;
+
+typedef struct {
+    int *states;                        /* NFA states, sorted */
+    int nstates;
+    int accept, accept_at_end;
+    int *next;                          /* per class; -1 if not built */
+} dfa_state_t;
+
+typedef struct {
+    nfa_state_t *nfa;
+    int nnfa, nfasize;
+    byteset_t *sets;
+    int nsets, setsize;
+    int single[256], allbut[256];       /* sets of one byte, or all but
+                                           one: index + 1, 0 if none */
+    int start;                          /* NFA state: a split chain */
+    int npatterns;
+    unsigned char classes[256];
+    unsigned char class_byte[256];      /* a byte of each class */
+    int nclasses;
+    dfa_state_t *dfa;
+    int ndfa;
+    int *table;                         /* DFA states by NFA set */
+    size_t tablesize;
+    int *mark, generation, *stack, *work;
+} globdfa_t;
+
+typedef struct {
+    char *prefix;                       /* directory, without "/" */
+    size_t prefixlen;
+    struct hgignore *ignore;
+} subinclude_t;
+
+struct hgignore {
+    int all;                            /* "path:." ignores everything */
+    strset_t names;                     /* glob "name": a component */
+    strset_t suffixes;                  /* glob "*suffix": a component's
+                                           end */
+    strset_t prefixes;                  /* rootglob or path: "dir/file",
+                                           and all below it */
+    globdfa_t globs;                    /* any other globs */
+    regex_t *regexes;
+    int nregexes, regexsize;
+    subinclude_t *subincludes;
+    int nsubincludes;
+
+    /* what dirstate-v2 records of the ignore files: hg up to 6.3
+     * hashed their content; later versions hash "<file> " <hash of its
+     * content> "\n" for each */
+    githash_t content_hash, files_hash;
+};
+
+/* The file being read, and where it comes in the includes. */
+typedef struct {
+    hgignore_t *top;                    /* where the hashes go */
+    const char *filename;
+    int depth;
+} reader_t;
+
+static int
+read_patterns(hgignore_t *ignore, reader_t *reader);
+
+/* Sets of strings. */
+
+static size_t
+hash_bytes(const char *s, size_t len)
+{
+    size_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char) s[i]) * 16777619u;
+    return hash;
+}
+
+static int
+strset_has(const strset_t *set, const char *s, size_t len)
+{
+    if (set->count == 0)
+        return 0;
+    for (size_t i = hash_bytes(s, len) & (set->nslots - 1); ;
+         i = (i + 1) & (set->nslots - 1)) {
+        const char *slot = set->slots[i];
+        if (slot == NULL)
+            return 0;
+        if (strncmp(slot, s, len) == 0 && slot[len] == '\0')
+            return 1;
+    }
+}
+
+static void
+strset_place(strset_t *set, char *s)
+{
+    size_t i = hash_bytes(s, strlen(s)) & (set->nslots - 1);
+
+    while (set->slots[i] != NULL)
+        i = (i + 1) & (set->nslots - 1);
+    set->slots[i] = s;
+}
+
+static int
+strset_add(strset_t *set, const char *s, size_t len)
+{
+    char *copy;
+
+    if (strset_has(set, s, len))
+        return 1;
+    if (2 * (set->count + 1) > set->nslots) {
+        strset_t grown = *set;
+        grown.nslots = set->nslots ? set->nslots * 2 : 16;
+        grown.slots = calloc(grown.nslots, sizeof(char *));
+        if (grown.slots == NULL)
+            return 0;
+        for (size_t i = 0; i < set->nslots; i++) {
+            if (set->slots[i] != NULL)
+                strset_place(&grown, set->slots[i]);
+        }
+        free(set->slots);
+        *set = grown;
+    }
+    if ((copy = strndup(s, len)) == NULL)
+        return 0;
+    strset_place(set, copy);
+    set->count++;
+
+    int i;
+    for (i = 0; i < set->nlengths && set->lengths[i] != len; i++)
+        ;
+    if (i == set->nlengths) {
+        if (set->nlengths < (int) (sizeof(set->lengths) /
+                                   sizeof(set->lengths[0])))
+            set->lengths[set->nlengths++] = len;
+        else
+            set->anylength = 1;
+    }
+    return 1;
+}
+
+static void
+strset_free(strset_t *set)
+{
+    for (size_t i = 0; i < set->nslots; i++)
+        free(set->slots[i]);
+    free(set->slots);
+}
+
+/* Is there a string in set that ends the len bytes at s?  With too many
+ * lengths to try them all, try every one up to len. */
+static int
+strset_has_suffix(const strset_t *set, const char *s, size_t len)
+{
+    if (set->anylength) {
+        for (size_t l = 1; l <= len; l++) {
+            if (strset_has(set, s + len - l, l))
+                return 1;
+        }
+        return 0;
+    }
+    for (int i = 0; i < set->nlengths; i++) {
+        size_t l = set->lengths[i];
+        if (l <= len && strset_has(set, s + len - l, l))
+            return 1;
+    }
+    return 0;
+}
+
+/* Is there a string in set that is the path (len bytes) or one of its
+ * parent directories? */
+static int
+strset_has_prefix(const strset_t *set, const char *path, size_t len)
+{
+    if (set->anylength) {
+        for (size_t l = 1; l <= len; l++) {
+            if ((path[l] == '\0' || path[l] == '/') &&
+                strset_has(set, path, l))
+                return 1;
+        }
+        return 0;
+    }
+    for (int i = 0; i < set->nlengths; i++) {
+        size_t l = set->lengths[i];
+        if (l <= len && (path[l] == '\0' || path[l] == '/') &&
+            strset_has(set, path, l))
+            return 1;
+    }
+    return 0;
+}
+
+/* The NFA for globs. */
+
+static int
+new_nfa_state(globdfa_t *g, int type, int out, int out1, int set)
+{
+    if (g->nnfa == g->nfasize) {
+        int newsize = g->nfasize ? g->nfasize * 2 : 64;
+        nfa_state_t *nfa = realloc(g->nfa, newsize * sizeof(nfa_state_t));
+        if (nfa == NULL)
+            return -1;
+        g->nfa = nfa;
+        g->nfasize = newsize;
+    }
+    g->nfa[g->nnfa].type = type;
+    g->nfa[g->nnfa].out = out;
+    g->nfa[g->nnfa].out1 = out1;
+    g->nfa[g->nnfa].set = set;
+    return g->nnfa++;
+}
+
+static int
+new_set(globdfa_t *g)
+{
+    if (g->nsets == g->setsize) {
+        int newsize = g->setsize ? g->setsize * 2 : 16;
+        byteset_t *sets = realloc(g->sets, newsize * sizeof(byteset_t));
+        if (sets == NULL)
+            return -1;
+        g->sets = sets;
+        g->setsize = newsize;
+    }
+    memset(&g->sets[g->nsets], 0, sizeof(byteset_t));
+    return g->nsets++;
+}
+
+static void
+set_add(byteset_t *set, unsigned char c)
+{
+    set->bits[c / 32] |= 1u << (c % 32);
+}
+
+static int
+set_has(const byteset_t *set, unsigned char c)
+{
+    return (set->bits[c / 32] >> (c % 32)) & 1;
+}
+
+/* A new set of the single byte c, or of all bytes but c if negate. */
+static int
+byte_set(globdfa_t *g, unsigned char c, int negate)
+{
+    int *cached = negate ? &g->allbut[c] : &g->single[c];
+    int set;
+
+    if (*cached > 0)
+        return *cached - 1;
+    if ((set = new_set(g)) < 0)
+        return -1;
+    *cached = set + 1;
+    if (negate) {
+        memset(g->sets[set].bits, 0xff, sizeof(g->sets[set].bits));
+        g->sets[set].bits[c / 32] &= ~(1u << (c % 32));
+    }
+    else
+        set_add(&g->sets[set], c);
+    return set;
+}
+
+/* The NFA is built forwards: *tail is a split state whose out is not
+ * set yet, where the next piece goes. */
+
+static int
+append_set(globdfa_t *g, int *tail, int set)
+{
+    int next = new_nfa_state(g, NFA_SPLIT, -1, -1, 0);
+    int state = new_nfa_state(g, NFA_SET, next, -1, set);
+
+    if (set < 0 || next < 0 || state < 0)
+        return 0;
+    g->nfa[*tail].out = state;
+    *tail = next;
+    return 1;
+}
+
+/* Any number of bytes in set. */
+static int
+append_star(globdfa_t *g, int *tail, int set)
+{
+    int next = new_nfa_state(g, NFA_SPLIT, -1, -1, 0);
+    int loop = new_nfa_state(g, NFA_SPLIT, -1, next, 0);
+    int state = new_nfa_state(g, NFA_SET, loop, -1, set);
+
+    if (set < 0 || next < 0 || loop < 0 || state < 0)
+        return 0;
+    g->nfa[loop].out = state;
+    g->nfa[*tail].out = loop;
+    *tail = next;
+    return 1;
+}
+
+/* Nothing, or anything that ends in "/": the "(?:.*\/)?" of "**\/". */
+static int
+append_any_dirs(globdfa_t *g, int *tail, int anyset, int slashset)
+{
+    int next = new_nfa_state(g, NFA_SPLIT, -1, -1, 0);
+    int slash = new_nfa_state(g, NFA_SET, next, -1, slashset);
+    int loop = new_nfa_state(g, NFA_SPLIT, -1, slash, 0);
+    int any = new_nfa_state(g, NFA_SET, loop, -1, anyset);
+    int split = new_nfa_state(g, NFA_SPLIT, loop, next, 0);
+
+    if (next < 0 || slash < 0 || loop < 0 || any < 0 || split < 0)
+        return 0;
+    g->nfa[loop].out = any;
+    g->nfa[*tail].out = split;
+    *tail = next;
+    return 1;
+}
+
+/* Parse the class in a glob at p, just after its "[".  Return the end
+ * of it, or NULL if there is no "]": then "[" is literal. */
+static const char *
+parse_class(const char *p, byteset_t *set)
+{
+    const char *end = p;
+    int negate = 0;
+
+    if (*end == '!' || *end == ']')
+        end++;
+    while (*end != '\0' && *end != ']')
+        end++;
+    if (*end == '\0')
+        return NULL;
+    memset(set, 0, sizeof(byteset_t));
+    if (*p == '!') {
+        negate = 1;
+        p++;
+    }
+    for (const char *q = p; q < end; q++) {
+        unsigned char lo = *q, hi = *q;
+        if (q + 2 < end && q[1] == '-') {
+            hi = q[2];
+            q += 2;
+        }
+        for (unsigned int c = lo; c <= hi; c++)
+            set_add(set, c);
+    }
+    if (negate) {
+        for (int i = 0; i < 8; i++)
+            set->bits[i] = ~set->bits[i];
+    }
+    return end + 1;
+}
+
+/* Append the glob pat to the NFA at *tail, translating it as hg does:
+ * "*" is any bytes but "/", "**" any bytes, "**\/" any directories,
+ * "?" any byte, "[...]" a class ("[!...]" negated), "{a,b}" either
+ * alternative, and "\" quotes the next byte.  Return 0 on error.
+ */
+static int
+append_glob(globdfa_t *g, int *tail, const char *pat)
+{
+    int anyset = byte_set(g, '\n', 1), notslash = byte_set(g, '/', 1);
+    int slash = byte_set(g, '/', 0);
+    struct {
+        int split, join;
+    } groups[32];
+    int ngroups = 0;
+
+    if (anyset < 0 || notslash < 0 || slash < 0)
+        return 0;
+    for (const char *p = pat; *p != '\0'; ) {
+        char c = *p++;
+        int ok = 1;
+
+        if (c == '*' && *p == '*' && p[1] == '/') {
+            p += 2;
+            ok = append_any_dirs(g, tail, anyset, slash);
+        }
+        else if (c == '*' && *p == '*') {
+            p++;
+            ok = append_star(g, tail, anyset);
+        }
+        else if (c == '*')
+            ok = append_star(g, tail, notslash);
+        else if (c == '?')
+            ok = append_set(g, tail, anyset);
+        else if (c == '[' && parse_class(p, &(byteset_t) {{0}}) != NULL) {
+            int set = new_set(g);
+            if (set < 0)
+                return 0;
+            p = parse_class(p, &g->sets[set]);
+            ok = append_set(g, tail, set);
+        }
+        else if (c == '{') {
+            if (ngroups == (int) (sizeof(groups) / sizeof(groups[0])))
+                return 0;
+            int join = new_nfa_state(g, NFA_SPLIT, -1, -1, 0);
+            int start = new_nfa_state(g, NFA_SPLIT, -1, -1, 0);
+            int split = new_nfa_state(g, NFA_SPLIT, start, -1, 0);
+            if (join < 0 || start < 0 || split < 0)
+                return 0;
+            g->nfa[*tail].out = split;
+            *tail = start;
+            groups[ngroups].split = split;
+            groups[ngroups++].join = join;
+        }
+        else if (c == ',' && ngroups > 0) {
+            int start = new_nfa_state(g, NFA_SPLIT, -1, -1, 0);
+            int split = new_nfa_state(g, NFA_SPLIT, start, -1, 0);
+            if (start < 0 || split < 0)
+                return 0;
+            g->nfa[*tail].out = groups[ngroups - 1].join;
+            g->nfa[groups[ngroups - 1].split].out1 = split;
+            groups[ngroups - 1].split = split;
+            *tail = start;
+        }
+        else if (c == '}' && ngroups > 0) {
+            g->nfa[*tail].out = groups[--ngroups].join;
+            *tail = groups[ngroups].join;
+        }
+        else {
+            if (c == '\\' && *p != '\0')
+                c = *p++;
+            ok = append_set(g, tail, byte_set(g, c, 0));
+        }
+        if (!ok)
+            return 0;
+    }
+    return ngroups == 0;                /* hg cannot compile "{a,b" */
+}
+
+/* Add a glob pattern of kind to the NFA: its own branch from the
+ * start state.
+ */
+static int
+add_glob(globdfa_t *g, int kind, const char *pat)
+{
+    int tail, head, end, split;
+
+    if (g->nnfa == 0) {
+        g->start = new_nfa_state(g, NFA_SPLIT, -1, -1, 0);
+        if (g->start < 0)
+            return 0;
+    }
+    head = tail = new_nfa_state(g, NFA_SPLIT, -1, -1, 0);
+    if (head < 0)
+        return 0;
+
+    if (kind == KIND_ROOTFILESIN) {
+        /* the files in directory pat, and nothing below */
+        if (*pat != '\0') {
+            for (const char *p = pat; *p != '\0'; p++) {
+                if (!append_set(g, &tail, byte_set(g, *p, 0)))
+                    return 0;
+            }
+            if (!append_set(g, &tail, byte_set(g, '/', 0)))
+                return 0;
+        }
+        int notslash = byte_set(g, '/', 1);
+        if (!append_set(g, &tail, notslash) ||
+            !append_star(g, &tail, notslash) ||
+            (end = new_nfa_state(g, NFA_ACCEPT_AT_END, -1, -1, 0)) < 0)
+            return 0;
+        g->nfa[tail].out = end;
+    }
+    else {
+        /* a glob matches at the start (rootglob) or after any "/"
+         * (glob), and then either the path ends or a "/" does: what
+         * is in an ignored directory is ignored */
+        if (kind == KIND_RELGLOB &&
+            !append_any_dirs(g, &tail, byte_set(g, '\n', 1),
+                             byte_set(g, '/', 0)))
+            return 0;
+        if (!append_glob(g, &tail, pat))
+            return 0;
+        int atend = new_nfa_state(g, NFA_ACCEPT_AT_END, -1, -1, 0);
+        int accept = new_nfa_state(g, NFA_ACCEPT, -1, -1, 0);
+        int slash = new_nfa_state(g, NFA_SET, accept, -1,
+                                  byte_set(g, '/', 0));
+        if (atend < 0 || accept < 0 || slash < 0 ||
+            g->nfa[slash].set < 0)
+            return 0;
+        g->nfa[tail].out = atend;
+        g->nfa[tail].out1 = slash;
+    }
+
+    /* start: a chain of splits, one for each pattern */
+    split = new_nfa_state(g, NFA_SPLIT, head, g->nfa[g->start].out, 0);
+    if (split < 0)
+        return 0;
+    g->nfa[g->start].out = split;
+    g->npatterns++;
+    return 1;
+}
+
+/* The DFA. */
+
+/* Split the 256 bytes into the classes that no set tells apart. */
+static void
+find_classes(globdfa_t *g)
+{
+    memset(g->classes, 0, sizeof(g->classes));
+    g->nclasses = 1;
+    for (int s = 0; s < g->nsets; s++) {
+        int split[256][2];              /* new class of (class, in set) */
+        int nclasses = 0;
+
+        memset(split, -1, sizeof(split));
+        for (int c = 0; c < 256; c++) {
+            int in = set_has(&g->sets[s], c);
+            int *newclass = &split[g->classes[c]][in];
+            if (*newclass < 0)
+                *newclass = nclasses++;
+            g->classes[c] = *newclass;
+        }
+        g->nclasses = nclasses;
+    }
+    for (int c = 255; c >= 0; c--)
+        g->class_byte[g->classes[c]] = c;
+}
+
+/* Add the states reachable from state without reading a byte to
+ * g->work. */
+static void
+add_closure(globdfa_t *g, int state, int *count)
+{
+    int sp = 0;
+
+    g->stack[sp++] = state;
+    while (sp > 0) {
+        int s = g->stack[--sp];
+        if (s < 0 || g->mark[s] == g->generation)
+            continue;
+        g->mark[s] = g->generation;
+        if (g->nfa[s].type == NFA_SPLIT) {
+            g->stack[sp++] = g->nfa[s].out1;
+            g->stack[sp++] = g->nfa[s].out;
+        }
+        else
+            g->work[(*count)++] = s;
+    }
+}
+
+static int
+compare_ints(const void *a, const void *b)
+{
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+static size_t
+hash_states(const int *states, int count)
+{
+    return hash_bytes((const char *) states, count * sizeof(int));
+}
+
+static void
+free_dfa_states(globdfa_t *g)
+{
+    for (int i = 0; i < g->ndfa; i++) {
+        free(g->dfa[i].states);
+        free(g->dfa[i].next);
+    }
+    g->ndfa = 0;
+    if (g->table != NULL)
+        memset(g->table, -1, g->tablesize * sizeof(int));
+}
+
+/* Return the DFA state for the count NFA states in g->work, adding it
+ * if it is new, or -1 if out of memory. */
+static int
+find_dfa_state(globdfa_t *g, int count)
+{
+    size_t i;
+
+    qsort(g->work, count, sizeof(int), compare_ints);
+    for (i = hash_states(g->work, count) & (g->tablesize - 1);
+         g->table[i] >= 0; i = (i + 1) & (g->tablesize - 1)) {
+        const dfa_state_t *d = &g->dfa[g->table[i]];
+        if (d->nstates == count &&
+            memcmp(d->states, g->work, count * sizeof(int)) == 0)
+            return g->table[i];
+    }
+
+    dfa_state_t *d = &g->dfa[g->ndfa];
+    d->nstates = count;
+    d->states = malloc((count ? count : 1) * sizeof(int));
+    d->next = malloc(g->nclasses * sizeof(int));
+    if (d->states == NULL || d->next == NULL) {
+        free(d->states);
+        free(d->next);
+        return -1;
+    }
+    memcpy(d->states, g->work, count * sizeof(int));
+    memset(d->next, -1, g->nclasses * sizeof(int));
+    d->accept = d->accept_at_end = 0;
+    for (int j = 0; j < count; j++) {
+        if (g->nfa[d->states[j]].type == NFA_ACCEPT)
+            d->accept = 1;
+        else if (g->nfa[d->states[j]].type == NFA_ACCEPT_AT_END)
+            d->accept_at_end = 1;
+    }
+    g->table[i] = g->ndfa;
+    return g->ndfa++;
+}
+
+/* State 0 of the DFA: where every pattern starts. */
+static int
+start_dfa(globdfa_t *g)
+{
+    int count = 0;
+
+    g->generation++;
+    add_closure(g, g->start, &count);
+    return find_dfa_state(g, count);
+}
+
+/* Compile the NFA so far for matching. */
+static int
+finish_globs(globdfa_t *g)
+{
+    if (g->npatterns == 0)
+        return 1;
+    find_classes(g);
+    g->dfa = calloc(MAX_DFA_STATES, sizeof(dfa_state_t));
+    g->tablesize = 2 * MAX_DFA_STATES;
+    g->table = malloc(g->tablesize * sizeof(int));
+    g->mark = calloc(g->nnfa, sizeof(int));
+    g->stack = malloc(2 * g->nnfa * sizeof(int));
+    g->work = malloc(g->nnfa * sizeof(int));
+    if (g->dfa == NULL || g->table == NULL || g->mark == NULL ||
+        g->stack == NULL || g->work == NULL)
+        return 0;
+    memset(g->table, -1, g->tablesize * sizeof(int));
+    return start_dfa(g) == 0;
+}
+
+/* Follow the transition from DFA state from on a byte of class c,
+ * building it if need be.  Return the new state, or -1 if out of
+ * memory. */
+static int
+dfa_step(globdfa_t *g, int from, int c)
+{
+    const dfa_state_t *d = &g->dfa[from];
+    unsigned char byte = g->class_byte[c];
+    int count = 0, to;
+
+    g->generation++;
+    for (int i = 0; i < d->nstates; i++) {
+        const nfa_state_t *s = &g->nfa[d->states[i]];
+        if (s->type == NFA_SET && set_has(&g->sets[s->set], byte))
+            add_closure(g, s->out, &count);
+    }
+    if (g->ndfa == MAX_DFA_STATES) {
+        /* start over: g->work is all we need of the old states */
+        int *work = g->work;
+        int saved[count ? count : 1];
+        memcpy(saved, work, count * sizeof(int));
+        debug("hgignore: DFA too big: starting over");
+        free_dfa_states(g);
+        if (start_dfa(g) < 0)
+            return -1;
+        memcpy(g->work, saved, count * sizeof(int));
+        return find_dfa_state(g, count);
+    }
+    to = find_dfa_state(g, count);
+    if (to >= 0)
+        g->dfa[from].next[c] = to;
+    return to;
+}
+
+static int
+match_globs(globdfa_t *g, const char *path)
+{
+    int state = 0;
+
+    if (g->npatterns == 0 || g->ndfa == 0)
+        return 0;
+    for (const unsigned char *p = (const unsigned char *) path; ; p++) {
+        const dfa_state_t *d = &g->dfa[state];
+        if (d->accept)
+            return 1;
+        if (*p == '\0')
+            return d->accept_at_end;
+        if (d->nstates == 0)
+            return 0;
+        int c = g->classes[*p];
+        int next = d->next[c];
+        if (next < 0 && (next = dfa_step(g, state, c)) < 0)
+            return 0;
+        state = next;
+    }
+}
+
+static void
+free_globs(globdfa_t *g)
+{
+    free_dfa_states(g);
+    free(g->dfa);
+    free(g->table);
+    free(g->mark);
+    free(g->stack);
+    free(g->work);
+    free(g->nfa);
+    free(g->sets);
+}
+
+/* Reading ignore files. */
+
+static int
+has_glob_chars(const char *s)
+{
+    return strpbrk(s, "*?[{}\\") != NULL;
+}
+
+static int
+add_regex(hgignore_t *ignore, const char *pat, const char *filename)
+{
+    char *re = malloc(strlen(pat) + 1), *q = re;
+    int status;
+
+    if (re == NULL)
+        return 0;
+    /* POSIX has no "(?:...)", but it is the same as "(...)" when
+     * nothing is captured */
+    for (const char *p = pat; *p != '\0'; ) {
+        if (strncmp(p, "(?:", 3) == 0) {
+            *q++ = '(';
+            p += 3;
+        }
+        else
+            *q++ = *p++;
+    }
+    *q = '\0';
+    if (ignore->nregexes == ignore->regexsize) {
+        int newsize = ignore->regexsize ? ignore->regexsize * 2 : 16;
+        regex_t *regexes = realloc(ignore->regexes,
+                                   newsize * sizeof(regex_t));
+        if (regexes == NULL) {
+            free(re);
+            return 0;
+        }
+        ignore->regexes = regexes;
+        ignore->regexsize = newsize;
+    }
+    status = regcomp(&ignore->regexes[ignore->nregexes], re,
+                     REG_EXTENDED | REG_NOSUB);
+    if (status == 0)
+        ignore->nregexes++;
+    else
+        debug("%s: cannot compile '%s': skipping it", filename, pat);
+    free(re);
+    return 1;
+}
+
+/* Join path, relative to the directory of filename, to it. */
+static void
+relative_path(char *buf, size_t size, const char *path, const char *filename)
+{
+    const char *slash = strrchr(filename, '/');
+
+    if (path[0] == '/' || slash == NULL)
+        snprintf(buf, size, "%s", path);
+    else
+        snprintf(buf, size, "%.*s/%s", (int) (slash - filename), filename,
+                 path);
+}
+
+static int
+add_subinclude(hgignore_t *ignore, const char *filename,
+               const reader_t *reader)
+{
+    const char *slash = strrchr(filename, '/');
+    subinclude_t *sub;
+
+    sub = realloc(ignore->subincludes,
+                  (ignore->nsubincludes + 1) * sizeof(subinclude_t));
+    if (sub == NULL)
+        return 0;
+    ignore->subincludes = sub;
+    sub = &ignore->subincludes[ignore->nsubincludes];
+    sub->prefixlen = slash != NULL ? (size_t) (slash - filename) : 0;
+    sub->prefix = strndup(filename, sub->prefixlen);
+    sub->ignore = calloc(1, sizeof(hgignore_t));
+    if (sub->prefix == NULL || sub->ignore == NULL) {
+        free(sub->prefix);
+        free(sub->ignore);
+        return 0;
+    }
+    ignore->nsubincludes++;
+
+    reader_t subreader = {reader->top, filename, reader->depth + 1};
+    read_patterns(sub->ignore, &subreader);
+    return finish_globs(&sub->ignore->globs);
+}
+
+/* Normalize a path pattern in place, as hg does: no "." components,
+ * doubled or trailing slashes.  ".." is left alone. */
+static void
+normalize_path(char *pat)
+{
+    char *p = pat, *q = pat;
+
+    while (*p != '\0') {
+        if (*p == '/' && q > pat && q[-1] == '/')
+            p++;
+        else if (p[0] == '.' && (p[1] == '/' || p[1] == '\0') &&
+                 (q == pat || q[-1] == '/'))
+            p++;
+        else
+            *q++ = *p++;
+    }
+    while (q > pat && q[-1] == '/')
+        q--;
+    *q = '\0';
+}
+
+/* Add one pattern of kind to ignore.  Return 0 if out of memory. */
+static int
+add_pattern(hgignore_t *ignore, int kind, char *pat, const reader_t *reader)
+{
+    char path[PATH_MAX];
+    size_t len;
+
+    if (kind != KIND_RELRE && kind != KIND_INCLUDE &&
+        kind != KIND_SUBINCLUDE)
+        normalize_path(pat);
+    len = strlen(pat);
+    switch (kind) {
+    case KIND_RELRE:
+        return add_regex(ignore, pat, reader->filename);
+    case KIND_RELGLOB:
+        if (!has_glob_chars(pat) && strchr(pat, '/') == NULL)
+            return strset_add(&ignore->names, pat, len);
+        if (pat[0] == '*' && pat[1] != '\0' && !has_glob_chars(pat + 1) &&
+            strchr(pat, '/') == NULL)
+            return strset_add(&ignore->suffixes, pat + 1, len - 1);
+        break;
+    case KIND_ROOTGLOB:
+        if (!has_glob_chars(pat))
+            return strset_add(&ignore->prefixes, pat, len);
+        break;
+    case KIND_PATH:
+        if (len == 0) {
+            ignore->all = 1;
+            return 1;
+        }
+        return strset_add(&ignore->prefixes, pat, len);
+    case KIND_INCLUDE:
+    case KIND_SUBINCLUDE:
+        if (reader->depth >= MAX_INCLUDE_DEPTH) {
+            debug("%s: includes nested too deeply", reader->filename);
+            return 1;
+        }
+        relative_path(path, sizeof(path), pat, reader->filename);
+        if (kind == KIND_SUBINCLUDE)
+            return add_subinclude(ignore, path, reader);
+        reader_t subreader = {reader->top, path, reader->depth + 1};
+        read_patterns(ignore, &subreader);
+        return 1;
+    }
+    if (!add_glob(&ignore->globs, kind, pat))
+        debug("%s: cannot compile '%s': skipping it", reader->filename, pat);
+    return 1;
+}
+
+/* Add to the ignore hashes, as hg would, the content of filename (size
+ * bytes at data). */
+static void
+hash_ignore_file(hgignore_t *top, const char *filename,
+                 const char *data, size_t size)
+{
+    unsigned char hash[20];
+    githash_t file;
+
+    githash_update(&top->content_hash, data, size);
+    githash_init(&file, 20);
+    githash_update(&file, data, size);
+    githash_final(&file, hash);
+    githash_update(&top->files_hash, filename, strlen(filename));
+    githash_update(&top->files_hash, " ", 1);
+    githash_update(&top->files_hash, hash, sizeof(hash));
+    githash_update(&top->files_hash, "\n", 1);
+}
+
+/* Strip a comment, which starts at a "#" not quoted by "\", and
+ * unquote "\#"; then trailing space.
+ */
+static void
+strip_comment(char *line)
+{
+    char *p, *q;
+    int backslashes = 0;
+
+    for (p = line; *p != '\0'; p++) {
+        if (*p == '#' && backslashes % 2 == 0) {
+            *p = '\0';
+            break;
+        }
+        backslashes = *p == '\\' ? backslashes + 1 : 0;
+    }
+    for (p = q = line; *p != '\0'; p++) {
+        if (p[0] == '\\' && p[1] == '#')
+            p++;
+        *q++ = *p;
+    }
+    while (q > line && (q[-1] == ' ' || q[-1] == '\t' || q[-1] == '\r' ||
+                        q[-1] == '\n'))
+        q--;
+    *q = '\0';
+}
+
+/* Add the patterns of reader->filename to ignore.  Return 0 if it
+ * cannot be read.
+ */
+static int
+read_patterns(hgignore_t *ignore, reader_t *reader)
+{
+    FILE *file;
+    char *data = NULL, *line, *next;
+    size_t size = 0, used = 0;
+    int kind = KIND_RELRE, count = 0;
+
+    file = fopen(reader->filename, "rb");
+    if (file == NULL) {
+        debug("error opening '%s': %s", reader->filename, strerror(errno));
+        return 0;
+    }
+    for (;;) {
+        if (used + 4096 + 1 > size) {
+            size = size ? size * 2 : 8192;
+            char *newdata = realloc(data, size);
+            if (newdata == NULL) {
+                free(data);
+                fclose(file);
+                return 0;
+            }
+            data = newdata;
+        }
+        size_t n = fread(data + used, 1, 4096, file);
+        if (n == 0)
+            break;
+        used += n;
+    }
+    fclose(file);
+    data[used] = '\0';
+    hash_ignore_file(reader->top, reader->filename, data, used);
+
+    for (line = data; line != NULL && *line != '\0'; line = next) {
+        next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+        strip_comment(line);
+        if (*line == '\0')
+            continue;
+
+        if (strncmp(line, "syntax:", 7) == 0) {
+            char *name = line + 7;
+            size_t i;
+            while (*name == ' ' || *name == '\t')
+                name++;
+            for (i = 0; i < sizeof(syntaxes) / sizeof(syntaxes[0]); i++) {
+                if (strcmp(name, syntaxes[i].name) == 0) {
+                    kind = syntaxes[i].kind;
+                    break;
+                }
+            }
+            if (i == sizeof(syntaxes) / sizeof(syntaxes[0]))
+                debug("%s: unknown syntax '%s'", reader->filename, name);
+            continue;
+        }
+
+        char *pat = line;
+        int linekind = kind;
+        for (size_t i = 0; i < sizeof(syntaxes) / sizeof(syntaxes[0]); i++) {
+            size_t len = strlen(syntaxes[i].name);
+            if (strncmp(line, syntaxes[i].name, len) == 0 &&
+                line[len] == ':') {
+                linekind = syntaxes[i].kind;
+                pat = line + len + 1;
+                break;
+            }
+        }
+        if (!add_pattern(ignore, linekind, pat, reader))
+            break;
+        count++;
+    }
+    free(data);
+    debug("read %d patterns from '%s'", count, reader->filename);
+    return 1;
+}
+
+hgignore_t *
+read_hg_ignores(const hgrc_t *config)
+{
+    hgignore_t *ignore = calloc(1, sizeof(hgignore_t));
+    reader_t reader = {ignore, ".hgignore", 0};
+    const char *home = getenv("HOME");
+    char path[PATH_MAX];
+
+    if (ignore == NULL)
+        return NULL;
+    githash_init(&ignore->content_hash, 20);
+    githash_init(&ignore->files_hash, 20);
+    read_patterns(ignore, &reader);
+
+    /* ui.ignore, ui.ignore.<name>: the last of each */
+    for (size_t i = 0; config != NULL && i < config->count; i++) {
+        const hgrc_entry_t *entry = &config->entries[i];
+        int later = 0;
+        if (strcmp(entry->section, "ui") != 0 || entry->value == NULL ||
+            (strcmp(entry->name, "ignore") != 0 &&
+             strncmp(entry->name, "ignore.", 7) != 0))
+            continue;
+        for (size_t j = i + 1; j < config->count && !later; j++)
+            later = strcmp(config->entries[j].section, "ui") == 0 &&
+                strcmp(config->entries[j].name, entry->name) == 0;
+        if (later)
+            continue;
+        if (strncmp(entry->value, "~/", 2) == 0 && home != NULL)
+            snprintf(path, sizeof(path), "%s%s", home, entry->value + 1);
+        else
+            snprintf(path, sizeof(path), "%s", entry->value);
+        reader.filename = path;
+        read_patterns(ignore, &reader);
+    }
+
+    if (!finish_globs(&ignore->globs)) {
+        free_hgignore(ignore);
+        return NULL;
+    }
+    debug("hgignore: %zu names, %zu suffixes, %zu paths, %d globs, "
+          "%d regexes, %d subincludes",
+          ignore->names.count, ignore->suffixes.count,
+          ignore->prefixes.count, ignore->globs.npatterns,
+          ignore->nregexes, ignore->nsubincludes);
+    return ignore;
+}
+
+void
+free_hgignore(hgignore_t *ignore)
+{
+    if (ignore == NULL)
+        return;
+    strset_free(&ignore->names);
+    strset_free(&ignore->suffixes);
+    strset_free(&ignore->prefixes);
+    free_globs(&ignore->globs);
+    for (int i = 0; i < ignore->nregexes; i++)
+        regfree(&ignore->regexes[i]);
+    free(ignore->regexes);
+    for (int i = 0; i < ignore->nsubincludes; i++) {
+        free(ignore->subincludes[i].prefix);
+        free_hgignore(ignore->subincludes[i].ignore);
+    }
+    free(ignore->subincludes);
+    free(ignore);
+}
+
+int
+hg_ignored(hgignore_t *ignore, const char *path)
+{
+    size_t len = strlen(path);
+
+    if (ignore == NULL)
+        return 0;
+    if (ignore->all)
+        return 1;
+
+    /* a name or suffix can match any component; a path any leading
+     * components */
+    for (const char *start = path; ; ) {
+        const char *end = strchr(start, '/');
+        size_t complen = end != NULL ? (size_t) (end - start) : strlen(start);
+        if (strset_has(&ignore->names, start, complen) ||
+            (ignore->suffixes.count > 0 &&
+             strset_has_suffix(&ignore->suffixes, start, complen)))
+            return 1;
+        if (end == NULL)
+            break;
+        start = end + 1;
+    }
+    if (ignore->prefixes.count > 0 &&
+        strset_has_prefix(&ignore->prefixes, path, len))
+        return 1;
+
+    if (match_globs(&ignore->globs, path))
+        return 1;
+    for (int i = 0; i < ignore->nregexes; i++) {
+        if (regexec(&ignore->regexes[i], path, 0, NULL, 0) == 0)
+            return 1;
+    }
+    for (int i = 0; i < ignore->nsubincludes; i++) {
+        const subinclude_t *sub = &ignore->subincludes[i];
+        const char *subpath = path;
+        if (sub->prefixlen == 0)
+            ;
+        else if (len > sub->prefixlen && path[sub->prefixlen] == '/' &&
+                 strncmp(path, sub->prefix, sub->prefixlen) == 0)
+            subpath += sub->prefixlen + 1;
+        else
+            continue;
+        if (hg_ignored(sub->ignore, subpath))
+            return 1;
+    }
+    return 0;
+}
+
+int
+hgignore_hash_matches(const hgignore_t *ignore, const unsigned char *hash)
+{
+    unsigned char digest[20];
+    githash_t copy;
+
+    copy = ignore->content_hash;
+    githash_final(&copy, digest);
+    if (memcmp(digest, hash, sizeof(digest)) == 0)
+        return 1;
+    copy = ignore->files_hash;
+    githash_final(&copy, digest);
+    return memcmp(digest, hash, sizeof(digest)) == 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef HGIGNORE_H
+#define HGIGNORE_H
+
+#include "hgrc.h"
+
+/* The ignore patterns of a working dir, compiled. */
+typedef struct hgignore hgignore_t;
+
+/* Read and compile the ignore patterns of the repository in the
+ * current dir: those of .hgignore and of the files named by ui.ignore
+ * and ui.ignore.<name> in config, with the files they include.  Lines
+ * are regular expressions, or globs after "syntax: glob", or take the
+ * syntax their prefix names ("glob:", "rootglob:", "re:", "path:",
+ * "rootfilesin:", "include:", "subinclude:").  Patterns that cannot be
+ * compiled are skipped.  Return NULL if out of memory; caller must
+ * free the result with free_hgignore().
+ */
+hgignore_t *
+read_hg_ignores(const hgrc_t *config);
+
+void
+free_hgignore(hgignore_t *ignore);
+
+/* Return 1 if path (relative to the root, without a trailing slash) is
+ * ignored.  The matcher for globs is built lazily, as paths are
+ * matched, so it is not const.
+ */
+int
+hg_ignored(hgignore_t *ignore, const char *path);
+
+/* Return 1 if hash is what dirstate-v2 records for the ignore files
+ * read: Mercurial uses it to tell whether its cached directory mtimes
+ * are still good for finding unknown files.
+ */
+int
+hgignore_hash_matches(const hgignore_t *ignore, const unsigned char *hash);
+
+#endif
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "hgrc.h"
+
+/* hg gives up on deeper includes, which are probably a loop */
+#define MAX_INCLUDE_DEPTH 10
+
+static int
+add_entry(hgrc_t *config, const char *section, const char *name,
+          size_t namelen, const char *value, size_t valuelen)
+{
+    hgrc_entry_t *entry;
+
+    if (config->count == config->size) {
+        size_t newsize = config->size ? config->size * 2 : 64;
+        hgrc_entry_t *entries = realloc(config->entries,
+                                        newsize * sizeof(hgrc_entry_t));
+        if (entries == NULL)
+            return 0;
+        config->entries = entries;
+        config->size = newsize;
+    }
+    entry = &config->entries[config->count];
+    entry->section = strdup(section);
+    entry->name = strndup(name, namelen);
+    entry->value = value != NULL ? strndup(value, valuelen) : NULL;
+    if (entry->section == NULL || entry->name == NULL ||
+        (value != NULL && entry->value == NULL)) {
+        free(entry->section);
+        free(entry->name);
+        free(entry->value);
+        return 0;
+    }
+    config->count++;
+    return 1;
+}
+
+/* Append a continuation line to the value of the last entry. */
+static void
+continue_value(hgrc_t *config, const char *line, size_t len)
+{
+    hgrc_entry_t *entry = &config->entries[config->count - 1];
+    size_t oldlen = strlen(entry->value);
+    char *value = realloc(entry->value, oldlen + len + 2);
+
+    if (value == NULL)
+        return;
+    value[oldlen] = '\n';
+    memcpy(value + oldlen + 1, line, len);
+    value[oldlen + 1 + len] = '\0';
+    entry->value = value;
+}
+
+static size_t
+strip_trailing_space(const char *s, size_t len)
+{
+    while (len > 0 && isspace((unsigned char) s[len - 1]))
+        len--;
+    return len;
+}
+
+static int
+add_hgrc_file(hgrc_t *config, const char *filename, int depth);
+
+/* Parse one line of an hgrc file.  section is the current section,
+ * updated by "[section]" lines; continuing says whether a continuation
+ * line would extend the last entry.
+ */
+static void
+parse_line(hgrc_t *config, char *line, char *section, size_t sectionsize,
+           int *continuing, const char *filename, int depth)
+{
+    size_t len = strip_trailing_space(line, strlen(line));
+    char *p = line;
+
+    if (isspace((unsigned char) *p)) {
+        while (isspace((unsigned char) *p))
+            p++;
+        if (*p != '\0' && *continuing)
+            continue_value(config, p, len - (p - line));
+        return;
+    }
+    *continuing = 0;
+    if (len == 0 || *p == ';' || *p == '#')
+        return;
+    if (*p == '[') {
+        char *close = strchr(p, ']');
+        if (close != NULL && close > p + 1)
+            snprintf(section, sectionsize, "%.*s",
+                     (int) (close - p - 1), p + 1);
+        return;
+    }
+    if (strncmp(p, "%unset", 6) == 0 && isspace((unsigned char) p[6])) {
+        for (p += 6; isspace((unsigned char) *p); p++)
+            ;
+        add_entry(config, section, p, len - (p - line), NULL, 0);
+        return;
+    }
+    if (strncmp(p, "%include", 8) == 0 && isspace((unsigned char) p[8])) {
+        char path[PATH_MAX];
+        const char *home = getenv("HOME");
+        const char *slash = strrchr(filename, '/');
+        for (p += 8; isspace((unsigned char) *p); p++)
+            ;
+        line[len] = '\0';
+        if (strncmp(p, "~/", 2) == 0 && home != NULL)
+            snprintf(path, sizeof(path), "%s%s", home, p + 1);
+        else if (p[0] == '/' || slash == NULL)
+            snprintf(path, sizeof(path), "%s", p);
+        else
+            snprintf(path, sizeof(path), "%.*s/%s",
+                     (int) (slash - filename), filename, p);
+        if (depth >= MAX_INCLUDE_DEPTH)
+            debug("hgrc: includes nested too deeply in '%s'", filename);
+        else
+            add_hgrc_file(config, path, depth + 1);
+        return;
+    }
+
+    char *eq = strchr(p, '=');
+    if (eq == NULL || eq == p || section[0] == '\0')
+        return;
+    size_t namelen = strip_trailing_space(p, eq - p);
+    char *value = eq + 1;
+    while (isspace((unsigned char) *value) && value < line + len)
+        value++;
+    *continuing = add_entry(config, section, p, namelen,
+                            value, len - (value - line));
+}
+
+static int
+add_hgrc_file(hgrc_t *config, const char *filename, int depth)
+{
+    FILE *file;
+    char line[4096], section[256] = "";
+    int continuing = 0;
+
+    file = fopen(filename, "r");
+    if (file == NULL) {
+        debug("error opening '%s': %s", filename, strerror(errno));
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file) != NULL)
+        parse_line(config, line, section, sizeof(section), &continuing,
+                   filename, depth);
+    fclose(file);
+    return 1;
+}
+
+int
+read_hgrc_file(hgrc_t *config, const char *filename)
+{
+    return add_hgrc_file(config, filename, 0);
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* Read the files in dirname whose names end in ".rc", in order. */
+static void
+read_hgrc_dir(hgrc_t *config, const char *dirname)
+{
+    DIR *dirp = opendir(dirname);
+    struct dirent *dirent;
+    char **names = NULL;
+    size_t count = 0, size = 0;
+
+    if (dirp == NULL)
+        return;
+    while ((dirent = readdir(dirp)) != NULL) {
+        size_t len = strlen(dirent->d_name);
+        if (len < 3 || strcmp(dirent->d_name + len - 3, ".rc") != 0)
+            continue;
+        if (count == size) {
+            size = size ? size * 2 : 16;
+            char **newnames = realloc(names, size * sizeof(char *));
+            if (newnames == NULL)
+                break;
+            names = newnames;
+        }
+        if ((names[count] = strdup(dirent->d_name)) != NULL)
+            count++;
+    }
+    closedir(dirp);
+    qsort(names, count, sizeof(char *), compare_names);
+    for (size_t i = 0; i < count; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dirname, names[i]);
+        read_hgrc_file(config, path);
+        free(names[i]);
+    }
+    free(names);
+}
+
+/* A file, or a directory of .rc files, as HGRCPATH may name. */
+static void
+read_hgrc_path(hgrc_t *config, char *path)
+{
+    if (isdir(path))
+        read_hgrc_dir(config, path);
+    else
+        read_hgrc_file(config, path);
+}
+
+void
+read_hgrc(hgrc_t *config)
+{
+    const char *home = getenv("HOME");
+    const char *xdg = getenv("XDG_CONFIG_HOME");
+    const char *env = getenv("HGRCPATH");
+    char path[PATH_MAX];
+
+    memset(config, 0, sizeof(hgrc_t));
+    if (env != NULL) {
+        const char *p = env, *colon;
+        do {
+            colon = strchr(p, ':');
+            size_t len = colon != NULL ? (size_t) (colon - p) : strlen(p);
+            if (len > 0 && len < sizeof(path)) {
+                snprintf(path, sizeof(path), "%.*s", (int) len, p);
+                read_hgrc_path(config, path);
+            }
+            p = colon + 1;
+        } while (colon != NULL);
+    }
+    else {
+        read_hgrc_file(config, "/etc/mercurial/hgrc");
+        read_hgrc_dir(config, "/etc/mercurial/hgrc.d");
+        if (home != NULL) {
+            snprintf(path, sizeof(path), "%s/.hgrc", home);
+            read_hgrc_file(config, path);
+        }
+        if (xdg != NULL && *xdg) {
+            snprintf(path, sizeof(path), "%s/hg/hgrc", xdg);
+            read_hgrc_file(config, path);
+        }
+        else if (home != NULL) {
+            snprintf(path, sizeof(path), "%s/.config/hg/hgrc", home);
+            read_hgrc_file(config, path);
+        }
+    }
+    if (getenv("HGRCSKIPREPO") == NULL)
+        read_hgrc_file(config, ".hg/hgrc");
+}
+
+void
+free_hgrc(hgrc_t *config)
+{
+    for (size_t i = 0; i < config->count; i++) {
+        free(config->entries[i].section);
+        free(config->entries[i].name);
+        free(config->entries[i].value);
+    }
+    free(config->entries);
+    config->entries = NULL;
+    config->count = config->size = 0;
+}
+
+const char *
+hgrc_get(const hgrc_t *config, const char *section, const char *name)
+{
+    /* the last one wins */
+    for (size_t i = config->count; i-- > 0; ) {
+        const hgrc_entry_t *entry = &config->entries[i];
+        if (strcmp(entry->name, name) == 0 &&
+            strcmp(entry->section, section) == 0)
+            return entry->value;
+    }
+    return NULL;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef HGRC_H
+#define HGRC_H
+
+#include <stddef.h>
+
+/* One "name = value" item of an hgrc file, in [section]. */
+typedef struct {
+    char *section;
+    char *name;
+    char *value;                        /* NULL after "%unset name" */
+} hgrc_entry_t;
+
+/* The items of one or more hgrc files, in the order Mercurial reads
+ * them, with "%include"d files spliced in: the last entry for an item
+ * wins.
+ */
+typedef struct {
+    hgrc_entry_t *entries;
+    size_t count, size;
+} hgrc_t;
+
+/* Read the config that hg would use in the repository in the current
+ * dir: the files in HGRCPATH if it is set, otherwise the system ones
+ * (/etc/mercurial/hgrc and the .rc files in /etc/mercurial/hgrc.d) and
+ * the user's (~/.hgrc and ~/.config/hg/hgrc); then .hg/hgrc, unless
+ * HGRCSKIPREPO is set.  Files that do not exist are skipped.  Caller
+ * must free config with free_hgrc().
+ */
+void
+read_hgrc(hgrc_t *config);
+
+/* Append the items of the hgrc file filename to config, which must be
+ * zeroed before the first call.  Return 1 if the file could be read.
+ */
+int
+read_hgrc_file(hgrc_t *config, const char *filename);
+
+void
+free_hgrc(hgrc_t *config);
+
+/* Return the value of name in section, or NULL if it is not set. */
+const char *
+hgrc_get(const hgrc_t *config, const char *section, const char *name);
+
+#endif
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "hgrevlog.h"
+
+#define NODEID_LEN 20
+
+/* RevlogNG index entry: offset and flags, compressed length,
+ * uncompressed length, base rev, link rev, parents, node ID (padded to
+ * 32 bytes); the first 4 bytes of entry 0 are the revlog's flags and
+ * version instead */
+#define ENTRY_LEN 64
+#define ENTRY_COMP_LEN 8
+#define ENTRY_NODEID 32
+#define REVLOGNG 1
+#define FLAG_INLINE_DATA (1 << 0)       /* of the high 16 bits */
+
+/* nodemap docket: version, id length, tip rev, data length, unused
+ * data, tip node length, id, tip node */
+#define NODEMAP_VERSION 1
+#define NODEMAP_HEADER_LEN 34
+#define NODEMAP_BLOCK_LEN (16 * 4)
+#define NODEMAP_NO_ENTRY (-1)
+
+/* mmap() the first *size bytes of filename, or all of it if *size is
+ * 0, in which case store its size in *size.  It must have at least
+ * minsize bytes.
+ */
+static const unsigned char *
+map_file(const char *filename, size_t minsize, size_t *size)
+{
+    struct stat statbuf;
+    void *data;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        debug("error opening '%s': %s", filename, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &statbuf) < 0 || statbuf.st_size == 0 ||
+        (size_t) statbuf.st_size < minsize) {
+        debug("'%s' is too short", filename);
+        close(fd);
+        return NULL;
+    }
+    if (*size == 0)
+        *size = statbuf.st_size;
+    data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        debug("failed to mmap() '%s': %s", filename, strerror(errno));
+        return NULL;
+    }
+    return data;
+}
+
+/* Find where each entry of an inline revlog starts: the data of each
+ * revision sits between its entry and the next, so there is no way
+ * but to read them all.  Mercurial only keeps small revlogs inline.
+ */
+static int
+find_inline_entries(hgrevlog_t *revlog)
+{
+    size_t maxentries = 0, offset = 0;
+
+    while (offset < revlog->size) {
+        if (revlog->size - offset < ENTRY_LEN)
+            return 0;
+        if (revlog->count == maxentries) {
+            maxentries = maxentries ? maxentries * 2 : 256;
+            const unsigned char **entries = realloc(
+                revlog->entries, maxentries * sizeof(*entries));
+            if (entries == NULL)
+                return 0;
+            revlog->entries = entries;
+        }
+        const unsigned char *entry = revlog->data + offset;
+        revlog->entries[revlog->count++] = entry;
+        uint32_t complen = get_be32(entry + ENTRY_COMP_LEN);
+        if (complen > revlog->size - offset - ENTRY_LEN)
+            return 0;
+        offset += ENTRY_LEN + complen;
+    }
+    return 1;
+}
+
+/* Use the persistent nodemap of storedir/name if there is one and it
+ * is for this revlog: the node ID of its tip must be the revlog's.
+ */
+static void
+open_nodemap(hgrevlog_t *revlog, const char *storedir, const char *name)
+{
+    char filename[PATH_MAX];
+    unsigned char docket[NODEMAP_HEADER_LEN + 2 * 256];
+    size_t len, idlen, nodelen, datalen;
+    uint64_t tip;
+
+    snprintf(filename, sizeof(filename), "%s/%s.n", storedir, name);
+    len = read_file(filename, (char *) docket, sizeof(docket));
+    if (len < NODEMAP_HEADER_LEN || docket[0] != NODEMAP_VERSION)
+        return;
+    idlen = docket[1];
+    tip = get_be64(docket + 2);
+    datalen = get_be64(docket + 10);
+    nodelen = get_be64(docket + 26);
+    if (nodelen != NODEID_LEN || len < NODEMAP_HEADER_LEN + idlen + nodelen ||
+        tip >= revlog->count ||
+        memcmp(revlog_node(revlog, tip),
+               docket + NODEMAP_HEADER_LEN + idlen, NODEID_LEN) != 0) {
+        debug("'%s' does not match the revlog: ignoring it", filename);
+        return;
+    }
+    if (datalen == 0 || datalen % NODEMAP_BLOCK_LEN != 0)
+        return;
+    if (snprintf(filename, sizeof(filename), "%s/%s-%.*s.nd",
+                 storedir, name, (int) idlen,
+                 docket + NODEMAP_HEADER_LEN) >= (int) sizeof(filename))
+        return;
+    /* the data file may have grown since the docket was written */
+    revlog->nodemap_size = datalen;
+    revlog->nodemap = map_file(filename, datalen, &revlog->nodemap_size);
+    if (revlog->nodemap == NULL)
+        return;
+    revlog->nodemap_blocks = datalen / NODEMAP_BLOCK_LEN;
+    revlog->nodemap_tip = tip;
+    debug("using nodemap '%s' (%u blocks, tip %u)", filename,
+          revlog->nodemap_blocks, revlog->nodemap_tip);
+}
+
+hgrevlog_t *
+open_hg_revlog(const char *storedir, const char *name)
+{
+    char filename[PATH_MAX];
+    hgrevlog_t *revlog;
+
+    revlog = calloc(1, sizeof(hgrevlog_t));
+    if (revlog == NULL)
+        return NULL;
+    snprintf(filename, sizeof(filename), "%s/%s.i", storedir, name);
+    revlog->data = map_file(filename, ENTRY_LEN, &revlog->size);
+    if (revlog->data == NULL)
+        goto err;
+
+    unsigned int flags = get_be16(revlog->data);
+    unsigned int version = get_be16(revlog->data + 2);
+    /* version 0 is taken for RevlogNG, as vcprompt always has */
+    if (version > REVLOGNG) {
+        debug("'%s': unsupported revlog version %u", filename, version);
+        goto err;
+    }
+    if (flags & FLAG_INLINE_DATA) {
+        if (!find_inline_entries(revlog)) {
+            debug("'%s': corrupt inline revlog", filename);
+            goto err;
+        }
+    }
+    else
+        revlog->count = revlog->size / ENTRY_LEN;
+    debug("read revlog '%s': %u revisions%s", filename, revlog->count,
+          revlog->entries != NULL ? " (inline)" : "");
+    open_nodemap(revlog, storedir, name);
+    return revlog;
+
+ err:
+    free_hg_revlog(revlog);
+    return NULL;
+}
+
+void
+free_hg_revlog(hgrevlog_t *revlog)
+{
+    if (revlog == NULL)
+        return;
+    if (revlog->data != NULL)
+        munmap((void *) revlog->data, revlog->size);
+    if (revlog->nodemap != NULL)
+        munmap((void *) revlog->nodemap, revlog->nodemap_size);
+    free(revlog->entries);
+    free(revlog);
+}
+
+const unsigned char *
+revlog_node(const hgrevlog_t *revlog, uint32_t rev)
+{
+    if (revlog->entries != NULL)
+        return revlog->entries[rev] + ENTRY_NODEID;
+    return revlog->data + (size_t) rev * ENTRY_LEN + ENTRY_NODEID;
+}
+
+/* Look nodeid up in the nodemap, one hex digit per level of the trie,
+ * until it reaches a revision (which need not be nodeid: the trie only
+ * goes as deep as it must to tell the node IDs it has apart).  Return
+ * 1 if found, 0 if the nodemap does not have it, -1 if it is corrupt.
+ */
+static int
+find_nodemap(const hgrevlog_t *revlog, const unsigned char *nodeid,
+             uint32_t *rev)
+{
+    uint32_t block = revlog->nodemap_blocks - 1;
+
+    for (int i = 0; i < 2 * NODEID_LEN; i++) {
+        unsigned int digit = i % 2 ? nodeid[i / 2] & 0xf : nodeid[i / 2] >> 4;
+        int32_t value = get_be32(revlog->nodemap +
+                                 (size_t) block * NODEMAP_BLOCK_LEN +
+                                 digit * 4);
+        if (value == NODEMAP_NO_ENTRY)
+            return 0;
+        if (value >= 0) {
+            if ((uint32_t) value >= revlog->nodemap_blocks)
+                return -1;
+            block = value;
+            continue;
+        }
+        *rev = -(value + 2);
+        if (*rev >= revlog->count)
+            return -1;
+        return memcmp(revlog_node(revlog, *rev), nodeid, NODEID_LEN) == 0;
+    }
+    return -1;
+}
+
+int
+find_revlog_node(const hgrevlog_t *revlog, const unsigned char *nodeid,
+                 uint32_t *rev)
+{
+    uint32_t stop = 0;
+
+    if (revlog->nodemap != NULL) {
+        int found = find_nodemap(revlog, nodeid, rev);
+        if (found > 0)
+            return 1;
+        /* revisions added since by an hg that does not keep the
+         * nodemap up to date are not in it */
+        if (found == 0)
+            stop = revlog->nodemap_tip + 1;
+        else
+            debug("corrupt nodemap: scanning the revlog");
+    }
+    for (uint32_t i = revlog->count; i-- > stop; ) {
+        if (memcmp(revlog_node(revlog, i), nodeid, NODEID_LEN) == 0) {
+            *rev = i;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef HGREVLOG_H
+#define HGREVLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The index of a Mercurial revlog (RevlogNG, e.g.
+ * .hg/store/00changelog.i): one 64-byte entry per revision, each
+ * followed by the revision's data if the revlog is inline.  The node
+ * ID of a revision is at offset 32 of its entry.
+ */
+typedef struct {
+    const unsigned char *data;          /* the .i file, mmap()ed */
+    size_t size;
+    uint32_t count;                     /* revisions */
+    const unsigned char **entries;      /* inline only: where each
+                                           entry starts */
+
+    /* The persistent nodemap (<name>.n, pointing to <name>-<id>.nd):
+     * a trie of 16-way blocks, one per hex digit of the node IDs, with
+     * the root block last.  It only covers the revisions up to
+     * nodemap_tip. */
+    const unsigned char *nodemap;       /* mmap()ed, NULL if none */
+    size_t nodemap_size;                /* of the mapping */
+    uint32_t nodemap_blocks;
+    uint32_t nodemap_tip;
+} hgrevlog_t;
+
+/* mmap() the revlog <storedir>/<name>.i and, if there is one and it
+ * matches, its persistent nodemap.  Return NULL if the index is missing,
+ * corrupt or of an unsupported version.  Caller must free the result
+ * with free_hg_revlog().
+ */
+hgrevlog_t *
+open_hg_revlog(const char *storedir, const char *name);
+
+void
+free_hg_revlog(hgrevlog_t *revlog);
+
+/* Return the binary node ID of revision rev, which must be less than
+ * revlog->count (it points into the revlog).
+ */
+const unsigned char *
+revlog_node(const hgrevlog_t *revlog, uint32_t rev);
+
+/* Find the revision whose node ID is nodeid, using the nodemap if
+ * there is one, and otherwise scanning back from the tip, which is
+ * where the working dir's parent usually is.  Store it in *rev and
+ * return 1, or return 0 if there is no such revision.
+ */
+int
+find_revlog_node(const hgrevlog_t *revlog, const unsigned char *nodeid,
+                 uint32_t *rev);
+
+#endif
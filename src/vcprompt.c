@@ -15,6 +15,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
@@ -49,6 +50,12 @@ static char* features[] = {
 #if HAVE_SQLITE3
     "svn-1.7",
     "svn-1.8",
+#endif
+#if HAVE_PTHREAD
+    "git-threads",
+#endif
+#if HAVE_ZLIB
+    "git-objects",
 #endif
     0,
 };
@@ -84,6 +91,14 @@ parse_args(int argc, char** argv, options_t *options)
                 "  %p  show patch name (MQ, guilt, ...)\n"
                 "  %u  indicate unknown (untracked) files\n"
                 "  %m  indicate uncommitted changes (modified/added/removed)\n"
+                "  %i  indicate staged changes (in the index)\n"
+                "  %w  indicate unstaged changes (in the working dir)\n"
+                "  %a  show commits ahead of/behind upstream (+N-M)\n"
+                "  %o  show operation in progress (merge, rebase, ...)\n"
+                "  %c  show number of files with conflicts\n"
+                "  %s  show number of stashes\n"
+                "  %t  show age of last commit\n"
+                "  %h  show heads of the branch, ^ if not at one\n"
                 "  %%  show '%'\n"
                 );
                 printf("Environment Variables:\n"
@@ -112,6 +127,14 @@ parse_format(options_t *options)
     options->show_patch = 0;
     options->show_unknown = 0;
     options->show_modified = 0;
+    options->show_staged = 0;
+    options->show_unstaged = 0;
+    options->show_ahead_behind = 0;
+    options->show_operation = 0;
+    options->show_conflicts = 0;
+    options->show_stashes = 0;
+    options->show_commit_age = 0;
+    options->show_heads = 0;
 
     char *format = options->format;
     size_t len = strlen(format);
@@ -138,6 +161,30 @@ parse_format(options_t *options)
                 case 'm':
                     options->show_modified = 1;
                     break;
+                case 'i':
+                    options->show_staged = 1;
+                    break;
+                case 'w':
+                    options->show_unstaged = 1;
+                    break;
+                case 'a':
+                    options->show_ahead_behind = 1;
+                    break;
+                case 'o':
+                    options->show_operation = 1;
+                    break;
+                case 'c':
+                    options->show_conflicts = 1;
+                    break;
+                case 's':
+                    options->show_stashes = 1;
+                    break;
+                case 't':
+                    options->show_commit_age = 1;
+                    break;
+                case 'h':
+                    options->show_heads = 1;
+                    break;
                 case '%':
                     break;
                 default:
@@ -150,6 +197,24 @@ parse_format(options_t *options)
     }
 }
 
+/* Print seconds as a short age: "45s", "10m", "3h", "2d", "1y". */
+static void
+print_age(long seconds)
+{
+    if (seconds < 0)
+        seconds = 0;            /* clock skew */
+    if (seconds < 60)
+        printf("%lds", seconds);
+    else if (seconds < 60 * 60)
+        printf("%ldm", seconds / 60);
+    else if (seconds < 24 * 60 * 60)
+        printf("%ldh", seconds / (60 * 60));
+    else if (seconds < 365 * 24 * 60 * 60)
+        printf("%ldd", seconds / (24 * 60 * 60));
+    else
+        printf("%ldy", seconds / (365 * 24 * 60 * 60));
+}
+
 void
 print_result(vccontext_t *context, options_t *options, result_t *result)
 {
@@ -185,6 +250,54 @@ print_result(vccontext_t *context, options_t *options, result_t *result)
                     if (result->modified)
                         putc('+', stdout);
                     break;
+                case 'i':
+                    if (result->staged)
+                        putc('+', stdout);
+                    break;
+                case 'w':
+                    if (result->unstaged)
+                        putc('*', stdout);
+                    break;
+                case 'a':
+                    if (result->ahead < 0 || result->behind < 0)
+                        putc('?', stdout);
+                    else {
+                        if (result->ahead > 0)
+                            printf("+%d", result->ahead);
+                        if (result->behind > 0)
+                            printf("-%d", result->behind);
+                    }
+                    break;
+                case 'o':
+                    if (result->operation != NULL)
+                        fputs(result->operation, stdout);
+                    break;
+                case 'c':
+                    if (result->conflicts < 0)
+                        putc('?', stdout);
+                    else if (result->conflicts > 0)
+                        printf("%d", result->conflicts);
+                    break;
+                case 's':
+                    if (result->stashes > 0)
+                        printf("%d", result->stashes);
+                    break;
+                case 't':
+                    if (result->commit_time < 0)
+                        putc('?', stdout);
+                    else if (result->commit_time > 0)
+                        print_age(time(NULL) - result->commit_time);
+                    break;
+                case 'h':
+                    if (result->heads < 0)
+                        putc('?', stdout);
+                    else if (result->heads > 1 ||
+                             (result->heads == 1 && !result->at_head)) {
+                        if (!result->at_head)
+                            putc('^', stdout);
+                        printf("%d", result->heads);
+                    }
+                    break;
                 case '%':               /* escaped % */
                     putc('%', stdout);
                     break;
@@ -288,6 +401,14 @@ main(int argc, char** argv)
         .show_revision = 0,
         .show_unknown  = 0,
         .show_modified = 0,
+        .show_staged = 0,
+        .show_unstaged = 0,
+        .show_ahead_behind = 0,
+        .show_operation = 0,
+        .show_conflicts = 0,
+        .show_stashes = 0,
+        .show_commit_age = 0,
+        .show_heads = 0,
         .show_features = 0,
     };
 
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/* Stand-in for "git fsmonitor--daemon", for testing vcprompt's
+ * fsmonitor client:
+ *
+ *   fsmonitor-daemon SOCKET TOKEN [PATH ...]
+ *
+ * listens on SOCKET and answers every query with TOKEN followed by
+ * PATHs, framed the way git's simple IPC does it, until killed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int
+read_all(int fd, char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n <= 0)
+            return 0;
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/* skip the request: pkt-lines up to a flush packet */
+static int
+read_request(int fd)
+{
+    char hdr[5], buf[65536];
+    unsigned int len;
+
+    while (read_all(fd, hdr, 4)) {
+        hdr[4] = '\0';
+        if (sscanf(hdr, "%4x", &len) != 1)
+            return 0;
+        if (len == 0)
+            return 1;
+        if (len < 4 || !read_all(fd, buf, len - 4))
+            return 0;
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sockaddr_un addr;
+    char hdr[5], reply[65536];
+    size_t len = 4;
+    int sock, fd, i;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s SOCKET TOKEN [PATH ...]\n", argv[0]);
+        return 2;
+    }
+    for (i = 2; i < argc; i++) {
+        size_t n = strlen(argv[i]) + 1;
+        if (len + n > sizeof(reply) - 4) {
+            fprintf(stderr, "%s: reply too long\n", argv[0]);
+            return 2;
+        }
+        memcpy(reply + len, argv[i], n);
+        len += n;
+    }
+    snprintf(hdr, sizeof(hdr), "%04zx", len);
+    memcpy(reply, hdr, 4);
+    memcpy(reply + len, "0000", 4);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    unlink(argv[1]);
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 ||
+        bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(sock, 5) < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    while ((fd = accept(sock, NULL, NULL)) >= 0) {
+        if (read_request(fd) &&
+            write(fd, reply, len + 4) != (ssize_t) (len + 4))
+            perror("write");
+        close(fd);
+    }
+    perror("accept");
+    return 1;
+}